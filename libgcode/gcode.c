@@ -24,12 +24,13 @@
 #include <stdio.h>
 #include <float.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <string.h>
 #include <libgen.h>
-#include <locale.h>
 #include <expat.h>
 #include "gcode_util.h"
 #include "gcode_sim.h"
+#include "gcode_compact.h"
 
 /**
  * Attaches 'block' as the first (and only) element of 'sel_block's' extruder;
@@ -333,11 +334,552 @@ gcode_get_circular_next (gcode_block_t **block)
     gcode_get_furthest_prev (block);
 }
 
+/**
+ * The top-level blocks shared out among the threads of 'gcode_list_make'; each
+ * pending block gets made from a tool position on entry ('entry') - the actual
+ * one if already known, one with open axes if not - and notes down where that
+ * leaves the tool, which the following block then has to start from.
+ */
+
+typedef struct gcode_make_job_s
+{
+  gcode_t *gcode;
+  gcode_block_t **block;                                                        /* top-level blocks, in order */
+  uint64_t *stamp;                                                              /* fingerprint of what each block gets made from */
+  gcode_vec3d_t *entry;                                                         /* tool position each pending block gets made from */
+  uint8_t *pending;                                                             /* set for the blocks to be (re)made */
+  pthread_mutex_t lock;                                                         /* protects next_block */
+  pthread_t caller;
+  int block_number;
+  int next_block;
+} gcode_make_job_t;
+
+/**
+ * Point 'block', its extruder and all of its children (all the way down) to the
+ * project 'gcode'; the working copies a make creates inherit it from them.
+ */
+
+static void
+gcode_make_context (gcode_block_t *block, gcode_t *gcode)
+{
+  gcode_block_t *index_block;
+
+  block->gcode = gcode;
+
+  if (block->extruder)
+    gcode_make_context (block->extruder, gcode);
+
+  for (index_block = block->listhead; index_block; index_block = index_block->next)
+    gcode_make_context (index_block, gcode);
+}
+
+/**
+ * Add 'size' bytes at 'data' to the running (FNV-1a) 'hash'
+ */
+
+uint64_t
+gcode_make_hash (uint64_t hash, const void *data, size_t size)
+{
+  const uint8_t *byte;
+  size_t i;
+
+  byte = (const uint8_t *)data;
+
+  for (i = 0; i < size; i++)
+    hash = (hash ^ byte[i]) * 0x100000001B3ULL;
+
+  return (hash);
+}
+
+/**
+ * Whether the code of 'block' (and all of its children) only depends on what
+ * its fingerprint covers: a begin block writes the time of its making into its
+ * code, and an STL block makes from slices it never saves.
+ */
+
+static int
+gcode_make_reusable (gcode_block_t *block)
+{
+  gcode_block_t *index_block;
+
+  if (block->type == GCODE_TYPE_BEGIN || block->type == GCODE_TYPE_STL)
+    return (0);
+
+  for (index_block = block->listhead; index_block; index_block = index_block->next)
+    if (!gcode_make_reusable (index_block))
+      return (0);
+
+  return (1);
+}
+
+/**
+ * The fingerprint of everything the code of 'block' gets made from, except for
+ * the tool position it starts from: its own data and that of all its children
+ * (as written by 'save' in the binary format, with every value in full), its
+ * offset, the tool it uses and the project settings; 0 if the code can not be
+ * reused at all.
+ */
+
+static uint64_t
+gcode_make_stamp (gcode_block_t *block)
+{
+  gcode_t *gcode, context;
+  gcode_tool_t *tool;
+  FILE *fh;
+  char *buffer;
+  size_t size;
+  uint64_t hash;
+
+  if (!gcode_make_reusable (block))
+    return (0);
+
+  buffer = NULL;
+  size = 0;
+
+  fh = open_memstream (&buffer, &size);
+
+  if (!fh)
+    return (0);
+
+  gcode = block->gcode;
+
+  context = *gcode;
+  context.format = GCODE_FORMAT_BIN;
+
+  gcode_make_context (block, &context);
+
+  block->save (block, fh);
+
+  gcode_make_context (block, gcode);
+
+  fclose (fh);
+
+  hash = 0xCBF29CE484222325ULL;
+
+  hash = gcode_make_hash (hash, buffer, size);
+
+  free (buffer);
+
+  hash = gcode_make_hash (hash, &block->type, sizeof (uint8_t));
+  hash = gcode_make_hash (hash, &block->flags, sizeof (uint8_t));
+  hash = gcode_make_hash (hash, block->comment, strlen (block->comment) + 1);
+  hash = gcode_make_hash (hash, block->offset, sizeof (gcode_offset_t));
+
+  tool = gcode_tool_find (block);
+
+  if (tool)
+  {
+    hash = gcode_make_hash (hash, &tool->diameter, sizeof (gfloat_t));
+    hash = gcode_make_hash (hash, &tool->length, sizeof (gfloat_t));
+    hash = gcode_make_hash (hash, &tool->prompt, sizeof (uint8_t));
+    hash = gcode_make_hash (hash, tool->label, strlen (tool->label) + 1);
+    hash = gcode_make_hash (hash, &tool->hinc, sizeof (gfloat_t));
+    hash = gcode_make_hash (hash, &tool->vinc, sizeof (gfloat_t));
+    hash = gcode_make_hash (hash, &tool->feed, sizeof (gfloat_t));
+    hash = gcode_make_hash (hash, tool->change_position, 3 * sizeof (gfloat_t));
+    hash = gcode_make_hash (hash, &tool->number, sizeof (uint8_t));
+    hash = gcode_make_hash (hash, &tool->plunge_ratio, sizeof (gfloat_t));
+    hash = gcode_make_hash (hash, &tool->spindle_rpm, sizeof (uint32_t));
+    hash = gcode_make_hash (hash, &tool->coolant, sizeof (uint8_t));
+  }
+
+  hash = gcode_make_hash (hash, gcode->name, strlen (gcode->name) + 1);
+  hash = gcode_make_hash (hash, gcode->notes, strlen (gcode->notes) + 1);
+  hash = gcode_make_hash (hash, &gcode->units, sizeof (uint8_t));
+  hash = gcode_make_hash (hash, gcode->material_size, 3 * sizeof (gfloat_t));
+  hash = gcode_make_hash (hash, gcode->material_origin, 3 * sizeof (gfloat_t));
+  hash = gcode_make_hash (hash, &gcode->ztraverse, sizeof (gfloat_t));
+  hash = gcode_make_hash (hash, &gcode->roughing_overlap, sizeof (gfloat_t));
+  hash = gcode_make_hash (hash, &gcode->padding_fraction, sizeof (gfloat_t));
+  hash = gcode_make_hash (hash, &gcode->fit_tolerance, sizeof (gfloat_t));
+  hash = gcode_make_hash (hash, &gcode->driver, sizeof (uint8_t));
+  hash = gcode_make_hash (hash, &gcode->machine_options, sizeof (uint8_t));
+  hash = gcode_make_hash (hash, &gcode->drilling_motion, sizeof (uint8_t));
+  hash = gcode_make_hash (hash, &gcode->pocketing_style, sizeof (uint8_t));
+  hash = gcode_make_hash (hash, &gcode->decimals, sizeof (uint32_t));
+  hash = gcode_make_hash (hash, &gcode->project_number, sizeof (uint32_t));
+
+  return (hash | 1);
+}
+
+/**
+ * Whether the code 'block' was last made would also be made starting from the
+ * tool position 'entry': it was made from the same position along each of the
+ * axes that were not left open, and compared the tool with none of those that
+ * were at a position 'entry' is at.
+ */
+
+static int
+gcode_make_fits (gcode_block_t *block, gcode_vec3d_t entry)
+{
+  gcode_make_probe_t *probe;
+  int i;
+
+  for (i = 0; i < 3; i++)
+    if (block->make_entry[i] != GCODE_OPEN_POSITION && block->make_entry[i] != entry[i])
+      return (0);
+
+  probe = &block->make_probe;
+
+  if (probe->number > GCODE_MAKE_PROBES)
+    return (0);
+
+  for (i = 0; i < probe->number; i++)
+    if (GCODE_MATH_IS_EQUAL (entry[probe->axis[i]], probe->value[i]))
+      return (0);
+
+  return (1);
+}
+
+/**
+ * Where the code 'block' was last made leaves the tool if started from 'entry'
+ * (the axes it never moved along stay where they were); 'exit' may be 'entry'.
+ */
+
+static void
+gcode_make_exit (gcode_block_t *block, gcode_vec3d_t entry, gcode_vec3d_t exit)
+{
+  int i;
+
+  for (i = 0; i < 3; i++)
+    exit[i] = (block->make_exit[i] == GCODE_OPEN_POSITION) ? entry[i] : block->make_exit[i];
+}
+
+/**
+ * Whether the code 'block' was last made is still what a make would make now:
+ * made from the same inputs ('stamp' being their fingerprint) and fitting the
+ * tool position 'entry' it would start from now.
+ */
+
+static int
+gcode_make_current (gcode_block_t *block, uint64_t stamp, gcode_vec3d_t entry)
+{
+  if (!stamp || stamp != block->make_stamp)
+    return (0);
+
+  return (gcode_make_fits (block, entry));
+}
+
+/**
+ * Make 'block' from where the tool is now, noting down what from: the inputs
+ * ('stamp' being their fingerprint), the tool position it started from (open
+ * axes included) with what it compared that to, and where it left the tool.
+ */
+
+static void
+gcode_make_code (gcode_block_t *block, uint64_t stamp)
+{
+  block->make_entry[0] = block->gcode->tool_xpos;
+  block->make_entry[1] = block->gcode->tool_ypos;
+  block->make_entry[2] = block->gcode->tool_zpos;
+
+  block->make_probe.number = 0;
+  block->gcode->make_probe = &block->make_probe;
+
+  block->make (block);
+
+  block->gcode->make_probe = NULL;
+
+  block->make_stamp = stamp;
+
+  block->make_exit[0] = block->gcode->tool_xpos;
+  block->make_exit[1] = block->gcode->tool_ypos;
+  block->make_exit[2] = block->gcode->tool_zpos;
+}
+
+/**
+ * Make 'block', unless it was last made from the very same inputs and from a
+ * tool position its code fits the current one of - in which case it is still
+ * what it would make, and only the tool position gets updated.
+ */
+
+static void
+gcode_make (gcode_block_t *block)
+{
+  gcode_vec3d_t position;
+  uint64_t stamp;
+
+  stamp = gcode_make_stamp (block);
+
+  GCODE_MATH_VEC3D_SET (position, block->gcode->tool_xpos, block->gcode->tool_ypos, block->gcode->tool_zpos);
+
+  if (gcode_make_current (block, stamp, position))
+  {
+    gcode_make_exit (block, position, position);
+
+    block->gcode->tool_xpos = position[0];
+    block->gcode->tool_ypos = position[1];
+    block->gcode->tool_zpos = position[2];
+    return;
+  }
+
+  gcode_make_code (block, stamp);
+}
+
+/**
+ * Guess where 'block' (not made yet from there) leaves the tool if it starts
+ * at 'position', updating that: begin and code blocks never move it (which is
+ * no guess but a fact - the only case this returns 1 for), a tool block only
+ * to the tool change height (if it prompts for the change), and every other
+ * block leaves it at the traverse height - or where it did when last made.
+ */
+
+static int
+gcode_make_guess (gcode_block_t *block, gcode_vec3d_t position)
+{
+  gcode_tool_t *tool;
+
+  switch (block->type)
+  {
+    case GCODE_TYPE_BEGIN:
+    case GCODE_TYPE_CODE:
+      return (1);
+
+    case GCODE_TYPE_TOOL:
+      tool = (gcode_tool_t *)block->pdata;
+
+      if (tool->prompt)
+        position[2] = tool->change_position[2];
+      break;
+
+    default:
+      if (block->make_stamp && block->make_exit[2] != GCODE_OPEN_POSITION)
+        position[2] = block->make_exit[2];
+      else if (!block->make_stamp)
+        position[2] = block->gcode->material_origin[2] + block->gcode->ztraverse;
+      break;
+  }
+
+  return (0);
+}
+
+/**
+ * Make block 'i' of 'job' on a private copy of the project, so that the tool
+ * position it tracks is its own: it starts from 'entry', and the block notes
+ * down where it ends up in 'make_exit'. The make of the block itself shares
+ * its work among 'threads' threads - just 1 for blocks made side by side, so
+ * the threads of the make don't each start as many again.
+ */
+
+static void
+gcode_make_block (gcode_make_job_t *job, int i, gcode_vec3d_t entry, int threads)
+{
+  gcode_t context;
+  gcode_block_t *block;
+
+  block = job->block[i];
+
+  context = *job->gcode;
+
+  context.tool_xpos = entry[0];
+  context.tool_ypos = entry[1];
+  context.tool_zpos = entry[2];
+
+  context.make_threads = threads;
+
+  gcode_make_context (block, &context);
+
+  gcode_make_code (block, job->stamp[i]);
+
+  gcode_make_context (block, job->gcode);
+}
+
+/**
+ * Worker thread of 'gcode_make_run': keep taking blocks off the shared counter
+ * and make the ones pending from their 'entry'; only the calling thread reports
+ * progress.
+ */
+
+static void *
+gcode_make_worker (void *data)
+{
+  gcode_make_job_t *job;
+  int i;
+
+  job = (gcode_make_job_t *)data;
+
+  for (;;)
+  {
+    pthread_mutex_lock (&job->lock);
+    i = job->next_block++;
+    pthread_mutex_unlock (&job->lock);
+
+    if (i >= job->block_number)
+      break;
+
+    if (!job->pending[i])
+      continue;
+
+    if (pthread_equal (pthread_self (), job->caller) && job->gcode->progress_callback)
+      job->gcode->progress_callback (job->gcode->gui, (gfloat_t)i / (gfloat_t)job->block_number);
+
+    gcode_make_block (job, i, job->entry[i], 1);
+  }
+
+  return (NULL);
+}
+
+/**
+ * Make all the pending blocks of 'job' on 'threads' threads (the calling one included)
+ */
+
+static void
+gcode_make_run (gcode_make_job_t *job, int threads)
+{
+  pthread_t thread[GCODE_MAKE_MAX_THREADS];
+  int i, started;
+
+  job->next_block = 0;
+
+  started = 0;
+
+  for (i = 1; i < threads; i++)
+  {
+    if (pthread_create (&thread[started], NULL, gcode_make_worker, job) == 0)
+      started++;
+  }
+
+  gcode_make_worker (job);
+
+  for (i = 0; i < started; i++)
+    pthread_join (thread[i], NULL);
+}
+
+/**
+ * Make the top-level blocks on several threads: blocks only depend on each other
+ * through the tool position one leaves and the next starts from (which decides
+ * what moves can be left out). First, a walk in order finds the blocks whose
+ * code is not current any more; those get made all at once, each exactly once:
+ * from the actual tool position as long as every block before it is current,
+ * and from one with X and Y left open (and a guess at Z) past the first that is
+ * not. Last, a walk in order takes each block's code as it is if it fits where
+ * its predecessor really left the tool, and makes it again (right here) only if
+ * it does not - the code ends up exactly the same as if made one block after
+ * the other, and blocks still current are not made at all. Returns 1 (having
+ * made nothing) if the working memory could not be allocated.
+ */
+
+static int
+gcode_list_make_parallel (gcode_t *gcode, int block_count, int threads)
+{
+  gcode_make_job_t job;
+  gcode_block_t *index_block;
+  gcode_vec3d_t position;
+  int i, known;
+
+  job.gcode = gcode;
+  job.block = malloc (block_count * sizeof (gcode_block_t *));
+  job.stamp = malloc (block_count * sizeof (uint64_t));
+  job.entry = malloc (block_count * sizeof (gcode_vec3d_t));
+  job.pending = malloc (block_count * sizeof (uint8_t));
+  job.block_number = block_count;
+  job.caller = pthread_self ();
+
+  if (!job.block || !job.stamp || !job.entry || !job.pending)
+  {
+    REMARK ("Failed to allocate memory for parallel G-code generation\n");
+    free (job.block);
+    free (job.stamp);
+    free (job.entry);
+    free (job.pending);
+    return (1);
+  }
+
+  GCODE_MATH_VEC3D_SET (position, FLT_MAX, FLT_MAX, FLT_MAX);
+
+  known = 1;                                                                    // Whether 'position' is where the tool actually is, not just a guess at Z
+
+  i = 0;
+
+  for (index_block = gcode->listhead; index_block; index_block = index_block->next, i++)
+  {
+    job.block[i] = index_block;
+    job.stamp[i] = gcode_make_stamp (index_block);
+
+    if (known)
+      job.pending[i] = gcode_make_current (index_block, job.stamp[i], position) ? 0 : 1;
+    else
+      job.pending[i] = (job.stamp[i] && job.stamp[i] == index_block->make_stamp) ? 0 : 1;
+
+    if (job.pending[i])
+    {
+      if (!known)
+      {
+        position[0] = GCODE_OPEN_POSITION;
+        position[1] = GCODE_OPEN_POSITION;
+      }
+
+      GCODE_MATH_VEC3D_COPY (job.entry[i], position);
+
+      if (!gcode_make_guess (index_block, position))
+        known = 0;
+    }
+    else
+    {
+      gcode_make_exit (index_block, position, position);
+    }
+  }
+
+  pthread_mutex_init (&job.lock, NULL);
+
+  gcode_make_run (&job, threads);
+
+  pthread_mutex_destroy (&job.lock);
+
+  GCODE_MATH_VEC3D_SET (position, FLT_MAX, FLT_MAX, FLT_MAX);
+
+  for (i = 0; i < block_count; i++)
+  {
+    if (!gcode_make_fits (job.block[i], position))
+      gcode_make_block (&job, i, position, gcode->make_threads);
+
+    gcode_make_exit (job.block[i], position, position);
+  }
+
+  gcode->tool_xpos = position[0];
+  gcode->tool_ypos = position[1];
+  gcode->tool_zpos = position[2];
+
+  free (job.block);
+  free (job.stamp);
+  free (job.entry);
+  free (job.pending);
+
+  return (0);
+}
+
+/**
+ * Number of threads to share 'work_count' independent pieces of making among:
+ * the 'make_threads' setting (0 meaning one per online processor) but no more
+ * than GCODE_MAKE_MAX_THREADS or the number of pieces there are to share out;
+ */
+
+int
+gcode_make_threads (gcode_t *gcode, int work_count)
+{
+  int threads;
+
+  threads = gcode->make_threads;
+
+#ifdef _SC_NPROCESSORS_ONLN
+  if (threads == 0)
+    threads = sysconf (_SC_NPROCESSORS_ONLN);
+#endif
+
+  if (threads > GCODE_MAKE_MAX_THREADS)
+    threads = GCODE_MAKE_MAX_THREADS;
+
+  if (threads > work_count)
+    threads = work_count;
+
+  return (threads);
+}
+
 void
 gcode_list_make (gcode_t *gcode)
 {
   gcode_block_t *index_block;
-  int block_count, block_index;
+  int block_count, block_index, threads;
 
   block_count = 0;
 
@@ -359,29 +901,31 @@ gcode_list_make (gcode_t *gcode)
   gcode->tool_ypos = FLT_MAX;
   gcode->tool_zpos = FLT_MAX;
 
-  setlocale(LC_NUMERIC, "C");                                                   // Setting the numeric locale back to "decimal point" while generating the g-code
+  threads = gcode_make_threads (gcode, block_count);
 
-  block_index = 0;
+  if (threads < 2 || gcode_list_make_parallel (gcode, block_count, threads))
+  {
+    block_index = 0;
 
-  index_block = gcode->listhead;
+    index_block = gcode->listhead;
 
-  while (index_block)
-  {
-    if (gcode->progress_callback)
-      gcode->progress_callback (gcode->gui, (gfloat_t)block_index / (gfloat_t)block_count);
+    while (index_block)
+    {
+      if (gcode->progress_callback)
+        gcode->progress_callback (gcode->gui, (gfloat_t)block_index / (gfloat_t)block_count);
 
-    /* Make the G-Code */
-    index_block->make (index_block);
+      /* Make the G-Code */
+      gcode_make (index_block);
 
-    block_index++;
+      block_index++;
 
-    index_block = index_block->next;
+      index_block = index_block->next;
+    }
   }
 
   if (gcode->progress_callback)                                                 // Clean up the progress bar before we leave;
     gcode->progress_callback (gcode->gui, 0.0);
 
-  setlocale(LC_NUMERIC, "");                                                    // Returning the numeric locale back to its system-suggested original value
 }
 
 void
@@ -511,7 +1055,7 @@ gcode_xml_char (void *parser, const char *data, int length)
             scan3 = scan2;                                                      // We need a two-level history of the scanning pointer:
             scan2 = scan1;                                                      // scan1 = current, scan2 = previous, scan3 = before previous.
 
-            array[context->index] = strtod (scan1, &scan1);                     // Find one float-type number and store it into the depth map;
+            array[context->index] = gstrtod (scan1, &scan1);                    // Find one float-type number and store it into the depth map;
 
             context->index++;                                                   // Increment the array index.
           }
@@ -880,23 +1424,39 @@ gcode_init (gcode_t *gcode)
   gcode->zero_offset.z[0] = 0.0;
   gcode->zero_offset.z[1] = 0.0;
 
+  gcode->stock_model = GCODE_STOCK_VOXEL_MAP;
+  gcode->sim_mode = GCODE_SIM_STEPPED;
+  gcode->sim_threads = 0;
+  gcode->make_threads = 0;
+  gcode->compact_output = 0;
+  gcode->subprograms = 0;
+
   gcode->voxel_resolution = 0;
 
   gcode->voxel_number[0] = 0;
   gcode->voxel_number[1] = 0;
   gcode->voxel_number[2] = 0;
 
-  gcode->voxel_map = NULL;
+  gcode->voxel_layout = GCODE_VOXEL_BYTE;
+  gcode_voxel_init (&gcode->voxel_map);
+
+  gcode->height_resolution = 0;
+  gcode->height_map = NULL;
+
+  gcode->sim_history = NULL;
 
   gcode->curve_segments = 0;
 
   gcode->roughing_overlap = 0;
   gcode->padding_fraction = 0;
+  gcode->fit_tolerance = 0;
 
   gcode->tool_xpos = FLT_MAX;
   gcode->tool_ypos = FLT_MAX;
   gcode->tool_zpos = FLT_MAX;
 
+  gcode->make_probe = NULL;
+
   gcode->format = GCODE_FORMAT_TBD;                                             // Initial file format = "to be determined" (at first save or load)
   gcode->driver = GCODE_DRIVER_LINUXCNC;
 
@@ -913,10 +1473,44 @@ gcode_init (gcode_t *gcode)
 void
 gcode_prep (gcode_t *gcode)
 {
-  uint32_t size;
+  size_t size;
   gcode_vec3d_t portion;
   gfloat_t inv_den;
 
+  gcode_sim_history_free (gcode);
+
+  if (gcode->stock_model == GCODE_STOCK_HEIGHT_MAP)
+  {
+    /**
+     * A height map only needs cells along X and Y, each holding the top Z level
+     * of the remaining material; the resolution is shared by those two axes.
+     */
+
+    inv_den = 1.0 / (gcode->material_size[0] + gcode->material_size[1]);
+
+    portion[0] = gcode->material_size[0] * inv_den;
+    portion[1] = gcode->material_size[1] * inv_den;
+
+    gcode->voxel_number[0] = (uint32_t)(gcode->height_resolution * portion[0]);
+    gcode->voxel_number[1] = (uint32_t)(gcode->height_resolution * portion[1]);
+    gcode->voxel_number[2] = 1;
+
+    if (gcode->voxel_number[0] == 0)
+      gcode->voxel_number[0] = 1;
+
+    if (gcode->voxel_number[1] == 0)
+      gcode->voxel_number[1] = 1;
+
+    size = (size_t)gcode->voxel_number[0] * (size_t)gcode->voxel_number[1];
+
+    gcode_voxel_free (&gcode->voxel_map);
+
+    gcode->height_map = realloc (gcode->height_map, size * sizeof (uint16_t));
+    memset (gcode->height_map, 0xFF, size * sizeof (uint16_t));                // All bits set is GCODE_HEIGHT_MAP_TOP
+
+    return;
+  }
+
   inv_den = 1.0 / (gcode->material_size[0] + gcode->material_size[1] + gcode->material_size[2]);
 
   portion[0] = gcode->material_size[0] * inv_den;
@@ -924,9 +1518,9 @@ gcode_prep (gcode_t *gcode)
   portion[2] = gcode->material_size[2] * inv_den;
 
   /* Setup voxels */
-  gcode->voxel_number[0] = (uint16_t)(gcode->voxel_resolution * portion[0]);
-  gcode->voxel_number[1] = (uint16_t)(gcode->voxel_resolution * portion[1]);
-  gcode->voxel_number[2] = (uint16_t)(gcode->voxel_resolution * portion[2]);
+  gcode->voxel_number[0] = (uint32_t)(gcode->voxel_resolution * portion[0]);
+  gcode->voxel_number[1] = (uint32_t)(gcode->voxel_resolution * portion[1]);
+  gcode->voxel_number[2] = (uint32_t)(gcode->voxel_resolution * portion[2]);
 
   if (gcode->voxel_number[0] == 0)
     gcode->voxel_number[0] = 1;
@@ -937,18 +1531,30 @@ gcode_prep (gcode_t *gcode)
   if (gcode->voxel_number[2] == 0)
     gcode->voxel_number[2] = 1;
 
-  size = gcode->voxel_number[0] * gcode->voxel_number[1] * gcode->voxel_number[2];
+  free (gcode->height_map);
+  gcode->height_map = NULL;
 
-  gcode->voxel_map = realloc (gcode->voxel_map, size);
-  memset (gcode->voxel_map, 1, size);
+  if (gcode_voxel_prep (&gcode->voxel_map, gcode->voxel_layout, gcode->voxel_number))
+  {
+    REMARK ("Not enough memory for a %u x %u x %u voxel map\n", gcode->voxel_number[0], gcode->voxel_number[1], gcode->voxel_number[2]);
+
+    /* Keep a single voxel rather than no map at all, so simulating stays safe */
+    gcode->voxel_number[0] = 1;
+    gcode->voxel_number[1] = 1;
+    gcode->voxel_number[2] = 1;
+
+    gcode_voxel_prep (&gcode->voxel_map, gcode->voxel_layout, gcode->voxel_number);
+  }
 }
 
 void
 gcode_free (gcode_t *gcode)
 {
   gcode_list_free (&gcode->listhead);
-  free (gcode->voxel_map);
-  gcode->voxel_map = NULL;
+  gcode_sim_history_free (gcode);
+  gcode_voxel_free (&gcode->voxel_map);
+  free (gcode->height_map);
+  gcode->height_map = NULL;
 }
 
 int
@@ -968,8 +1574,6 @@ gcode_save (gcode_t *gcode, char *filename)
     return (1);
   }
 
-  setlocale(LC_NUMERIC, "C");                                                   // Setting the numeric locale back to "decimal point" while saving the project
-
   if (gcode->format == GCODE_FORMAT_TBD)                                        // If the file format is not determined yet, choose one based on the file extension
   {
     gcode->format = GCODE_FORMAT_BIN;                                           // Unless subsequently changed, set format to binary by default
@@ -1144,8 +1748,6 @@ gcode_save (gcode_t *gcode, char *filename)
     fwrite (&fsize, sizeof (uint32_t), 1, fh);
   }
 
-  setlocale(LC_NUMERIC, "");                                                    // Returning the numeric locale back to its system-suggested original value
-
   fclose (fh);
 
   return (0);
@@ -1172,16 +1774,6 @@ gcode_load (gcode_t *gcode, char *filename)
     return (result);
   }
 
-  /**
-   * Set the numeric locale to C (Minimal) so that all numeric output
-   * uses the period as the decimal separator since most G-Gcode drivers
-   * are only compatible with a period decimal separator.  This allows
-   * the user interface in GCAM to display a comma decimal separator
-   * for locales that call for that format.
-   */
-
-  setlocale (LC_NUMERIC, "C");
-
   switch (gcode->format)
   {
     case GCODE_FORMAT_BIN:
@@ -1465,19 +2057,223 @@ gcode_load (gcode_t *gcode, char *filename)
 
   fclose (fh);
 
-  /* Restore Locale to previous value */
-  setlocale (LC_NUMERIC, "");
-
   return (result);
 }
 
+/**
+ * Write the pieces of 'rope' straight to 'fh', dropping any line break past the
+ * second in a row (leaving at most one empty line) - 'newlines' is the count of
+ * line breaks just written, so it carries on from piece to piece, block to block.
+ */
+
+static void
+gcode_export_code (FILE *fh, gcode_rope_t *rope, uint32_t *newlines)
+{
+  gcode_rope_piece_t *piece;
+  char *sp, *tsp, *ep;
+  uint32_t i;
+
+  for (i = 0; i < rope->piece_number; i++)
+  {
+    piece = &rope->piece[i];
+
+    sp = &piece->chunk->data[piece->offset];
+    ep = sp + piece->len;
+
+    while (sp < ep)
+    {
+      for (tsp = sp; tsp < ep && !(*tsp == '\n' && *newlines >= 2); tsp++)
+        *newlines = (*tsp == '\n') ? *newlines + 1 : 0;
+
+      fwrite (sp, 1, tsp - sp, fh);
+
+      while (tsp < ep && *tsp == '\n')
+        tsp++;
+
+      sp = tsp;
+    }
+  }
+}
+
+/**
+ * Write 'rope' to the file, through the compaction stage if that is enabled
+ */
+
+static void
+gcode_export_rope (gcode_t *gcode, FILE *fh, gcode_compact_t *compact, gcode_rope_t *rope, uint32_t *newlines)
+{
+  if (gcode->compact_output)
+    gcode_compact_rope (compact, rope);
+  else
+    gcode_export_code (fh, rope, newlines);
+}
+
+/**
+ * Write the text 'string' to the file, the same way as the code of a block
+ */
+
+static void
+gcode_export_text (gcode_t *gcode, FILE *fh, gcode_compact_t *compact, const char *string, uint32_t *newlines)
+{
+  gcode_rope_t rope;
+
+  gcode_rope_init (&rope);
+  gcode_rope_append (&rope, string, strlen (string));
+
+  gcode_export_rope (gcode, fh, compact, &rope, newlines);
+
+  gcode_rope_free (&rope);
+}
+
+/**
+ * A fingerprint of what the children of the top-level template 'block' make,
+ * wherever they are: the children of a clone get moved so that the corner of
+ * their bounds falls on the origin, and saved as XML (whose 6 decimals cover
+ * the rounding a move may leave behind). Two templates with equal prints (and
+ * the same tool) make the same code, only shifted by the distance between the
+ * corners, which goes into 'corner'. Returns 0 for a template whose code its
+ * fingerprint cannot vouch for.
+ */
+
+static uint64_t
+gcode_export_copy_stamp (gcode_block_t *block, gcode_vec2d_t corner)
+{
+  gcode_t *gcode, context;
+  gcode_block_t *copy, *index_block;
+  gcode_template_t *template;
+  gcode_vec2d_t max, delta;
+  FILE *fh;
+  char *buffer;
+  size_t size;
+  uint64_t hash;
+
+  if (!block->listhead || !gcode_make_reusable (block))
+    return (0);
+
+  block->aabb (block, corner, max, GCODE_GET);
+
+  if (corner[0] > max[0] || corner[1] > max[1])
+    return (0);
+
+  buffer = NULL;
+  size = 0;
+
+  fh = open_memstream (&buffer, &size);
+
+  if (!fh)
+    return (0);
+
+  gcode = block->gcode;
+
+  gcode_template_clone (&copy, gcode, block);
+
+  delta[0] = -corner[0];
+  delta[1] = -corner[1];
+
+  copy->move (copy, delta);
+
+  context = *gcode;
+  context.format = GCODE_FORMAT_XML;
+
+  for (index_block = copy->listhead; index_block; index_block = index_block->next)
+  {
+    gcode_make_context (index_block, &context);
+
+    index_block->save (index_block, fh);
+
+    gcode_make_context (index_block, gcode);
+  }
+
+  copy->free (&copy);
+
+  fclose (fh);
+
+  hash = 0xCBF29CE484222325ULL;
+
+  hash = gcode_make_hash (hash, buffer, size);
+
+  free (buffer);
+
+  template = (gcode_template_t *)block->pdata;
+
+  hash = gcode_make_hash (hash, template->position, sizeof (gcode_vec2d_t));
+  hash = gcode_make_hash (hash, &template->rotation, sizeof (gfloat_t));
+
+  return (hash ? hash : 1);
+}
+
+/**
+ * Find the top-level templates that are copies of an earlier one: 'model[i]' is
+ * set to the index of the first of the copies block 'i' belongs to (itself, for
+ * that first one), or -1 for a block with no copies (or no template at all);
+ * 'corner[i]' is where the bounds of the children of a template begin.
+ * Returns the number of different templates that have copies.
+ */
+
+static int
+gcode_export_find_copies (gcode_block_t **block_list, int block_count, int *model, gcode_vec2d_t *corner)
+{
+  gcode_block_t *block;
+  uint64_t *stamp;
+  int copy_count, i, j;
+
+  for (i = 0; i < block_count; i++)
+    model[i] = -1;
+
+  stamp = malloc (block_count * sizeof (uint64_t));
+
+  if (!stamp)
+    return (0);
+
+  copy_count = 0;
+
+  for (i = 0; i < block_count; i++)
+  {
+    block = block_list[i];
+
+    stamp[i] = 0;
+
+    if (block->type != GCODE_TYPE_TEMPLATE || (block->flags & GCODE_FLAGS_SUPPRESS))
+      continue;
+
+    stamp[i] = gcode_export_copy_stamp (block, corner[i]);
+
+    if (!stamp[i])
+      continue;
+
+    for (j = 0; j < i; j++)
+    {
+      if (stamp[j] != stamp[i] || gcode_tool_find (block_list[j]) != gcode_tool_find (block))
+        continue;
+
+      if (model[j] < 0)
+      {
+        model[j] = j;
+        copy_count++;
+      }
+
+      model[i] = model[j];
+
+      break;
+    }
+  }
+
+  free (stamp);
+
+  return (copy_count);
+}
+
 int
 gcode_export (gcode_t *gcode, char *filename)
 {
   FILE *fh;
-  char *code;
-  size_t code_size;
-  gcode_block_t *index_block;
+  int result, block_count, block_index, copy_count, program_count, *model, *program;
+  uint32_t newlines;
+  gcode_compact_t compact;
+  gcode_block_t *index_block, **block_list;
+  gcode_template_t *template;
+  gcode_vec2d_t shift, *corner;
+  char string[512], comment[256];                                               // Room for a template comment and the code around it
 
   fh = fopen (filename, "w");
 
@@ -1487,6 +2283,8 @@ gcode_export (gcode_t *gcode, char *filename)
     return (1);
   }
 
+  setvbuf (fh, NULL, _IOFBF, GCODE_ROPE_CHUNK_SIZE);                            // Writes go out a chunk's worth at a time, whatever the size of the program;
+
   /**
    * Set appropriate number of decimals given driver
    */
@@ -1506,299 +2304,317 @@ gcode_export (gcode_t *gcode, char *filename)
       break;
   }
 
-  /* Make all */
-  gcode_list_make (gcode);
+  block_count = 0;
 
-  code_size = 1;
+  for (index_block = gcode->listhead; index_block; index_block = index_block->next)
+    block_count++;
 
-  code = malloc (code_size);
+  block_list = malloc ((block_count + 1) * sizeof (gcode_block_t *));
+  model = malloc ((block_count + 1) * sizeof (int));
+  program = malloc ((block_count + 1) * sizeof (int));
+  corner = malloc ((block_count + 1) * sizeof (gcode_vec2d_t));
 
-  if (!code)
+  if (!block_list || !model || !program || !corner)
   {
-    REMARK ("Failed to allocate memory for G-code export buffer\n");
+    free (block_list);
+    free (model);
+    free (program);
+    free (corner);
     fclose (fh);
+    REMARK ("Failed to allocate memory for G-code export\n");
     return (1);
   }
 
-  code[0] = '\0';
+  block_index = 0;
 
-  index_block = gcode->listhead;
+  for (index_block = gcode->listhead; index_block; index_block = index_block->next)
+    block_list[block_index++] = index_block;
 
-  while (index_block)
+  /**
+   * With subprograms enabled, the code of the first of several copies of a
+   * top-level template gets written once as a subprogram (the 'O<n> sub' kind
+   * on LinuxCNC, a separate 'O' program after M30 on Haas), each copy calling
+   * it with a local offset (G52) shifting it where that copy is; the copies
+   * after the first are not even made. TurboCNC has no subprograms to call.
+   */
+
+  copy_count = 0;
+
+  if (gcode->subprograms && gcode->driver != GCODE_DRIVER_TURBOCNC)
+    copy_count = gcode_export_find_copies (block_list, block_count, model, corner);
+
+  /**
+   * Same as 'gcode_list_make', except that each block gets written to the file
+   * as soon as it is made (or found still up to date), one after the other.
+   */
+
+  gcode->tool_xpos = FLT_MAX;
+  gcode->tool_ypos = FLT_MAX;
+  gcode->tool_zpos = FLT_MAX;
+
+  newlines = 0;
+
+  if (gcode->compact_output)
+    gcode_compact_init (&compact, fh, gcode->driver);
+
+  program_count = 0;
+
+  for (block_index = 0; block_index < block_count; block_index++)
   {
-    code_size += strlen (index_block->code);
+    index_block = block_list[block_index];
 
-    code = realloc (code, code_size);
+    if (gcode->progress_callback)
+      gcode->progress_callback (gcode->gui, (gfloat_t)block_index / (gfloat_t)block_count);
 
-    if (!code)
+    if (!copy_count || model[block_index] < 0)
     {
-      REMARK ("Failed to reallocate memory for G-code export buffer\n");
-      fclose (fh);
-      return (1);
+      gcode_make (index_block);
+
+      gcode_export_rope (gcode, fh, &compact, &index_block->code, &newlines);
+
+      continue;
     }
 
-    strcat (code, index_block->code);
+    strncpy (comment, index_block->comment, 200);
+    comment[200] = '\0';
+    strswp (comment, '(', '[');
+    strswp (comment, ')', ']');
 
-    index_block = index_block->next;
+    if (model[block_index] == block_index)
+    {
+      /**
+       * The first copy gets made from an unknown tool position, so that its code
+       * does not depend on where the tool was before any of the calls.
+       */
+
+      gcode->tool_xpos = FLT_MAX;
+      gcode->tool_ypos = FLT_MAX;
+      gcode->tool_zpos = FLT_MAX;
+
+      gcode_make (index_block);
+
+      program[block_index] = ++program_count;
+
+      if (gcode->driver == GCODE_DRIVER_HAAS)
+      {
+        snprintf (string, sizeof (string), "\n(TEMPLATE: %s)\nM98 P%d\n", comment, gcode->project_number + program_count);
+        gcode_export_text (gcode, fh, &compact, string, &newlines);
+      }
+      else
+      {
+        sprintf (string, "\nO%d sub\n", 100 + program_count);
+        gcode_export_text (gcode, fh, &compact, string, &newlines);
+
+        gcode_export_rope (gcode, fh, &compact, &index_block->code, &newlines);
+
+        sprintf (string, "%sO%d endsub\nO%d call\n", gcode_rope_last (&index_block->code) == '\n' ? "" : "\n", 100 + program_count, 100 + program_count);
+        gcode_export_text (gcode, fh, &compact, string, &newlines);
+      }
+    }
+    else
+    {
+      template = (gcode_template_t *)index_block->pdata;
+
+      shift[0] = corner[block_index][0] - corner[model[block_index]][0];
+      shift[1] = corner[block_index][1] - corner[model[block_index]][1];
+
+      GCODE_MATH_ROTATE (shift, shift, index_block->offset->rotation + template->rotation);
+
+      if (gcode->driver == GCODE_DRIVER_HAAS)
+        gsprintf (string, gcode->decimals, "\n(TEMPLATE: %s)\nG52 X%z Y%z\nM98 P%d\nG52 X0 Y0\n", comment, shift[0], shift[1], gcode->project_number + program[model[block_index]]);
+      else
+        gsprintf (string, gcode->decimals, "\n(TEMPLATE: %s)\nG52 X%z Y%z\nO%d call\nG52 X0 Y0\n", comment, shift[0], shift[1], 100 + program[model[block_index]]);
+
+      gcode_export_text (gcode, fh, &compact, string, &newlines);
+    }
+
+    gcode->tool_xpos = FLT_MAX;                                                 // Where a call leaves the tool is up to the subprogram
+    gcode->tool_ypos = FLT_MAX;
+    gcode->tool_zpos = FLT_MAX;
   }
 
-  gcode_util_filter_newlines (code);                                            // This just removes multiple empty lines in the text (leaving max. one);
+  if (gcode->driver == GCODE_DRIVER_HAAS)
+  {
+    for (block_index = 0; program_count && block_index < block_count; block_index++)
+    {
+      if (model[block_index] != block_index)
+        continue;
 
-  code_size = strlen (code);                                                    // Sine we messed with the text, its length should be re-evaluated;
+      index_block = block_list[block_index];
 
-  fwrite (code, 1, code_size, fh);
+      sprintf (string, "\nO%.5d\n", gcode->project_number + program[block_index]);
+      gcode_export_text (gcode, fh, &compact, string, &newlines);
 
-  fclose (fh);
+      gcode_export_rope (gcode, fh, &compact, &index_block->code, &newlines);
+
+      sprintf (string, "%sM99\n", gcode_rope_last (&index_block->code) == '\n' ? "" : "\n");
+      gcode_export_text (gcode, fh, &compact, string, &newlines);
+    }
+
+    gcode_export_text (gcode, fh, &compact, "%\n", &newlines);
+  }
 
-  free (code);
+  if (gcode->compact_output)
+    gcode_compact_finish (&compact);
+
+  free (block_list);
+  free (model);
+  free (program);
+  free (corner);
+
+  result = ferror (fh) ? 1 : 0;
+
+  if (fclose (fh))
+    result = 1;
+
+  if (result)
+    REMARK ("Failed to write file '%s'\n", basename (filename));
 
   if (gcode->progress_callback)
     gcode->progress_callback (gcode->gui, 0.0);
 
-  return (0);
+  return (result);
 }
 
 void
 gcode_render_final (gcode_t *gcode, gfloat_t *time_elapsed)
 {
-  char *code;
-  size_t code_size;
-  gcode_block_t *index_block;
+  gcode_block_t *start_block, *index_block;
+  gcode_motion_state_t state;
+  gcode_motion_list_t list;
   gcode_sim_t sim;
-  char line[256], *sp, *tsp, *gv;
-  uint32_t size, line_count, line_index, mode = 0;
-  gfloat_t G83_depth = 0.0;
-  gfloat_t G83_retract = 0.0;
+  gcode_rope_piece_t *piece;
+  char line[256], *sp, *tsp, *ep;
+  size_t len, join, code_size, code_done;
+  uint32_t i, block, block_number, first;
+  uint64_t hash, *block_hash;
 
   /* Make all */
   gcode_list_make (gcode);
 
   gcode_sim_init (&sim, gcode);
+  gcode_motion_state_init (&state, gcode);
+  gcode_motion_list_init (&list);
 
   sim.vn_inv[0] = 1.0 / (gfloat_t)gcode->voxel_number[0];
   sim.vn_inv[1] = 1.0 / (gfloat_t)gcode->voxel_number[1];
   sim.vn_inv[2] = 1.0 / (gfloat_t)gcode->voxel_number[2];
 
-  /* Turn all the voxels back on */
-  size = gcode->voxel_number[0] * gcode->voxel_number[1] * gcode->voxel_number[2];
-  memset (gcode->voxel_map, 1, size);
+  block_number = 0;
 
-  code_size = 1;
+  for (index_block = gcode->listhead; index_block; index_block = index_block->next)
+    block_number++;
 
-  code = malloc (code_size);
+  block_hash = malloc ((block_number + 1) * sizeof (uint64_t));
 
-  if (!code)
+  if (!block_hash)
   {
-    REMARK ("Failed to allocate memory for G-code simulation buffer\n");
+    REMARK ("Failed to allocate memory for G-code simulation\n");
+    gcode_sim_free (&sim);
     return;
   }
 
-  code[0] = '\0';
+  /**
+   * Each top-level block gets a hash of all the code up to its end (FNV-1a),
+   * which is what tells the checkpoints still valid from the previous render;
+   * a block not ending on a line break shares its last line with the next one
+   * and gets no checkpoint (hash 0) so it is never resumed from in the middle.
+   */
 
-  index_block = gcode->listhead;
+  hash = 0xCBF29CE484222325ULL;
+  block = 0;
 
-  while (index_block)
+  for (index_block = gcode->listhead; index_block; index_block = index_block->next)
   {
-    code_size += strlen (index_block->code);
-
-    code = realloc (code, code_size);
-
-    if (!code)
+    for (i = 0; i < index_block->code.piece_number; i++)
     {
-      REMARK ("Failed to reallocate memory for G-code simulation buffer\n");
-      return;
-    }
-
-    strcat (code, index_block->code);
+      piece = &index_block->code.piece[i];
 
-    index_block = index_block->next;
-  }
-
-  /* Count the number of lines */
-  line_count = 0;
-  sp = code;
+      for (sp = &piece->chunk->data[piece->offset], ep = sp + piece->len; sp < ep; sp++)
+        hash = (hash ^ (uint8_t)*sp) * 0x100000001B3ULL;
+    }
 
-  while ((tsp = strchr (sp, '\n')))
-  {
-    sp = tsp + 1;
-    line_count++;
+    block_hash[block++] = (gcode_rope_last (&index_block->code) == '\n') ? hash | 1 : 0;
   }
 
-  setlocale(LC_NUMERIC, "C");                                                   // Setting the numeric locale back to "decimal point" while parsing the g-code
-
-  /* Isolate each line */
-  line_index = 0;
-  sp = code;
+  /* Roll the stock back to where the code starts to differ from the last render */
+  first = gcode_sim_resume (gcode, &sim, &state, block_hash, block_number);
 
-  while ((tsp = strchr (sp, '\n')))
-  {
-    uint8_t sind;
+  start_block = gcode->listhead;
 
-    if (gcode->progress_callback)
-      gcode->progress_callback (gcode->gui, (gfloat_t)line_index / (gfloat_t)line_count);
+  for (block = 0; block < first; block++)
+    start_block = start_block->next;
 
-    memset (line, 0, 256);
-    memcpy (line, sp, tsp - sp);
-    sp = tsp + 1;
-    sind = 0;
+  code_size = 0;
 
-    /**
-     * Parse the line
-     */
+  for (index_block = start_block; index_block; index_block = index_block->next)
+    code_size += index_block->code.len;
 
-    /* Scan for comments of the form (Tool diameter: VALUE) */
-    gv = strstr (line, "Tool Diameter:");
+  /**
+   * Walk the pieces of each block's code in place, one line at a time; only a
+   * line split between two pieces gets pieced together, with its head carried
+   * in 'line'. Each block gets compiled into motions first, then simulated.
+   */
 
-    if (gv)
-    {
-      char string[256];
-      uint8_t len;
-
-      gv = strpbrk (line, ".0123456789");
-      len = strspn (gv, ".0123456789");
-      memset (string, 0, 256);
-      memcpy (string, gv, len);
-      sim.tool_diameter = atof (string);
-    }
+  join = 0;
+  code_done = 0;
 
-    /* Scan for comments of the form (Origin offset: X=VALUE Y=VALUE Z=VALUE) */
-    gv = strstr (line, "Origin Offset:");
+  block = first;
 
-    if (gv)
+  for (index_block = start_block; index_block; index_block = index_block->next, block++)
+  {
+    for (i = 0; i < index_block->code.piece_number; i++)
     {
-      char string[256];
-      uint8_t len;
-
-      gv = strpbrk (gv, ".0123456789");
-      len = strspn (gv, ".0123456789");
-      memset (string, 0, 256);
-      memcpy (string, gv, len);
-      sim.origin[0] = atof (string);
-      sim.pos[0] += sim.origin[0];
-
-      gv += len;
-      gv = strpbrk (gv, ".0123456789");
-      len = strspn (gv, ".0123456789");
-      memset (string, 0, 256);
-      memcpy (string, gv, len);
-      sim.origin[1] = atof (string);
-      sim.pos[1] += sim.origin[1];
-
-      gv += len;
-      gv = strpbrk (gv, ".0123456789");
-      len = strspn (gv, ".0123456789");
-      memset (string, 0, 256);
-      memcpy (string, gv, len);
-      sim.origin[2] = atof (string);
-      sim.pos[2] += sim.origin[2];
-    }
-
-    /* Remove the spaces */
-    gcode_util_remove_spaces (line);
+      piece = &index_block->code.piece[i];
 
-    /* Strip comments */
-    gcode_util_remove_comment (line);
+      sp = &piece->chunk->data[piece->offset];
+      ep = sp + piece->len;
 
-    switch (line[sind])
-    {
-      case 'G':
+      while ((tsp = memchr (sp, '\n', ep - sp)))
       {
-        uint8_t len;
-        char string[256];
-
-        sind++;
-
-        /* The Number */
-        len = strspn (&line[sind], "0123456789");
-        memset (string, 0, 256);
-        memcpy (string, &line[sind], len);
-        sind += len;
-
-        switch (atoi (string))
-        {
-          case 0:
-            gcode_sim_G00 (gcode, &sim, &line[sind]);
-            break;
+        if (gcode->progress_callback)
+          gcode->progress_callback (gcode->gui, (gfloat_t)code_done / (gfloat_t)code_size);
 
-          case 1:
-            gcode_sim_G01 (gcode, &sim, &line[sind]);
-            break;
+        len = tsp - sp;
 
-          case 2:
-            gcode_sim_G02 (gcode, &sim, &line[sind]);
-            break;
+        if (join + len > sizeof (line) - 1)
+          len = sizeof (line) - 1 - join;
 
-          case 3:
-            gcode_sim_G03 (gcode, &sim, &line[sind]);
-            break;
+        memcpy (&line[join], sp, len);
+        line[join + len] = '\0';
+        join = 0;
 
-          case 4:
-            /* Dwell */
-            break;
+        code_done += tsp + 1 - sp;
+        sp = tsp + 1;
 
-          case 20:
-            break;
-
-          case 21:
-            break;
-
-          case 81:
-          case 83:
-            gcode_sim_G83 (gcode, &sim, &line[sind], &G83_depth, &G83_retract, 1);
-            mode = 83;
-            break;
-
-          case 90:
-            sim.absolute = 1;
-            break;
-
-          case 91:
-            sim.absolute = 0;
-            break;
-
-          default:
-            break;
-        }
-        break;
+        gcode_motion_compile_line (&list, &state, line, block);
       }
 
-      case 'F':
-      {
-        char string[256];
-        uint8_t len;
+      /* Keep a trailing partial line for the next piece to finish */
+      len = ep - sp;
+      code_done += len;
 
-        sind++;
+      if (join + len > sizeof (line) - 1)
+        len = sizeof (line) - 1 - join;
 
-        len = strspn (&line[sind], ".0123456789");
-        memset (string, 0, 256);
-        memcpy (string, &line[sind], len);
-        sim.feed = atof (string);
-        break;
-      }
-
-      case 'X':
-      case 'Y':
-      {
-        if (mode == 83)
-        {
-          gcode_sim_G83 (gcode, &sim, &line[sind], &G83_depth, &G83_retract, 0);
-        }
-        break;
-      }
-
-      default:
-        break;
+      memcpy (&line[join], sp, len);
+      join += len;
     }
 
-    line_index++;
+    /* Carve the block once compiled, checkpointing the stock */
+    gcode_sim_run (gcode, &sim, &list);
+    gcode_sim_checkpoint (gcode, &sim, &state, block_hash[block]);
+
+    list.number = 0;
   }
 
-  setlocale(LC_NUMERIC, "");                                                    // Returning the numeric locale back to its system-suggested original value
+  gcode_sim_flush (gcode, &sim);
 
-  free (code);
+  gcode_motion_list_free (&list);
+  free (block_hash);
 
   /* Calculate elapsed time */
-  sim.time_elapsed = 60 * sim.time_elapsed / sim.feed;
+  sim.time_elapsed = 60 * sim.time_elapsed / state.feed;
 
   *time_elapsed = sim.time_elapsed;
   gcode_sim_free (&sim);
@@ -67,6 +67,8 @@ void gcode_get_furthest_next (gcode_block_t **block);
 void gcode_get_circular_prev (gcode_block_t **block);
 void gcode_get_circular_next (gcode_block_t **block);
 
+uint64_t gcode_make_hash (uint64_t hash, const void *data, size_t size);
+int gcode_make_threads (gcode_t *gcode, int work_count);
 void gcode_list_make (gcode_t *gcode);
 void gcode_list_free (gcode_block_t **list);
 
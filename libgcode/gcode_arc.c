@@ -77,7 +77,7 @@ gcode_arc_init (gcode_block_t **block, gcode_t *gcode, gcode_block_t *parent)
 void
 gcode_arc_free (gcode_block_t **block)
 {
-  free ((*block)->code);
+  GCODE_FREE ((*block));
   free ((*block)->pdata);
   free (*block);
   *block = NULL;
@@ -58,7 +58,7 @@ gcode_begin_init (gcode_block_t **block, gcode_t *gcode, gcode_block_t *parent)
 void
 gcode_begin_free (gcode_block_t **block)
 {
-  free ((*block)->code);
+  GCODE_FREE ((*block));
   free ((*block)->pdata);
   free (*block);
   *block = NULL;
@@ -145,6 +145,7 @@ gcode_begin_make (gcode_block_t *block)
 {
   gcode_begin_t *begin;
   char string[256], nrcode[32], date_string[32];
+  struct tm date;
   time_t timer;
 
   begin = (gcode_begin_t *)block->pdata;
@@ -163,7 +164,7 @@ gcode_begin_make (gcode_block_t *block)
   GCODE_COMMENT (block, string);
 
   timer = time (NULL);
-  strcpy (date_string, asctime (localtime (&timer)));
+  asctime_r (localtime_r (&timer, &date), date_string);                         // Blocks may get made on several threads - keep to the reentrant variants;
   date_string[strlen (date_string) - 1] = 0;
   sprintf (string, "Created: %s with GCAM SE v%s", date_string, VERSION);
   GCODE_COMMENT (block, string);
@@ -111,7 +111,7 @@ gcode_bolt_holes_free (gcode_block_t **block)
     tmp->free (&tmp);
   }
 
-  free ((*block)->code);
+  GCODE_FREE ((*block));
   free ((*block)->pdata);
   free (*block);
   *block = NULL;
@@ -273,7 +273,7 @@ gcode_bolt_holes_make (gcode_block_t *block)
         offset_block->offset->z[1] = z;
 
         offset_block->make (offset_block);                                      // There is only ever 1 arc...
-        GCODE_APPEND (block, offset_block->code);
+        GCODE_SPLICE (block, offset_block);
 
         free (offset_block->offset);                                            // The specially created zero-offset is no longer needed;
         gcode_list_free (&offset_block);                                        // This depth has been built - get rid of the snapshot;
@@ -786,6 +786,8 @@ gcode_bolt_holes_clone (gcode_block_t **block, gcode_t *gcode, gcode_block_t *mo
   bolt_holes->offset_angle = model_bolt_holes->offset_angle;
   bolt_holes->offset = model_bolt_holes->offset;
 
+  (*block)->extruder->free (&(*block)->extruder);                               // Scrap the default extruder 'init' came up with, the clone replaces it
+
   model->extruder->clone (&new_block, gcode, model->extruder);                  // Acquire a clone of the model's extruder, referenced as 'new_block'
 
   gcode_attach_as_extruder (*block, new_block);                                 // Attach the brand new extrusion clone as the extruder of this block
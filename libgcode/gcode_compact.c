@@ -0,0 +1,594 @@
+/**
+ *  gcode_compact.c
+ *  Source code file for G-Code generation, simulation, and visualization
+ *  library.
+ *
+ *  Copyright (C) 2006 - 2010 by Justin Shumaker
+ *  Copyright (C) 2014 - 2020 by Asztalos Attila Oszkár
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gcode_compact.h"
+#include "gcode_internal.h"
+
+#define GCODE_COMPACT_MAX_WORDS     16                                          /* More words than this on a line and it gets written out as it is */
+
+/**
+ * Number rules per driver, indexed by GCODE_DRIVER_*: LinuxCNC reads ".5" and
+ * "1" just fine, TurboCNC gets to keep its leading zeros, while Haas (as every
+ * Fanuc-style control) needs the decimal point on whole numbers ("X1.").
+ */
+
+static const gcode_compact_policy_t gcode_compact_policy[] =
+{
+  { 0, 0 },                                                                     // GCODE_DRIVER_LINUXCNC
+  { 0, 1 },                                                                     // GCODE_DRIVER_TURBOCNC
+  { 1, 0 },                                                                     // GCODE_DRIVER_HAAS
+};
+
+typedef struct gcode_compact_word_s
+{
+  char letter;
+  char number[GCODE_COMPACT_WORD_SIZE];                                         // As it is to be written, trailing zeros and all trimmed
+  uint8_t integer;                                                              // The number had no decimal point (and so is written unchanged)
+  uint8_t dropped;
+} gcode_compact_word_t;
+
+/**
+ * Forget everything the controller is known to have in effect - after any line
+ * the compaction does not follow the meaning of (tool changes, canned cycles...)
+ */
+
+static void
+gcode_compact_forget (gcode_compact_t *compact)
+{
+  compact->motion = -1;
+  compact->input_motion = -1;
+  compact->feed[0] = '\0';
+  compact->axis[0][0] = '\0';
+  compact->axis[1][0] = '\0';
+  compact->axis[2][0] = '\0';
+}
+
+void
+gcode_compact_init (gcode_compact_t *compact, FILE *fh, uint8_t driver)
+{
+  compact->fh = fh;
+  compact->policy = &gcode_compact_policy[driver < sizeof (gcode_compact_policy) / sizeof (gcode_compact_policy_t) ? driver : GCODE_DRIVER_LINUXCNC];
+  compact->len = 0;
+  compact->overflow = 0;
+  compact->blank = 1;
+  compact->absolute = 0;                                                        // Not taken for granted until a G90 goes out
+  compact->pending_feed[0] = '\0';
+
+  gcode_compact_forget (compact);
+}
+
+/**
+ * Read the number at 'sp' into 'word', trimmed as the driver allows: trailing
+ * zeros go, leading zeros (but maybe one) go, and so does the sign of a zero;
+ * numbers with no decimal point (G01, T01, O00001) are kept exactly as they are.
+ * Returns the number of characters read, or 0 if there is no number at 'sp'.
+ */
+
+static int
+gcode_compact_number (gcode_compact_t *compact, const char *sp, gcode_compact_word_t *word)
+{
+  const char *tsp, *ip, *fp;
+  int ilen, flen, negative, point;
+  char *dp;
+
+  tsp = sp;
+
+  negative = 0;
+
+  if (*tsp == '-' || *tsp == '+')
+    negative = (*tsp++ == '-');
+
+  for (ip = tsp; *tsp >= '0' && *tsp <= '9'; tsp++);
+
+  ilen = tsp - ip;
+
+  point = (*tsp == '.');
+
+  if (point)
+    tsp++;
+
+  for (fp = tsp; *tsp >= '0' && *tsp <= '9'; tsp++);
+
+  flen = tsp - fp;
+
+  if ((ilen + flen == 0) || (tsp - sp >= GCODE_COMPACT_WORD_SIZE))
+    return (0);
+
+  word->integer = !point;
+
+  if (!point)
+  {
+    memcpy (word->number, sp, tsp - sp);
+    word->number[tsp - sp] = '\0';
+
+    return (tsp - sp);
+  }
+
+  while (ilen > 0 && *ip == '0')
+  {
+    ip++;
+    ilen--;
+  }
+
+  while (flen > 0 && fp[flen - 1] == '0')
+    flen--;
+
+  dp = word->number;
+
+  if (ilen + flen == 0)                                                         // Zero, and "-0.000" is zero too
+  {
+    *dp++ = '0';
+
+    if (compact->policy->keep_point)
+      *dp++ = '.';
+
+    *dp = '\0';
+
+    return (tsp - sp);
+  }
+
+  if (negative)
+    *dp++ = '-';
+
+  if (ilen == 0 && (compact->policy->keep_lead_zero || flen == 0))
+    *dp++ = '0';
+
+  memcpy (dp, ip, ilen);
+  dp += ilen;
+
+  if (flen > 0 || compact->policy->keep_point)
+    *dp++ = '.';
+
+  memcpy (dp, fp, flen);
+  dp += flen;
+
+  *dp = '\0';
+
+  return (tsp - sp);
+}
+
+/**
+ * Split 'line' (not terminated) into words - up to the start of its comment,
+ * which 'comment' gets set to point at (or to the end of the line, if none).
+ * Returns the number of words, or -1 if the line is not made of words.
+ */
+
+static int
+gcode_compact_parse (gcode_compact_t *compact, char *line, uint32_t len, gcode_compact_word_t *word, char **comment)
+{
+  char *sp, *ep, held;
+  int word_number, read;
+
+  ep = line + len;
+
+  for (sp = line; sp < ep && *sp != '(' && *sp != ';'; sp++);
+
+  *comment = sp;
+
+  held = *sp;                                                                   // The buffer has room for this past 'len' - see 'gcode_compact_rope'
+  *sp = '\0';
+
+  word_number = 0;
+
+  for (sp = line; *sp; )
+  {
+    if (*sp == ' ' || *sp == '\t' || *sp == '\r')
+    {
+      sp++;
+      continue;
+    }
+
+    if (*sp < 'A' || *sp > 'Z' || word_number == GCODE_COMPACT_MAX_WORDS)
+    {
+      word_number = -1;
+      break;
+    }
+
+    word[word_number].letter = *sp++;
+    word[word_number].dropped = 0;
+
+    read = gcode_compact_number (compact, sp, &word[word_number]);
+
+    if (!read)
+    {
+      word_number = -1;
+      break;
+    }
+
+    sp += read;
+    word_number++;
+  }
+
+  **comment = held;
+
+  return (word_number);
+}
+
+/**
+ * Write the motion word and the feed rate asked for but not yet written (if
+ * any) on a line of their own, before a line the compaction does not follow
+ * the meaning of - so the controller has in effect what the code asked for.
+ */
+
+static void
+gcode_compact_flush_pending (gcode_compact_t *compact)
+{
+  int first;
+
+  first = 1;
+
+  if (compact->input_motion >= 0 && compact->input_motion != compact->motion)
+  {
+    fprintf (compact->fh, "G%02d", compact->input_motion);
+    compact->motion = compact->input_motion;
+    first = 0;
+  }
+
+  if (compact->pending_feed[0])
+  {
+    fprintf (compact->fh, first ? "F%s" : " F%s", compact->pending_feed);
+    strcpy (compact->feed, compact->pending_feed);
+    compact->pending_feed[0] = '\0';
+    first = 0;
+  }
+
+  if (first)
+    return;
+
+  fputc ('\n', compact->fh);
+
+  compact->blank = 0;
+}
+
+/**
+ * Write out the words (the ones not dropped) and the comment of a line, after
+ * the motion word 'motion' if the line has to say it but does not (or -1).
+ */
+
+static void
+gcode_compact_write (gcode_compact_t *compact, int motion, gcode_compact_word_t *word, int word_number, const char *feed, const char *comment, uint32_t comment_len)
+{
+  int i, first;
+
+  first = 1;
+
+  if (motion >= 0)
+  {
+    fprintf (compact->fh, "G%02d", motion);
+    first = 0;
+  }
+
+  for (i = 0; i < word_number; i++)
+  {
+    if (word[i].dropped)
+      continue;
+
+    fprintf (compact->fh, first ? "%c%s" : " %c%s", word[i].letter, word[i].number);
+    first = 0;
+  }
+
+  if (feed)
+  {
+    fprintf (compact->fh, first ? "F%s" : " F%s", feed);
+    first = 0;
+  }
+
+  if (comment_len)
+  {
+    if (!first)
+      fputc (' ', compact->fh);
+
+    fwrite (comment, 1, comment_len, compact->fh);
+  }
+
+  fputc ('\n', compact->fh);
+
+  compact->blank = 0;
+}
+
+/**
+ * Work out what a line of motion (G00 - G03, X, Y, Z, I, J and F words only)
+ * still needs to say, given what the controller already has in effect: the
+ * motion word if it changes, the axes that move and the feed rate if it is a
+ * new one - the latter put off until the next feed move that actually moves.
+ * A line that moves nowhere goes, but the motion and feed rate it asks for are
+ * kept, and said by the next line that does get written.
+ */
+
+static void
+gcode_compact_motion (gcode_compact_t *compact, gcode_compact_word_t *word, int word_number, int motion, const char *comment, uint32_t comment_len)
+{
+  const char *feed;
+  int i, axis, moves, said;
+
+  compact->input_motion = motion;
+
+  moves = 0;
+  said = 0;
+
+  for (i = 0; i < word_number; i++)
+  {
+    switch (word[i].letter)
+    {
+      case 'G':
+
+        word[i].dropped = (motion == compact->motion);
+        said = 1;
+
+        break;
+
+      case 'F':
+
+        strcpy (compact->pending_feed, word[i].number);
+        word[i].dropped = 1;
+
+        break;
+
+      case 'X':
+      case 'Y':
+      case 'Z':
+
+        axis = word[i].letter - 'X';
+
+        if (motion <= 1 && compact->absolute && strcmp (compact->axis[axis], word[i].number) == 0)
+          word[i].dropped = 1;
+        else
+          moves = 1;
+
+        break;
+
+      default:                                                                  // I and J
+
+        moves = 1;
+
+        break;
+    }
+  }
+
+  if (!moves)                                                                   // Nothing left that would make the tool go anywhere: the line goes, comment and all
+    return;                                                                     // (the motion and feed rate it asked for are still pending)
+
+  feed = NULL;
+
+  if (motion >= 1 && compact->pending_feed[0])
+  {
+    if (strcmp (compact->pending_feed, compact->feed) != 0)
+    {
+      strcpy (compact->feed, compact->pending_feed);
+      feed = compact->feed;
+    }
+
+    compact->pending_feed[0] = '\0';
+  }
+
+  gcode_compact_write (compact, (!said && motion != compact->motion) ? motion : -1, word, word_number, feed, comment, comment_len);
+
+  compact->motion = motion;
+
+  for (i = 0; i < word_number; i++)
+  {
+    if (word[i].letter < 'X' || word[i].letter > 'Z')
+      continue;
+
+    axis = word[i].letter - 'X';
+
+    if (compact->absolute)
+      strcpy (compact->axis[axis], word[i].number);
+    else
+      compact->axis[axis][0] = '\0';
+  }
+}
+
+/**
+ * Compact one (not terminated) line of 'len' bytes at 'line' into the file
+ */
+
+static void
+gcode_compact_line (gcode_compact_t *compact, char *line, uint32_t len)
+{
+  gcode_compact_word_t word[GCODE_COMPACT_MAX_WORDS];
+  char *comment;
+  uint32_t comment_len;
+  int i, word_number, motion, seen, axes;
+
+  while (len > 0 && (line[len - 1] == ' ' || line[len - 1] == '\r'))
+    len--;
+
+  if (len == 0)                                                                 // At most one empty line in a row, as ever
+  {
+    if (!compact->blank)
+      fputc ('\n', compact->fh);
+
+    compact->blank = 1;
+
+    return;
+  }
+
+  word_number = gcode_compact_parse (compact, line, len, word, &comment);
+
+  if (word_number < 0)                                                          // Not something to make sense of ('%' and such): written out as it is
+  {
+    gcode_compact_flush_pending (compact);
+
+    fwrite (line, 1, len, compact->fh);
+    fputc ('\n', compact->fh);
+
+    compact->blank = 0;
+
+    gcode_compact_forget (compact);
+
+    return;
+  }
+
+  comment_len = line + len - comment;
+
+  if (word_number == 0)                                                         // Nothing but a comment
+  {
+    fwrite (comment, 1, comment_len, compact->fh);
+    fputc ('\n', compact->fh);
+
+    compact->blank = 0;
+
+    return;
+  }
+
+  /**
+   * A line of motion: motion words (G00 - G03), coordinates and feed rate,
+   * each at most once - while moving along some known motion, unless there is
+   * nothing to move along (the feed rate by itself).
+   */
+
+  motion = compact->input_motion;                                               // Lines with no motion word move along the one the code asked for last
+  seen = 0;
+  axes = 0;
+
+  for (i = 0; i < word_number; i++)
+  {
+    const char *letter = strchr ("GXYZIJF", word[i].letter);
+
+    if (!letter || (seen & (1 << (letter - "GXYZIJF"))))
+      break;
+
+    seen |= 1 << (letter - "GXYZIJF");
+
+    if (word[i].letter == 'G')
+    {
+      if (!word[i].integer || atoi (word[i].number) > 3)
+        break;
+
+      motion = atoi (word[i].number);
+    }
+    else if (word[i].letter != 'F')
+    {
+      axes = 1;
+    }
+  }
+
+  if (i == word_number && (motion >= 0 || !axes))
+  {
+    if (motion >= 0)
+      gcode_compact_motion (compact, word, word_number, motion, comment, comment_len);
+    else
+      strcpy (compact->pending_feed, word[0].number);                           // Only a feed rate: it waits for a move to go with
+
+    return;
+  }
+
+  /**
+   * Anything else: written out (with its numbers trimmed) after the motion and
+   * feed rate still pending, and from then on nothing is known to be in effect
+   * anymore.
+   */
+
+  gcode_compact_flush_pending (compact);
+
+  gcode_compact_write (compact, -1, word, word_number, NULL, comment, comment_len);
+
+  gcode_compact_forget (compact);
+
+  for (i = 0; i < word_number; i++)
+  {
+    if (word[i].letter == 'G' && word[i].integer && atoi (word[i].number) == 90)
+      compact->absolute = 1;
+
+    if (word[i].letter == 'G' && word[i].integer && atoi (word[i].number) == 91)
+      compact->absolute = 0;
+  }
+}
+
+/**
+ * Feed the code in 'rope' through the compaction, line by line - lines can
+ * go on from one piece to the next, and from one block's rope to the next.
+ */
+
+void
+gcode_compact_rope (gcode_compact_t *compact, gcode_rope_t *rope)
+{
+  gcode_rope_piece_t *piece;
+  char *sp, *tsp, *ep;
+  uint32_t i, len;
+
+  for (i = 0; i < rope->piece_number; i++)
+  {
+    piece = &rope->piece[i];
+
+    sp = &piece->chunk->data[piece->offset];
+    ep = sp + piece->len;
+
+    while (sp < ep)
+    {
+      tsp = memchr (sp, '\n', ep - sp);
+
+      len = (tsp ? tsp : ep) - sp;
+
+      if (compact->overflow)                                                    // The rest of a line too long to compact
+      {
+        fwrite (sp, 1, len, compact->fh);
+      }
+      else if (compact->len + len >= GCODE_COMPACT_LINE_SIZE)                   // A line too long to compact (one byte is kept for 'gcode_compact_parse')
+      {
+        gcode_compact_flush_pending (compact);
+
+        fwrite (compact->line, 1, compact->len, compact->fh);
+        fwrite (sp, 1, len, compact->fh);
+
+        compact->len = 0;
+        compact->overflow = 1;
+        compact->blank = 0;
+
+        gcode_compact_forget (compact);
+      }
+      else
+      {
+        memcpy (&compact->line[compact->len], sp, len);
+        compact->len += len;
+      }
+
+      if (!tsp)
+        break;
+
+      if (compact->overflow)
+        fputc ('\n', compact->fh);
+      else
+        gcode_compact_line (compact, compact->line, compact->len);
+
+      compact->len = 0;
+      compact->overflow = 0;
+
+      sp = tsp + 1;
+    }
+  }
+}
+
+/**
+ * Compact whatever is left of the last line, if it was not terminated
+ */
+
+void
+gcode_compact_finish (gcode_compact_t *compact)
+{
+  if (compact->len > 0 && !compact->overflow)
+    gcode_compact_line (compact, compact->line, compact->len);
+
+  compact->len = 0;
+  compact->overflow = 0;
+}
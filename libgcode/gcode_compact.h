@@ -0,0 +1,73 @@
+/**
+ *  gcode_compact.h
+ *  Source code file for G-Code generation, simulation, and visualization
+ *  library.
+ *
+ *  Copyright (C) 2006 - 2010 by Justin Shumaker
+ *  Copyright (C) 2014 - 2020 by Asztalos Attila Oszkár
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _GCODE_COMPACT_H
+#define _GCODE_COMPACT_H
+
+#include <stdio.h>
+#include <inttypes.h>
+#include "gcode_rope.h"
+
+#define GCODE_COMPACT_LINE_SIZE     512                                         /* Longer lines get written out as they are */
+#define GCODE_COMPACT_WORD_SIZE     32                                          /* Longest number a word can carry */
+
+/**
+ * How a driver's controller reads numbers: whether a whole number still needs
+ * its decimal point (Fanuc-style controls read "X1" as one least increment),
+ * and whether the zero in front of the decimal point can go.
+ */
+
+typedef struct gcode_compact_policy_s
+{
+  uint8_t keep_point;
+  uint8_t keep_lead_zero;
+} gcode_compact_policy_t;
+
+/**
+ * The state of the compaction stage between 'gcode_export' and the file: the
+ * line being put together, and the modal values the controller already has in
+ * effect, as last written out ("" or -1 where not known) - next to the motion
+ * and feed rate the code being compacted asked for, which may not have gone out
+ * yet if there was nothing to move along with them.
+ */
+
+typedef struct gcode_compact_s
+{
+  FILE *fh;
+  const gcode_compact_policy_t *policy;
+  char line[GCODE_COMPACT_LINE_SIZE];
+  uint32_t len;                                                                 // Bytes of the current line so far
+  uint8_t overflow;                                                             // The current line did not fit and is being written straight out
+  uint8_t blank;                                                                // The last line written was an empty one (or nothing was written yet)
+  uint8_t absolute;                                                             // G90 is known to be in effect
+  int8_t motion;                                                                // Modal motion (G00 - G03) in effect, as last written out
+  int8_t input_motion;                                                          // Modal motion in effect in the code being compacted (maybe not written yet)
+  char feed[GCODE_COMPACT_WORD_SIZE];                                           // Feed rate in effect
+  char pending_feed[GCODE_COMPACT_WORD_SIZE];                                   // Feed rate asked for in the code being compacted but not yet written
+  char axis[3][GCODE_COMPACT_WORD_SIZE];                                        // X, Y and Z of the tool
+} gcode_compact_t;
+
+void gcode_compact_init (gcode_compact_t *compact, FILE *fh, uint8_t driver);
+void gcode_compact_rope (gcode_compact_t *compact, gcode_rope_t *rope);
+void gcode_compact_finish (gcode_compact_t *compact);
+
+#endif
@@ -92,7 +92,7 @@ gcode_drill_holes_free (gcode_block_t **block)
     tmp->free (&tmp);
   }
 
-  free ((*block)->code);
+  GCODE_FREE ((*block));
   free ((*block)->pdata);
   free (*block);
   *block = NULL;
@@ -62,7 +62,7 @@ gcode_end_init (gcode_block_t **block, gcode_t *gcode, gcode_block_t *parent)
 void
 gcode_end_free (gcode_block_t **block)
 {
-  free ((*block)->code);
+  GCODE_FREE ((*block));
   free ((*block)->pdata);
   free (*block);
   *block = NULL;
@@ -177,12 +177,7 @@ gcode_end_make (gcode_block_t *block)
     GCODE_2D_MOVE (block, end->retract_position[0], end->retract_position[1], "move to parking position");
   }
 
-  GCODE_COMMAND (block, "M30", "program end and reset");
-
-  if (block->gcode->driver == GCODE_DRIVER_HAAS)
-  {
-    GCODE_APPEND (block, "%\n");
-  }
+  GCODE_COMMAND (block, "M30", "program end and reset");                        // On Haas, 'gcode_export' closes the tape with '%' after any subprograms
 }
 
 void
@@ -31,6 +31,62 @@
 #include <stdio.h>
 #include <string.h>
 #include <libgen.h>
+#include <ctype.h>
+
+/**
+ * Read a word for each of 'letters' off 'string', each letter followed by a
+ * number, the same as sscanf ("X %f Y %f") would for 'letters' "XY" in the "C"
+ * locale; returns the number of words read.
+ */
+
+static int
+gcode_excellon_words (const char *string, const char *letters, float *value)
+{
+  gfloat_t number;
+  char *end;
+  int i;
+
+  for (i = 0; letters[i]; i++)
+  {
+    if (i)
+      while (isspace ((unsigned char)*string))
+        string++;
+
+    if (*string != letters[i])
+      break;
+
+    string++;
+
+    number = gstrtod (string, &end);
+
+    if (end == string)
+      break;
+
+    value[i] = (float)number;
+    string = end;
+  }
+
+  return (i);
+}
+
+/**
+ * Copy as much of 'string' as fits into the 'size' bytes at 'target', always
+ * terminated - a label gets cut short rather than overflowing its block.
+ */
+
+static void
+gcode_excellon_label (char *target, size_t size, const char *string)
+{
+  size_t len;
+
+  len = strlen (string);
+
+  if (len > size - 1)
+    len = size - 1;
+
+  memcpy (target, string, len);
+  target[len] = '\0';
+}
 
 /**
  * Open the Excellon drill file 'filename' and import its contents into a series
@@ -60,10 +116,10 @@ gcode_excellon_import (gcode_block_t *template_block, char *filename)
   gfloat_t digit_guess, digit_scale, unit_scale;
   long int length, nomore, index;
   int body, line, ignore, result;
-  float value1, value2, value;
+  float xy[2], value;
   long int number1, number2;
-  int number;
-  char letter;
+  int number, consumed;
+  char letter, string[512];
 
   body = 0;
   line = 1;
@@ -187,7 +243,9 @@ gcode_excellon_import (gcode_block_t *template_block, char *filename)
 
         case 'T':                                                               // *** Looking for a tool number and diameter definition;
 
-          if (sscanf (&buffer[index], "T %d C %f", &number, &value) == 2)
+          consumed = 0;
+
+          if ((sscanf (&buffer[index], "T %d C%n", &number, &consumed) == 1) && consumed && (gcode_excellon_words (&buffer[index + consumed - 1], "C", &value) == 1))
           {
             if (number >= 0)
             {
@@ -322,10 +380,10 @@ gcode_excellon_import (gcode_block_t *template_block, char *filename)
                 tool->number = tool_set[tool_index].number;                     // Technically, the tool HAS a number but it doesn't match the project toolset;
                 tool->prompt = 1;
 
-                snprintf (tool_block->comment, sizeof (tool_block->comment), "%.4f drill (imported T%d)", tool->diameter, tool->number);
-                snprintf (tool->label, sizeof (tool->label), "%.4f drill (imported T%d)", tool->diameter, tool->number);
-                tool_block->comment[sizeof (tool_block->comment) - 1] = '\0';   // About that 'snprintf' - what do you think happens when 'diameter' ends up having
-                tool->label[sizeof (tool->label) - 1] = '\0';                   // 300 digits because, say, you tried to select a tool that was never defined...?!?
+                gsprintf (string, 4, "%z drill (imported T%d)", tool->diameter, tool->number);
+
+                gcode_excellon_label (tool_block->comment, sizeof (tool_block->comment), string);   // About cutting these short - what do you think happens when 'diameter'
+                gcode_excellon_label (tool->label, sizeof (tool->label), string);                   // ends up having 300 digits because, say, you selected an undefined tool...?!?
 
                 gcode_append_as_listtail (template_block, tool_block);          // Append 'tool_block' to the end of 'template_block's list (as head if the list is NULL)
                 gcode_append_as_listtail (template_block, drill_block);         // Append 'drill_block' to the end of 'template_block's list (as head if the list is NULL)
@@ -361,7 +419,7 @@ gcode_excellon_import (gcode_block_t *template_block, char *filename)
               result = 1;
             }
           }
-          else if (sscanf (&buffer[index], "X %f Y %f", &value1, &value2) == 2) // Float scan succeeds even without explicit decimals so we test for it second;
+          else if (gcode_excellon_words (&buffer[index], "XY", xy) == 2)        // Float scan succeeds even without explicit decimals so we test for it second;
           {                                                                     // Testing for float first would hide presence or absence of explicit decimals.
             if (unit_scale > 0.0)                                               // If we got this far digit_scale is set, but we still need to test unit_scale;
             {
@@ -369,8 +427,8 @@ gcode_excellon_import (gcode_block_t *template_block, char *filename)
 
               point = (gcode_point_t *)point_block->pdata;
 
-              point->p[0] = (gfloat_t)value1 * unit_scale;                      // Float values means digit scaling is not necessary; 
-              point->p[1] = (gfloat_t)value2 * unit_scale;                      // We still have to apply any unit conversion though.
+              point->p[0] = (gfloat_t)xy[0] * unit_scale;                       // Float values means digit scaling is not necessary; 
+              point->p[1] = (gfloat_t)xy[1] * unit_scale;                       // We still have to apply any unit conversion though.
 
               gcode_append_as_listtail (drill_block, point_block);              // Append 'point_block' to the end of 'drill_block's list (as head if the list is NULL)
             }
@@ -101,7 +101,7 @@ gcode_extrusion_free (gcode_block_t **block)
     tmp->free (&tmp);
   }
 
-  free ((*block)->code);
+  GCODE_FREE ((*block));
   free ((*block)->pdata);
   free (*block);
   *block = NULL;
@@ -25,6 +25,7 @@
 #include "gcode_arc.h"
 #include "gcode_line.h"
 #include "gcode_util.h"
+#include "gcode_index.h"
 #include "gcode.h"
 
 #define GERBER_PASS_1     0
@@ -1170,7 +1171,7 @@ gcode_gerber_pass1 (gcode_block_t *sketch_block, FILE *fh, int *trace_count, gco
           }
 
           buf[buf_ind] = 0;
-          diameter = atof (buf) * unit_scale + 2 * offset;
+          diameter = gstrtod (buf, NULL) * unit_scale + 2 * offset;
 
           insert_aperture (&aperture_num, &aperture_set, GCODE_GERBER_APERTURE_TYPE_CIRCLE, inum, diameter, diameter);
         }
@@ -1193,7 +1194,7 @@ gcode_gerber_pass1 (gcode_block_t *sketch_block, FILE *fh, int *trace_count, gco
           }
 
           buf[buf_ind] = 0;
-          x = atof (buf) * unit_scale + 2 * offset;
+          x = gstrtod (buf, NULL) * unit_scale + 2 * offset;
 
           index++;                                                              /* Skip 'X' */
 
@@ -1207,7 +1208,7 @@ gcode_gerber_pass1 (gcode_block_t *sketch_block, FILE *fh, int *trace_count, gco
           }
 
           buf[buf_ind] = 0;
-          y = atof (buf) * unit_scale + 2 * offset;
+          y = gstrtod (buf, NULL) * unit_scale + 2 * offset;
 
           insert_aperture (&aperture_num, &aperture_set, GCODE_GERBER_APERTURE_TYPE_RECTANGLE, inum, x, y);
         }
@@ -1232,7 +1233,7 @@ gcode_gerber_pass1 (gcode_block_t *sketch_block, FILE *fh, int *trace_count, gco
           }
 
           buf[buf_ind] = 0;
-          diameter = atof (buf) * unit_scale + 2 * offset;
+          diameter = gstrtod (buf, NULL) * unit_scale + 2 * offset;
 
           insert_aperture (&aperture_num, &aperture_set, GCODE_GERBER_APERTURE_TYPE_CIRCLE, inum, diameter, diameter);
         }
@@ -1255,7 +1256,7 @@ gcode_gerber_pass1 (gcode_block_t *sketch_block, FILE *fh, int *trace_count, gco
           }
 
           buf[buf_ind] = 0;
-          x = atof (buf) * unit_scale + 2 * offset;
+          x = gstrtod (buf, NULL) * unit_scale + 2 * offset;
 
           index++;                                                              /* Skip 'X' */
 
@@ -1269,7 +1270,7 @@ gcode_gerber_pass1 (gcode_block_t *sketch_block, FILE *fh, int *trace_count, gco
           }
 
           buf[buf_ind] = 0;
-          y = atof (buf) * unit_scale + 2 * offset;
+          y = gstrtod (buf, NULL) * unit_scale + 2 * offset;
 
           if (GCODE_MATH_IS_EQUAL (x, y))
             insert_aperture (&aperture_num, &aperture_set, GCODE_GERBER_APERTURE_TYPE_CIRCLE, inum, x, y);
@@ -1317,7 +1318,7 @@ gcode_gerber_pass1 (gcode_block_t *sketch_block, FILE *fh, int *trace_count, gco
 
           buf[buf_ind] = 0;
 
-          pos[0] = atof (buf) * digit_scale * unit_scale;
+          pos[0] = gstrtod (buf, NULL) * digit_scale * unit_scale;
           xy_mask |= 1;
         }
 
@@ -1335,7 +1336,7 @@ gcode_gerber_pass1 (gcode_block_t *sketch_block, FILE *fh, int *trace_count, gco
 
           buf[buf_ind] = 0;
 
-          pos[1] = atof (buf) * digit_scale * unit_scale;
+          pos[1] = gstrtod (buf, NULL) * digit_scale * unit_scale;
           xy_mask |= 2;
         }
 
@@ -1353,7 +1354,7 @@ gcode_gerber_pass1 (gcode_block_t *sketch_block, FILE *fh, int *trace_count, gco
 
           buf[buf_ind] = 0;
 
-          cur_ij[0] = atof (buf) * digit_scale * unit_scale;
+          cur_ij[0] = gstrtod (buf, NULL) * digit_scale * unit_scale;
           ij_mask |= 1;
         }
 
@@ -1371,7 +1372,7 @@ gcode_gerber_pass1 (gcode_block_t *sketch_block, FILE *fh, int *trace_count, gco
 
           buf[buf_ind] = 0;
 
-          cur_ij[1] = atof (buf) * digit_scale * unit_scale;
+          cur_ij[1] = gstrtod (buf, NULL) * digit_scale * unit_scale;
           ij_mask |= 2;
         }
 
@@ -1660,7 +1661,8 @@ gcode_gerber_pass3 (gcode_block_t *sketch_block)
   gcode_t *gcode;
   gcode_block_t *index1_block, *index2_block;
   gcode_block_t *original_listhead;
-  gcode_vec2d_t min1, max1, min2, max2;
+  gcode_index_t index;
+  gcode_vec2d_t min1, max1;
   gcode_vec2d_t p0, p1;
   gcode_vec2d_t ip_array[2];
   gcode_vec2d_t full_ip_array[1022];
@@ -1686,11 +1688,14 @@ gcode_gerber_pass3 (gcode_block_t *sketch_block)
     index1_block = index1_block->next;                                          // It's a small price to pay for having some feedback that GCAM didn't crash.
   }
 
+  gcode_index_init (&index);                                                    // Index all the blocks by their "quick and dirty" bounding boxes, so every
+  gcode_index_blocks (&index, original_listhead, NULL);                         // block only gets intersected with the ones whose boxes overlap its own;
+
   block_index = 0;
 
   index1_block = original_listhead;                                             // Start with the first block on the original list of 'sketch_block';
 
-  while (index1_block)                                                          // Take every single block and intersect it with every other block;
+  while (index1_block)                                                          // Take every single block and intersect it with every other block nearby;
   {
     if (gcode->progress_callback)                                               // Make sure there is a progress update function to call
     {
@@ -1706,45 +1711,42 @@ gcode_gerber_pass3 (gcode_block_t *sketch_block)
 
     gcode_util_qdbb (index1_block, min1, max1);                                 // Calculate the "quick and dirty" bounding box of 'index1_block';
 
-    index2_block = original_listhead;                                           // Starting from the same listhead,
+    gcode_index_box (&index, min1, max1);                                       // Find the blocks whose bounding boxes don't clear that of 'index1_block' -
 
-    while (index2_block)                                                        // loop through all the other blocks of 'sketch_block' with a second index;
+    for (uint32_t k = 0; k < index.found_number; k++)                           // they come in the order of the list, just as if crawling along all of it;
     {
-      if (index1_block != index2_block)                                         // Don't perform intersection against self.
-      {
-        gcode_util_qdbb (index2_block, min2, max2);                             // Calculate the "quick and dirty" bounding box of 'index2_block';
+      if ((int)index.found[k] == block_index)                                   // Don't perform intersection against self.
+        continue;
 
-        if (!GCODE_MATH_IS_APART (min1, max1, min2, max2))                      // If the two bounding boxes clear each other, don't try to intersect;
+      index2_block = (gcode_block_t *)index.item_data[index.found[k]];
+
+      if (gcode_util_intersect (index1_block, index2_block, ip_array, &ip_count) == 0)
+      {
+        for (int i = 0; i < ip_count; i++)                                      // Examine every intersection point returned (if any):
         {
-          if (gcode_util_intersect (index1_block, index2_block, ip_array, &ip_count) == 0)
+          if (full_ip_count < MAX_ELEMENTS (full_ip_array))                     // Make sure we have more room to store intersection points;
           {
-            for (int i = 0; i < ip_count; i++)                                  // Examine every intersection point returned (if any):
-            {
-              if (full_ip_count < MAX_ELEMENTS (full_ip_array))                 // Make sure we have more room to store intersection points;
-              {
-                if (GCODE_MATH_2D_DISTANCE (p0, ip_array[i]) < GCODE_PRECISION)   // Something touching one of the endpoints of 'index1_block', while technically
-                  continue;                                                       // being an 'intersection', CANNOT DIVIDE THE BLOCK IN TWO, so drop that point;
+            if (GCODE_MATH_2D_DISTANCE (p0, ip_array[i]) < GCODE_PRECISION)     // Something touching one of the endpoints of 'index1_block', while technically
+              continue;                                                         // being an 'intersection', CANNOT DIVIDE THE BLOCK IN TWO, so drop that point;
 
-                if (GCODE_MATH_2D_DISTANCE (p1, ip_array[i]) < GCODE_PRECISION)   // Same with the other endpoint - if the only intersections found coincide with
-                  continue;                                                       // the endpoints, THEN THERE ARE NO INTERSECTIONS as in no division is needed!
+            if (GCODE_MATH_2D_DISTANCE (p1, ip_array[i]) < GCODE_PRECISION)     // Same with the other endpoint - if the only intersections found coincide with
+              continue;                                                         // the endpoints, THEN THERE ARE NO INTERSECTIONS as in no division is needed!
 
-                GCODE_MATH_VEC2D_COPY (full_ip_array[full_ip_count], ip_array[i]);        // If we're here, this is a genuine intersection that will divide the block...
+            GCODE_MATH_VEC2D_COPY (full_ip_array[full_ip_count], ip_array[i]);  // If we're here, this is a genuine intersection that will divide the block...
 
-                full_ip_count++;                                                // So save it into the full array and increase the total intersection count;
-              }
-              else
-              {
-                gcode_list_free (&original_listhead);                           // Free the original list of 'sketch_block' before bailing;
+            full_ip_count++;                                                    // So save it into the full array and increase the total intersection count;
+          }
+          else
+          {
+            gcode_index_free (&index);
 
-                REMARK ("Intersection array size exceeded!\n");
-                return (1);
-              }
-            }
+            gcode_list_free (&original_listhead);                               // Free the original list of 'sketch_block' before bailing;
+
+            REMARK ("Intersection array size exceeded!\n");
+            return (1);
           }
         }
       }
-
-      index2_block = index2_block->next;                                        // Move on to the next block to attempt to intersect with 'index1_block';
     }
 
     if (index1_block->type == GCODE_TYPE_LINE)                                  // The division process is type-specific, so this is what we do for lines:
@@ -1913,6 +1915,8 @@ gcode_gerber_pass3 (gcode_block_t *sketch_block)
     index1_block = index1_block->next;                                          // Move on to the next block in the original list of 'sketch_block';
   }
 
+  gcode_index_free (&index);
+
   gcode_list_free (&original_listhead);                                         // Free the original list of 'sketch_block', it's no longer needed;
 
   return (0);
@@ -1931,6 +1935,7 @@ gcode_gerber_pass4 (gcode_block_t *sketch_block, int trace_count, gcode_gerber_t
   gcode_block_t *line_block, *arc_block;
   gcode_line_t *line;
   gcode_arc_t *arc;
+  gcode_index_t trace_index, exposure_index;
   int block_count, block_index, remove_block;
   gfloat_t progress;
   gfloat_t eps;
@@ -1945,6 +1950,72 @@ gcode_gerber_pass4 (gcode_block_t *sketch_block, int trace_count, gcode_gerber_t
   line = (gcode_line_t *)line_block->pdata;
   arc = (gcode_arc_t *)arc_block->pdata;
 
+  /**
+   * A segment can only ever be removed by the traces and pads whose footprint
+   * overlaps its bounding box (the endpoints and the midpoint all fall within
+   * it), so both get a spatial index by the bounding box of their footprints.
+   */
+
+  gcode_index_init (&trace_index);
+  gcode_index_init (&exposure_index);
+
+  for (int i = 0; i < trace_count; i++)
+  {
+    gcode_vec2d_t tmin, tmax;
+    gfloat_t margin;
+
+    if (trace_array[i].type == GCODE_GERBER_TRACE_TYPE_ARC)
+    {
+      GCODE_MATH_VEC2D_COPY (arc->p, trace_array[i].p0);
+
+      arc->radius = trace_array[i].radius;
+
+      arc->start_angle = trace_array[i].start_angle;
+      arc->sweep_angle = trace_array[i].sweep_angle;
+
+      gcode_arc_qdbb (arc_block, tmin, tmax);
+    }
+    else
+    {
+      GCODE_MATH_VEC2D_COPY (line->p0, trace_array[i].p0);
+      GCODE_MATH_VEC2D_COPY (line->p1, trace_array[i].p1);
+
+      gcode_line_qdbb (line_block, tmin, tmax);
+    }
+
+    margin = 0.5 * fabs (trace_array[i].width) + GCODE_PRECISION;               // The footprint reaches half the trace width beyond the centerline;
+
+    tmin[0] -= margin;
+    tmin[1] -= margin;
+    tmax[0] += margin;
+    tmax[1] += margin;
+
+    gcode_index_add (&trace_index, tmin, tmax, NULL);
+  }
+
+  gcode_index_build (&trace_index);
+
+  for (int i = 0; i < exposure_count; i++)
+  {
+    gcode_vec2d_t emin, emax, half;
+
+    half[0] = 0.5 * fabs (exposure_array[i].v[0]);
+
+    if (exposure_array[i].type == GCODE_GERBER_APERTURE_TYPE_CIRCLE)            // Circles only have a diameter, everything else a width and a height;
+      half[1] = half[0];
+    else
+      half[1] = 0.5 * fabs (exposure_array[i].v[1]);
+
+    emin[0] = exposure_array[i].pos[0] - half[0] - GCODE_PRECISION;
+    emin[1] = exposure_array[i].pos[1] - half[1] - GCODE_PRECISION;
+    emax[0] = exposure_array[i].pos[0] + half[0] + GCODE_PRECISION;
+    emax[1] = exposure_array[i].pos[1] + half[1] + GCODE_PRECISION;
+
+    gcode_index_add (&exposure_index, emin, emax, NULL);
+  }
+
+  gcode_index_build (&exposure_index);
+
   block_count = 0;
 
   index1_block = sketch_block->listhead;                                        // Start with the first block on the list of 'sketch_block';
@@ -1998,8 +2069,11 @@ gcode_gerber_pass4 (gcode_block_t *sketch_block, int trace_count, gcode_gerber_t
      * Trace Interference Check
      */
 
-    for (int i = 0; i < trace_count && !remove_block; i++)                      // Loop through each trace in the trace array;
+    gcode_index_box (&trace_index, bmin, bmax);                                 // Find the traces whose footprint may reach the block at all;
+
+    for (uint32_t k = 0; k < trace_index.found_number && !remove_block; k++)    // Loop through each of those, in the order of the trace array;
     {
+      int i = trace_index.found[k];
       gcode_vec2d_t ip_array[2], dpos;
       gcode_vec2d_t tmin, tmax;
       gfloat_t trace_radius;
@@ -2162,8 +2236,12 @@ gcode_gerber_pass4 (gcode_block_t *sketch_block, int trace_count, gcode_gerber_t
      * Exposure (Pad) Interference Check
      */
 
-    for (int i = 0; i < exposure_count && !remove_block; i++)
+    gcode_index_box (&exposure_index, bmin, bmax);                              // Find the pads that may cover any of the block's points;
+
+    for (uint32_t k = 0; k < exposure_index.found_number && !remove_block; k++)
     {
+      int i = exposure_index.found[k];
+
       switch (exposure_array[i].type)
       {
         case GCODE_GERBER_APERTURE_TYPE_CIRCLE:
@@ -2274,6 +2352,9 @@ gcode_gerber_pass4 (gcode_block_t *sketch_block, int trace_count, gcode_gerber_t
     }
   }
 
+  gcode_index_free (&trace_index);
+  gcode_index_free (&exposure_index);
+
   line_block->free (&line_block);
   arc_block->free (&arc_block);
 
@@ -2371,17 +2452,13 @@ static int
 gcode_gerber_pass6 (gcode_block_t *sketch_block)
 {
   gcode_t *gcode;
-  gfloat_t progress;
 
   gcode = (gcode_t *)sketch_block->gcode;
 
-  gcode_util_merge_list_fragments (&sketch_block->listhead);
-
-  /* Cheating like crazy, but 'merge' doesn't have progress feedback... */
+  gcode_util_merge_list_fragments (&sketch_block->listhead);                    // Endpoints get matched through a spatial hash, so this takes no time to speak of;
 
   if (gcode->progress_callback)
-    for (progress = 0.0; progress < 1.0; progress += 0.01)
-      gcode->progress_callback (gcode->gui, GERBER_PROGRESS (GERBER_PASS_6, progress));
+    gcode->progress_callback (gcode->gui, GERBER_PROGRESS (GERBER_PASS_6, 1.0));
 
   return (0);
 }
@@ -2662,7 +2739,7 @@ gcode_gerber_import (gcode_block_t *sketch_block, char *filename, gfloat_t depth
 
   line->p1[1] = -depth;
 
-  sprintf (sketch_block->comment, "Pass offset: %.4f", offset);                 // Note the offset for this pass in the sketch comment;
+  gsprintf (sketch_block->comment, 4, "Pass offset: %z", offset);               // Note the offset for this pass in the sketch comment;
 
   extrusion->cut_side = GCODE_EXTRUSION_ALONG;
 
@@ -77,7 +77,7 @@ gcode_image_free (gcode_block_t **block)
 
   free (image->dmap);
 
-  free ((*block)->code);
+  GCODE_FREE ((*block));
   free ((*block)->pdata);
   free (*block);
   *block = NULL;
@@ -199,13 +199,103 @@ gcode_image_load (gcode_block_t *block, FILE *fh)
   }
 }
 
+/**
+ * Return 1 if points 'first' to 'last' of 'point' all lie within 'tolerance' of
+ * the straight line from the first to the last, in that order, or 0 otherwise;
+ */
+
+static int
+gcode_image_fit_line (gcode_vec3d_t *point, int first, int last, gfloat_t tolerance)
+{
+  gcode_vec3d_t v, w, n;
+  gfloat_t l, t, t_prev, d;
+  int i;
+
+  GCODE_MATH_VEC3D_SUB (v, point[last], point[first]);
+
+  l = v[0] * v[0] + v[1] * v[1] + v[2] * v[2];
+
+  if (l < GCODE_PRECISION * GCODE_PRECISION)
+    return (0);
+
+  t_prev = 0.0;
+
+  for (i = first + 1; i < last; i++)
+  {
+    GCODE_MATH_VEC3D_SUB (w, point[i], point[first]);
+
+    t = (w[0] * v[0] + w[1] * v[1] + w[2] * v[2]) / l;
+
+    if (t < t_prev || t > 1.0)
+      return (0);
+
+    GCODE_MATH_VEC3D_CROSS (n, w, v);
+    GCODE_MATH_VEC3D_MAG (d, n);
+
+    if (d / sqrt (l) > tolerance)
+      return (0);
+
+    t_prev = t;
+  }
+
+  return (1);
+}
+
+/**
+ * Mill along the 'point_number' points of a row of the raster: with a non-zero
+ * 'tolerance' every run of points that lies along a straight line (flat ground
+ * or an even slope) becomes a single move, grown greedily from its first point;
+ */
+
+static void
+gcode_image_row (gcode_block_t *block, gcode_vec3d_t *point, int point_number, gfloat_t tolerance)
+{
+  int i, good, bad, step, next;
+
+  GCODE_3D_LINE (block, point[0][0], point[0][1], point[0][2], "");
+
+  for (i = 0; i < point_number - 1; i = good)
+  {
+    good = i + 1;
+    bad = (tolerance > 0.0) ? point_number : good + 1;
+    step = 1;
+
+    while (good < bad - 1)                                                      // Try ever longer runs until one does not fit...
+    {
+      next = good + step < point_number - 1 ? good + step : point_number - 1;
+
+      if (!gcode_image_fit_line (point, i, next, tolerance))
+      {
+        bad = next;
+        break;
+      }
+
+      good = next;
+      step *= 2;
+    }
+
+    while (bad - good > 1)                                                      // ...then close in on the longest one that does, between the two;
+    {
+      next = (good + bad) / 2;
+
+      if (gcode_image_fit_line (point, i, next, tolerance))
+        good = next;
+      else
+        bad = next;
+    }
+
+    GCODE_3D_LINE (block, point[good][0], point[good][1], point[good][2], "");
+  }
+}
+
 void
 gcode_image_make (gcode_block_t *block)
 {
   gcode_image_t *image;
   gcode_tool_t *tool;
   gcode_vec2d_t pos;
-  gfloat_t xpos, ypos;
+  gcode_vec3d_t *row;
+  gfloat_t xpos, ypos, tolerance;
   char string[256];
   int x, y;
 
@@ -241,6 +331,16 @@ gcode_image_make (gcode_block_t *block)
 
   GCODE_PLUMMET (block, 0.0);
 
+  row = malloc (image->resolution[0] * sizeof (gcode_vec3d_t));
+
+  if (!row)
+  {
+    REMARK ("Failed to allocate memory for image\n");
+    return;
+  }
+
+  tolerance = GCODE_UNITS (block->gcode, block->gcode->fit_tolerance);
+
   for (y = 0; y < image->resolution[1]; y++)
   {
     ypos = (((gfloat_t)y) + 0.5) * image->size[1] / (gfloat_t)image->resolution[1];
@@ -254,9 +354,11 @@ gcode_image_make (gcode_block_t *block)
       GCODE_MATH_ROTATE (pos, pos, block->offset->rotation);
       GCODE_MATH_TRANSLATE (pos, pos, block->offset->origin);
 
-      GCODE_3D_LINE (block, pos[0], pos[1], image->size[2] * image->dmap[y * image->resolution[0] + x], "");
+      GCODE_MATH_VEC3D_SET (row[x], pos[0], pos[1], image->size[2] * image->dmap[y * image->resolution[0] + x]);
     }
 
+    gcode_image_row (block, row, image->resolution[0], tolerance);
+
     y++;
 
     ypos = (((gfloat_t)y) + 0.5) * image->size[1] / (gfloat_t)image->resolution[1];
@@ -272,10 +374,14 @@ gcode_image_make (gcode_block_t *block)
         GCODE_MATH_ROTATE (pos, pos, block->offset->rotation);
         GCODE_MATH_TRANSLATE (pos, pos, block->offset->origin);
 
-        GCODE_3D_LINE (block, pos[0], pos[1], image->size[2] * image->dmap[y * image->resolution[0] + x], "");
+        GCODE_MATH_VEC3D_SET (row[image->resolution[0] - 1 - x], pos[0], pos[1], image->size[2] * image->dmap[y * image->resolution[0] + x]);
       }
+
+      gcode_image_row (block, row, image->resolution[0], tolerance);
     }
   }
+
+  free (row);
 }
 
 void
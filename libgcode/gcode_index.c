@@ -0,0 +1,312 @@
+/**
+ *  gcode_index.c
+ *  Source code file for G-Code generation, simulation, and visualization
+ *  library.
+ *
+ *  Copyright (C) 2006 - 2010 by Justin Shumaker
+ *  Copyright (C) 2014 - 2020 by Asztalos Attila Oszkár
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gcode_index.h"
+#include "gcode_util.h"
+
+void
+gcode_index_init (gcode_index_t *index)
+{
+  memset (index, 0, sizeof (gcode_index_t));
+}
+
+void
+gcode_index_free (gcode_index_t *index)
+{
+  free (index->item_min);
+  free (index->item_max);
+  free (index->item_data);
+  free (index->cell_first);
+  free (index->cell_item);
+  free (index->stamp);
+  free (index->found);
+
+  gcode_index_init (index);
+}
+
+/**
+ * Add the box ['min', 'max'] to the index carrying 'data' along; the index has
+ * to be (re)built with 'gcode_index_build' before it answers about new boxes.
+ */
+
+void
+gcode_index_add (gcode_index_t *index, gcode_vec2d_t min, gcode_vec2d_t max, void *data)
+{
+  if (index->item_number == index->item_alloc)
+  {
+    index->item_alloc = index->item_alloc ? 2 * index->item_alloc : 64;
+
+    index->item_min = realloc (index->item_min, index->item_alloc * sizeof (gcode_vec2d_t));
+    index->item_max = realloc (index->item_max, index->item_alloc * sizeof (gcode_vec2d_t));
+    index->item_data = realloc (index->item_data, index->item_alloc * sizeof (void *));
+  }
+
+  GCODE_MATH_VEC2D_COPY (index->item_min[index->item_number], min);
+  GCODE_MATH_VEC2D_COPY (index->item_max[index->item_number], max);
+
+  index->item_data[index->item_number] = data;
+
+  index->item_number++;
+}
+
+/**
+ * The cell column / row 'value' falls in along 'axis', clamped to the grid; as
+ * this never decreases with 'value', any two boxes that overlap are certain to
+ * share at least one cell (while far apart ones almost never do).
+ */
+
+static int
+gcode_index_cell (gcode_index_t *index, int axis, gfloat_t value)
+{
+  gfloat_t cell;
+
+  cell = (value - index->origin[axis]) * index->scale[axis];
+
+  if (!(cell > 0.0))                                                            // Also takes care of NaN-s;
+    return (0);
+
+  if (cell >= index->cells[axis])
+    return (index->cells[axis] - 1);
+
+  return ((int)cell);
+}
+
+/**
+ * Lay the grid over the boxes added so far - about as many cells as there are
+ * boxes, shaped after the area they cover - and sort the boxes into the cells
+ * they touch (counted first, then filled in, all in one array).
+ */
+
+void
+gcode_index_build (gcode_index_t *index)
+{
+  gcode_vec2d_t min, max;
+  gfloat_t extent[2];
+  uint32_t i, cell_number, item_cells;
+  int cmin[2], cmax[2], x, y;
+
+  free (index->cell_first);
+  free (index->cell_item);
+  free (index->stamp);
+  free (index->found);
+
+  GCODE_MATH_VEC2D_SET (min, 0.0, 0.0);
+  GCODE_MATH_VEC2D_SET (max, 0.0, 0.0);
+
+  if (index->item_number)
+  {
+    GCODE_MATH_VEC2D_COPY (min, index->item_min[0]);
+    GCODE_MATH_VEC2D_COPY (max, index->item_max[0]);
+  }
+
+  for (i = 1; i < index->item_number; i++)                                      // Find the area all the boxes cover;
+  {
+    min[0] = fmin (min[0], index->item_min[i][0]);
+    min[1] = fmin (min[1], index->item_min[i][1]);
+    max[0] = fmax (max[0], index->item_max[i][0]);
+    max[1] = fmax (max[1], index->item_max[i][1]);
+  }
+
+  extent[0] = max[0] - min[0];
+  extent[1] = max[1] - min[1];
+
+  index->cells[0] = 1;
+  index->cells[1] = 1;
+
+  if (isfinite (extent[0]) && isfinite (extent[1]) && (extent[0] > GCODE_PRECISION || extent[1] > GCODE_PRECISION))
+  {
+    if (extent[0] < GCODE_PRECISION)                                            // A grid along a single line is just a row (or a column) of cells;
+      index->cells[1] = index->item_number;
+    else if (extent[1] < GCODE_PRECISION)
+      index->cells[0] = index->item_number;
+    else
+    {
+      index->cells[0] = (int)ceil (sqrt (index->item_number * extent[0] / extent[1]));
+      index->cells[1] = (int)ceil (sqrt (index->item_number * extent[1] / extent[0]));
+    }
+
+    for (x = 0; x < 2; x++)
+    {
+      if (index->cells[x] < 1)
+        index->cells[x] = 1;
+
+      if (index->cells[x] > GCODE_INDEX_MAX_CELLS)
+        index->cells[x] = GCODE_INDEX_MAX_CELLS;
+    }
+  }
+
+  GCODE_MATH_VEC2D_COPY (index->origin, min);
+
+  index->scale[0] = (extent[0] > GCODE_PRECISION) ? index->cells[0] / extent[0] : 0.0;
+  index->scale[1] = (extent[1] > GCODE_PRECISION) ? index->cells[1] / extent[1] : 0.0;
+
+  cell_number = index->cells[0] * index->cells[1];
+
+  index->cell_first = calloc (cell_number + 1, sizeof (uint32_t));
+
+  for (i = 0; i < index->item_number; i++)                                      // First count the boxes touching each cell (shifted by one),
+  {
+    cmin[0] = gcode_index_cell (index, 0, index->item_min[i][0]);
+    cmin[1] = gcode_index_cell (index, 1, index->item_min[i][1]);
+    cmax[0] = gcode_index_cell (index, 0, index->item_max[i][0]);
+    cmax[1] = gcode_index_cell (index, 1, index->item_max[i][1]);
+
+    for (y = cmin[1]; y <= cmax[1]; y++)
+      for (x = cmin[0]; x <= cmax[0]; x++)
+        index->cell_first[y * index->cells[0] + x + 1]++;
+  }
+
+  for (i = 0; i < cell_number; i++)                                             // then add up the counts into the start of every cell...
+    index->cell_first[i + 1] += index->cell_first[i];
+
+  item_cells = index->cell_first[cell_number];
+
+  index->cell_item = malloc ((item_cells ? item_cells : 1) * sizeof (uint32_t));
+
+  for (i = 0; i < index->item_number; i++)                                      // ...and file the boxes, advancing the start of every cell
+  {                                                                             // as it fills up, which leaves them all one cell late;
+    cmin[0] = gcode_index_cell (index, 0, index->item_min[i][0]);
+    cmin[1] = gcode_index_cell (index, 1, index->item_min[i][1]);
+    cmax[0] = gcode_index_cell (index, 0, index->item_max[i][0]);
+    cmax[1] = gcode_index_cell (index, 1, index->item_max[i][1]);
+
+    for (y = cmin[1]; y <= cmax[1]; y++)
+      for (x = cmin[0]; x <= cmax[0]; x++)
+        index->cell_item[index->cell_first[y * index->cells[0] + x]++] = i;
+  }
+
+  for (i = cell_number; i > 0; i--)                                             // Move the starts back where they belong;
+    index->cell_first[i] = index->cell_first[i - 1];
+
+  index->cell_first[0] = 0;
+
+  index->stamp = calloc (index->item_number ? index->item_number : 1, sizeof (uint32_t));
+  index->found = malloc ((index->item_number ? index->item_number : 1) * sizeof (uint32_t));
+
+  index->query = 0;
+  index->found_number = 0;
+}
+
+/**
+ * Add the blocks from 'first_block' up to (but not including) 'final_block' to
+ * the index by their "quick and dirty" bounding boxes, and build it.
+ */
+
+void
+gcode_index_blocks (gcode_index_t *index, gcode_block_t *first_block, gcode_block_t *final_block)
+{
+  gcode_block_t *index_block;
+  gcode_vec2d_t bmin, bmax;
+
+  for (index_block = first_block; index_block != final_block; index_block = index_block->next)
+  {
+    gcode_util_qdbb (index_block, bmin, bmax);
+
+    gcode_index_add (index, bmin, bmax, index_block);
+  }
+
+  gcode_index_build (index);
+}
+
+static int
+gcode_index_compare (const void *a, const void *b)
+{
+  uint32_t item_a, item_b;
+
+  item_a = *(const uint32_t *)a;
+  item_b = *(const uint32_t *)b;
+
+  return ((item_a > item_b) - (item_a < item_b));
+}
+
+/**
+ * List in 'found' every item whose box is not apart from ['min', 'max'] (as in
+ * GCODE_MATH_IS_APART) and return their number; the list is only valid up to
+ * the next query or build.
+ */
+
+uint32_t
+gcode_index_box (gcode_index_t *index, gcode_vec2d_t min, gcode_vec2d_t max)
+{
+  uint32_t i, item;
+  int cmin[2], cmax[2], x, y;
+
+  index->found_number = 0;
+
+  if (!index->cell_first || !index->item_number)
+    return (0);
+
+  if (++index->query == 0)                                                      // Once in four billion queries the stamps have to start over;
+  {
+    memset (index->stamp, 0, index->item_number * sizeof (uint32_t));
+
+    index->query = 1;
+  }
+
+  cmin[0] = gcode_index_cell (index, 0, min[0]);
+  cmin[1] = gcode_index_cell (index, 1, min[1]);
+  cmax[0] = gcode_index_cell (index, 0, max[0]);
+  cmax[1] = gcode_index_cell (index, 1, max[1]);
+
+  for (y = cmin[1]; y <= cmax[1]; y++)
+  {
+    for (x = cmin[0]; x <= cmax[0]; x++)
+    {
+      for (i = index->cell_first[y * index->cells[0] + x]; i < index->cell_first[y * index->cells[0] + x + 1]; i++)
+      {
+        item = index->cell_item[i];
+
+        if (index->stamp[item] == index->query)                                 // Boxes spanning several cells only get looked at once;
+          continue;
+
+        index->stamp[item] = index->query;
+
+        if (!GCODE_MATH_IS_APART (min, max, index->item_min[item], index->item_max[item]))
+          index->found[index->found_number++] = item;
+      }
+    }
+  }
+
+  if (index->found_number > 1)
+    qsort (index->found, index->found_number, sizeof (uint32_t), gcode_index_compare);
+
+  return (index->found_number);
+}
+
+uint32_t
+gcode_index_point (gcode_index_t *index, gcode_vec2d_t point)
+{
+  return (gcode_index_box (index, point, point));
+}
+
+uint32_t
+gcode_index_segment (gcode_index_t *index, gcode_vec2d_t p0, gcode_vec2d_t p1)
+{
+  gcode_vec2d_t min, max;
+
+  min[0] = fmin (p0[0], p1[0]) - GCODE_PRECISION;
+  min[1] = fmin (p0[1], p1[1]) - GCODE_PRECISION;
+  max[0] = fmax (p0[0], p1[0]) + GCODE_PRECISION;
+  max[1] = fmax (p0[1], p1[1]) + GCODE_PRECISION;
+
+  return (gcode_index_box (index, min, max));
+}
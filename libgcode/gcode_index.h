@@ -0,0 +1,65 @@
+/**
+ *  gcode_index.h
+ *  Source code file for G-Code generation, simulation, and visualization
+ *  library.
+ *
+ *  Copyright (C) 2006 - 2010 by Justin Shumaker
+ *  Copyright (C) 2014 - 2020 by Asztalos Attila Oszkár
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _GCODE_INDEX_H
+#define _GCODE_INDEX_H
+
+#include "gcode_internal.h"
+
+#define GCODE_INDEX_MAX_CELLS       1024                                        /* Most cells the grid gets along either axis */
+
+/**
+ * A uniform grid over a set of axis-aligned boxes (usually the "quick and dirty"
+ * bounding boxes of a block list) - answers which of the boxes may touch a box,
+ * a point or a segment without looking at every one of them; every item keeps
+ * the number it got when added, and queries list the numbers of the items hit
+ * in 'found', in ascending order, so callers can keep their original ordering.
+ */
+
+typedef struct gcode_index_s
+{
+  uint32_t item_number;
+  uint32_t item_alloc;
+  gcode_vec2d_t *item_min;                                                      // The boxes added, one per item
+  gcode_vec2d_t *item_max;
+  void **item_data;                                                             // Whatever the caller attached to each box (e.g. the block)
+  gcode_vec2d_t origin;                                                         // Lower left corner of the grid
+  gfloat_t scale[2];                                                            // Cells per unit length along X and Y
+  int cells[2];                                                                 // Number of cells along X and Y
+  uint32_t *cell_first;                                                         // Where the items of each cell start within 'cell_item' (one extra at the end)
+  uint32_t *cell_item;                                                          // Items touching each cell, cell after cell
+  uint32_t *stamp;                                                              // The query each item was last found by (to list every item only once)
+  uint32_t query;
+  uint32_t *found;                                                              // Items found by the last query
+  uint32_t found_number;
+} gcode_index_t;
+
+void gcode_index_init (gcode_index_t *index);
+void gcode_index_free (gcode_index_t *index);
+void gcode_index_add (gcode_index_t *index, gcode_vec2d_t min, gcode_vec2d_t max, void *data);
+void gcode_index_build (gcode_index_t *index);
+void gcode_index_blocks (gcode_index_t *index, gcode_block_t *first_block, gcode_block_t *final_block);
+uint32_t gcode_index_box (gcode_index_t *index, gcode_vec2d_t min, gcode_vec2d_t max);
+uint32_t gcode_index_point (gcode_index_t *index, gcode_vec2d_t point);
+uint32_t gcode_index_segment (gcode_index_t *index, gcode_vec2d_t p0, gcode_vec2d_t p1);
+
+#endif
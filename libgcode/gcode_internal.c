@@ -21,6 +21,8 @@
  */
 
 #include "gcode_internal.h"
+#include <ctype.h>
+#include <locale.h>
 
 void
 gcode_internal_init (gcode_block_t *block, gcode_t *gcode, gcode_block_t *parent, uint8_t type, uint8_t flags)
@@ -44,7 +46,11 @@ gcode_internal_init (gcode_block_t *block, gcode_t *gcode, gcode_block_t *parent
   block->offref = NULL;
   block->offset = NULL;
   block->pdata = NULL;
-  block->code = NULL;
+  GCODE_INIT (block);
+  block->make_stamp = 0;
+  GCODE_MATH_VEC3D_SET (block->make_entry, FLT_MAX, FLT_MAX, FLT_MAX);
+  GCODE_MATH_VEC3D_SET (block->make_exit, FLT_MAX, FLT_MAX, FLT_MAX);
+  block->make_probe.number = 0;
 
   block->free = NULL;
   block->save = NULL;
@@ -63,66 +69,340 @@ gcode_internal_init (gcode_block_t *block, gcode_t *gcode, gcode_block_t *parent
   block->clone = NULL;
 }
 
-static void
-format_z (char *format, char **format2, unsigned int number)
+/**
+ * Note down that the code being made compared the tool with 'value' along the
+ * (open) axis 'axis' - or, with 'axis' being -1, that it used where the tool
+ * is some other way; returns 0, the outcome of a comparison with an open axis.
+ */
+
+int
+gcode_make_probe (gcode_t *gcode, int axis, gfloat_t value)
 {
-  unsigned int i, j, s;
+  gcode_make_probe_t *probe;
+  int i;
+
+  probe = gcode->make_probe;
 
-  if (number > 9)
-    return;
+  if (!probe || probe->number > GCODE_MAKE_PROBES)
+    return (0);
 
-  s = strlen (format) + 1;
-  *format2 = malloc (2 * s);
-  memcpy (*format2, format, s);
+  if (axis < 0)
+  {
+    probe->number = GCODE_MAKE_PROBES + 1;                                      // Holds for no other entry whatsoever
+    return (0);
+  }
 
-  j = 0;
+  for (i = 0; i < probe->number; i++)
+    if (probe->axis[i] == axis && probe->value[i] == value)
+      return (0);
 
-  for (i = 0; i < s - 1; i++)
+  if (probe->number < GCODE_MAKE_PROBES)
   {
-    if (format[i] == '%' && format[i + 1] == 'z')
-    {
-      /* copy % */
-      (*format2)[j] = format[i];
-      j++;
-      i += 1;
+    probe->axis[probe->number] = axis;
+    probe->value[probe->number] = value;
+  }
 
-      (*format2)[j] = '.';
-      j++;
+  probe->number++;
 
-      sprintf (&(*format2)[j], "%d", number);
-      j++;
+  return (0);
+}
 
-      (*format2)[j] = 'f';
-      j++;
-    }
-    else
-    {
-      (*format2)[j] = format[i];
-      j++;
-    }
+/**
+ * The decimal point of the current locale, or NULL if it is just '.' anyway
+ */
+
+static const char *
+glocale_point (void)
+{
+  const char *point;
+
+  point = localeconv ()->decimal_point;
+
+  if (!point || !*point || (point[0] == '.' && !point[1]))
+    return (NULL);
+
+  return (point);
+}
+
+/**
+ * Swap the decimal point of the current locale for '.' in the 'len' characters
+ * long number the C library just printed at 'target'; returns the new length.
+ */
+
+static int
+gpoint (char *target, int len)
+{
+  const char *point;
+  char *sp;
+  int size;
+
+  point = glocale_point ();
+
+  if (!point)
+    return (len);
+
+  sp = strstr (target, point);
+
+  if (!sp)
+    return (len);
+
+  size = strlen (point);
+
+  *sp = '.';
+
+  memmove (sp + 1, sp + size, len - (sp - target) - size + 1);
+
+  return (len - size + 1);
+}
+
+/**
+ * Write 'value' with exactly 'decimals' digits after the decimal point, the way
+ * "%.*f" would but through integer arithmetic and always with a '.' whatever
+ * the locale; returns the number of characters written. Values too large for
+ * that, or sitting right on a rounding tie (where only the exact binary value
+ * can tell which way to round), are left to sprintf (and 'gpoint').
+ */
+
+int
+gfixed (char *target, gfloat_t value, unsigned int decimals)
+{
+  static const double scale[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9 };
+  char digits[32];
+  double scaled, whole, frac;
+  uint64_t number, bits;
+  int i, n;
+
+  if (decimals > 9)
+    return (gpoint (target, sprintf (target, "%.*f", decimals, (double)value)));
+
+  scaled = fabs ((double)value) * scale[decimals];
+
+  if (!(scaled < 1e9))                                                          // Also catches NaN and infinities
+    return (gpoint (target, sprintf (target, "%.*f", decimals, (double)value)));
+
+  whole = floor (scaled);
+  frac = scaled - whole;
+
+  if (fabs (frac - 0.5) < 1e-6)
+    return (gpoint (target, sprintf (target, "%.*f", decimals, (double)value)));
+
+  number = (uint64_t)whole + (frac > 0.5);
+
+  /* Digits in reverse, padded so that there is at least one before the point */
+  n = 0;
+
+  do
+  {
+    digits[n++] = '0' + number % 10;
+    number /= 10;
+  } while (number || n <= (int)decimals);
+
+  i = 0;
+
+  memcpy (&bits, &value, sizeof (bits));                                        // The sign bit itself: -ffast-math folds signbit (-0.0) to 0
+
+  if (bits >> 63)
+    target[i++] = '-';
+
+  while (n > (int)decimals)
+    target[i++] = digits[--n];
+
+  if (decimals)
+  {
+    target[i++] = '.';
+
+    while (n)
+      target[i++] = digits[--n];
   }
 
-  (*format2)[j] = 0;
+  target[i] = '\0';
+
+  return (i);
 }
 
+/**
+ * Formatted print for G-code output: "%z" prints a float with 'number' decimals
+ * and "%.Nf" with N decimals, both through 'gfixed'; anything else goes to
+ * sprintf one conversion at a time (any other float still with a '.' for its
+ * decimal point). Nothing gets allocated.
+ */
+
 void
 gsprintf (char *target, unsigned int number, char *format, ...)
 {
   va_list arglist;
-  char *format2;
+  char spec[32], *fp;
+  int len;
 
   va_start (arglist, format);
 
-  format2 = NULL;
+  for (fp = format; *fp; fp++)
+  {
+    if (*fp != '%')
+    {
+      *target++ = *fp;
+      continue;
+    }
+
+    if (fp[1] == 'z')
+    {
+      target += gfixed (target, va_arg (arglist, double), number);
+      fp++;
+      continue;
+    }
+
+    if (fp[1] == '.' && fp[2] >= '0' && fp[2] <= '9' && fp[3] == 'f')
+    {
+      target += gfixed (target, va_arg (arglist, double), fp[2] - '0');
+      fp += 3;
+      continue;
+    }
+
+    if (fp[1] == '%')
+    {
+      *target++ = '%';
+      fp++;
+      continue;
+    }
+
+    /* Any other conversion: isolate it and let sprintf take its argument */
+    len = 1 + strcspn (&fp[1], "diouxXcsfFeEgG");
+
+    if (!fp[len] || len > (int)sizeof (spec) - 2)
+      break;
+
+    memcpy (spec, fp, len + 1);
+    spec[len + 1] = '\0';
 
-  format_z (format, &format2, number);
-  vsprintf (target, format2, arglist);
+    switch (fp[len])
+    {
+      case 'd':
+      case 'i':
+      case 'c':
+        target += sprintf (target, spec, va_arg (arglist, int));
+        break;
+
+      case 'o':
+      case 'u':
+      case 'x':
+      case 'X':
+        target += sprintf (target, spec, va_arg (arglist, unsigned int));
+        break;
 
-  free (format2);
+      case 's':
+        target += sprintf (target, spec, va_arg (arglist, char *));
+        break;
+
+      default:
+        target += gpoint (target, sprintf (target, spec, va_arg (arglist, double)));
+        break;
+    }
+
+    fp += len;
+  }
+
+  *target = '\0';
 
   va_end (arglist);
 }
 
+/**
+ * Read a number off 'string' the way strtod does in the "C" locale, whatever the
+ * locale of the process: where that has a decimal point other than '.', the
+ * characters a number can have get copied with the locale's point in place of
+ * the '.' for strtod to read, and 'end' gets set back in terms of 'string'.
+ */
+
+gfloat_t
+gstrtod (const char *string, char **end)
+{
+  const char *point, *sp;
+  char local[64], *buffer, *tail;
+  size_t len, size, dot, done;
+  gfloat_t value;
+
+  point = glocale_point ();
+
+  if (!point)
+    return (strtod (string, end));
+
+  for (sp = string; isspace ((unsigned char)*sp); sp++);
+
+  len = strspn (sp, "+-0123456789.eE");
+
+  if (!len)                                                                     // Nothing with a decimal point to swap (could still be "inf" or "nan");
+    return (strtod (string, end));
+
+  dot = strcspn (sp, ".");
+
+  size = (dot < len) ? strlen (point) : 1;
+
+  buffer = (len + size < sizeof (local)) ? local : malloc (len + size);
+
+  if (!buffer)
+  {
+    if (end)
+      *end = (char *)string;
+
+    return (0.0);
+  }
+
+  if (dot < len)
+  {
+    memcpy (buffer, sp, dot);
+    memcpy (buffer + dot, point, size);
+    memcpy (buffer + dot + size, sp + dot + 1, len - dot - 1);
+  }
+  else
+  {
+    memcpy (buffer, sp, len);
+  }
+
+  buffer[len + size - 1] = '\0';
+
+  value = strtod (buffer, &tail);
+
+  done = tail - buffer;
+
+  if (done > dot)                                                               // Past the point: the locale's may be longer (or shorter) than '.';
+    done = (done < dot + size) ? dot : done - size + 1;
+
+  if (end)
+    *end = (char *)(done ? sp + done : string);
+
+  if (buffer != local)
+    free (buffer);
+
+  return (value);
+}
+
+/**
+ * Read up to 'count' numbers, separated by white space, off 'string' the way
+ * sscanf ("%lf %lf ...") would in the "C" locale; returns the number read.
+ */
+
+int
+gscan (const char *string, gfloat_t *value, int count)
+{
+  gfloat_t number;
+  char *end;
+  int i;
+
+  for (i = 0; i < count; i++)
+  {
+    number = gstrtod (string, &end);
+
+    if (end == string)
+      break;
+
+    value[i] = number;
+
+    string = end;
+  }
+
+  return (i);
+}
+
 void
 strswp (char *target, char oldchar, char newchar)
 {
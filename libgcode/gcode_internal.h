@@ -31,6 +31,8 @@
 #include <stdbool.h>
 #include <inttypes.h>
 #include "gcode_math.h"
+#include "gcode_voxel.h"
+#include "gcode_rope.h"
 
 #define NONE              0
 
@@ -93,6 +95,19 @@
 #define GCODE_POCKETING_TRADITIONAL   0x00
 #define GCODE_POCKETING_ALTERNATE_1   0x01
 
+#define GCODE_STOCK_VOXEL_MAP         0x00
+#define GCODE_STOCK_HEIGHT_MAP        0x01
+
+#define GCODE_SIM_STEPPED             0x00
+#define GCODE_SIM_SWEPT               0x01
+#define GCODE_SIM_MAX_THREADS         64
+#define GCODE_MAKE_MAX_THREADS        64
+#define GCODE_MAKE_PROBES             8                                         /* Tool positions a block made from an open entry may compare with */
+
+#define GCODE_OPEN_POSITION           (-FLT_MAX)                                /* Tool position along an axis left open while making a block */
+
+#define GCODE_HEIGHT_MAP_TOP          0xFFFF                                    /* Height map level of the untouched stock top */
+
 /* *INDENT-OFF* */
 
 enum
@@ -224,6 +239,7 @@ static const char *GCODE_XML_ATTR_BLOCK_FLAGS = "flags";
 
 struct gcode_s;
 struct gcode_block_s;
+struct gcode_sim_history_s;
 
 /**
  * Type definitions for block-specific functions
@@ -262,6 +278,20 @@ typedef struct gcode_offset_s
   gcode_vec2d_t z;                                                              // Z values for helical paths
 } gcode_offset_t;
 
+/**
+ * The tool positions a block made from an open entry (one that leaves some of
+ * the axes at GCODE_OPEN_POSITION) compared the tool with along such an axis -
+ * the code it made holds for any actual entry that equals none of them. More
+ * than GCODE_MAKE_PROBES of them means it only holds for that very entry.
+ */
+
+typedef struct gcode_make_probe_s
+{
+  uint8_t number;
+  uint8_t axis[GCODE_MAKE_PROBES];
+  gfloat_t value[GCODE_MAKE_PROBES];
+} gcode_make_probe_t;
+
 typedef struct gcode_block_s
 {
   uint8_t type;
@@ -285,9 +315,11 @@ typedef struct gcode_block_s
 
   void *pdata;
 
-  int code_alloc;
-  int code_len;
-  char *code;
+  gcode_rope_t code;
+  uint64_t make_stamp;                                                          // Fingerprint of everything but the tool position the code was last made from, 0 if not reusable
+  gcode_vec3d_t make_entry;                                                     // Tool position the code was last made from
+  gcode_vec3d_t make_exit;                                                      // Tool position the code was last made to leave the tool at
+  gcode_make_probe_t make_probe;                                                // Tool positions the code was made to compare with along the open axes of 'make_entry'
 
   gcode_free_t *free;
   gcode_save_t *save;
@@ -327,19 +359,35 @@ typedef struct gcode_s
 
   gcode_offset_t zero_offset;
 
-  uint16_t voxel_resolution;
-  uint16_t voxel_number[3];
-  uint8_t *voxel_map;
+  uint8_t stock_model;                                                          // Voxel map (3D) or height map (2.5D) stock simulation
+  uint8_t sim_mode;                                                             // Stepped (sampled) or swept (analytic) motion simulation
+  uint8_t sim_threads;                                                          // Number of simulation threads, 0 for one per processor
+  uint8_t make_threads;                                                         // Number of G-code generating threads, 0 for one per processor
+  uint8_t compact_output;                                                       // Drop the words and lines the controller can do without at export
+  uint8_t subprograms;                                                          // Export repeated templates as one subprogram called once per copy
+
+  uint32_t voxel_resolution;
+  uint32_t voxel_number[3];
+  uint8_t voxel_layout;                                                         // Storage layout of the voxel map (GCODE_VOXEL_*)
+  gcode_voxel_t voxel_map;
+
+  uint16_t height_resolution;                                                   // Number of height map cells along X + Y
+  uint16_t *height_map;                                                         // Top Z level of each XY cell, 0 to GCODE_HEIGHT_MAP_TOP
+
+  struct gcode_sim_history_s *sim_history;                                      // Checkpoints of the last final part render, NULL if none
 
   uint16_t curve_segments;
 
   gfloat_t roughing_overlap;
   gfloat_t padding_fraction;
+  gfloat_t fit_tolerance;                                                       // Furthest runs of short lines may stray from the line or arc replacing them, 0 for never
 
   gfloat_t tool_xpos;
   gfloat_t tool_ypos;
   gfloat_t tool_zpos;
 
+  gcode_make_probe_t *make_probe;                                               // Where to note down comparisons with an open tool position, NULL if none
+
   uint8_t format;
   uint8_t driver;
 
@@ -373,7 +421,11 @@ typedef struct xml_context_s
  */
 
 void gcode_internal_init (gcode_block_t *block, gcode_t *gcode, gcode_block_t *parent, uint8_t type, uint8_t flags);
+int gcode_make_probe (gcode_t *gcode, int axis, gfloat_t value);
+int gfixed (char *target, gfloat_t value, unsigned int decimals);
 void gsprintf (char *target, unsigned int number, char *format, ...);
+gfloat_t gstrtod (const char *string, char **end);
+int gscan (const char *string, gfloat_t *value, int count);
 void strswp (char *target, char oldchar, char newchar);
 
 /**
@@ -412,29 +464,25 @@ void strswp (char *target, char oldchar, char newchar);
         EQUIV_UNITS(_gcode->units, _num)
 
 #define GCODE_INIT(_block) { \
-        _block->code = NULL; }
+        gcode_rope_init (&_block->code); }
 
 #define GCODE_CLEAR(_block) { \
-        _block->code_len = 1; \
-        _block->code_alloc = 1; \
-        _block->code = realloc (_block->code, _block->code_alloc); \
-        _block->code[0] = '\0'; }
+        gcode_rope_clear (&_block->code); }
+
+#define GCODE_FREE(_block) { \
+        gcode_rope_free (&_block->code); }
 
 /**
- * increase by 64kB + string length + 1 if request to append greater than current buffer size.
- * includes optimized manual strcat code to vastly improve performance for large strings.
+ * appends go into the chunks of the block's rope; the string length is taken once.
+ * the code of a child block gets spliced in by reference instead of being copied.
  */
 
 #define GCODE_APPEND(_block, _str) { \
-        int _slen = strlen (_str) + 1, _i; \
-        if (_block->code_len + _slen > _block->code_alloc) \
-        { \
-          _block->code_alloc +=  (1 << 16) + _slen; \
-          _block->code = realloc (_block->code, _block->code_alloc); \
-        } \
-        for (_i = 0; _i < _slen; _i++) \
-          _block->code[_block->code_len + _i - 1] = _str[_i]; \
-        _block->code_len += _slen - 1; }
+        const char *_s = _str; \
+        gcode_rope_append (&_block->code, _s, strlen (_s)); }
+
+#define GCODE_SPLICE(_block, _child) { \
+        gcode_rope_splice (&_block->code, &_child->code); }
 
 #define GCODE_NEWLINE(_block) { \
         GCODE_APPEND (_block, "\n"); }
@@ -473,7 +521,7 @@ void strswp (char *target, char oldchar, char newchar);
 
 #define GCODE_F_VALUE(_block, _feed, _comment) { \
         char _string[256]; \
-        sprintf (_string, "F%.3f", _feed); \
+        gsprintf (_string, _block->gcode->decimals, "F%.3f", _feed); \
         GCODE_APPEND (_block, _string); \
         GCODE_PADDING (_block, _comment); \
         GCODE_COMMENT (_block, _comment); }
@@ -485,17 +533,24 @@ void strswp (char *target, char oldchar, char newchar);
         GCODE_PADDING (_block, _comment); \
         GCODE_COMMENT (_block, _comment); }
 
+/* Whether the tool is at '_value' along an axis now - never, if the axis is left open, but noted down as a probe */
+
+#define GCODE_TOOL_AT(_block, _pos, _axis, _value) \
+        (_block->gcode->_pos == GCODE_OPEN_POSITION ? \
+         gcode_make_probe (_block->gcode, _axis, _value) : \
+         GCODE_MATH_IS_EQUAL (_block->gcode->_pos, _value))
+
 /* Plunge and retract macros - WARNING: THESE WORK RELATIVE TO THE Z-ORIGIN, WHATEVER THAT MEANS... */
 
 #define GCODE_DESCEND(_block, _depth, _tool) { \
         gfloat_t _z = _block->gcode->material_origin[2] + _depth; \
-        if (!GCODE_MATH_IS_EQUAL (_block->gcode->tool_zpos, _z)) \
+        if (!GCODE_TOOL_AT (_block, tool_zpos, 2, _z)) \
         { \
           char _string[256]; \
           gsprintf (_string, _block->gcode->decimals, "G01 Z%z F%.3f ", _z, _tool->feed * _tool->plunge_ratio); \
           GCODE_APPEND (_block, _string); \
           GCODE_COMMENT (_block, "slow plunge"); \
-          sprintf (_string, "F%.3f ", _tool->feed); \
+          gsprintf (_string, _block->gcode->decimals, "F%.3f ", _tool->feed); \
           GCODE_APPEND (_block, _string); \
           GCODE_COMMENT (_block, "restore feed rate"); \
           _block->gcode->tool_zpos = _z; \
@@ -503,7 +558,7 @@ void strswp (char *target, char oldchar, char newchar);
 
 #define GCODE_PLUMMET(_block, _depth) { \
         gfloat_t _z = _block->gcode->material_origin[2] + _depth; \
-        if (!GCODE_MATH_IS_EQUAL (_block->gcode->tool_zpos, _z)) \
+        if (!GCODE_TOOL_AT (_block, tool_zpos, 2, _z)) \
         { \
           char _string[256]; \
           gsprintf (_string, _block->gcode->decimals, "G00 Z%z ", _z); \
@@ -514,7 +569,7 @@ void strswp (char *target, char oldchar, char newchar);
 
 #define GCODE_RETRACT(_block, _depth) { \
         gfloat_t _z = _block->gcode->material_origin[2] + _depth; \
-        if (!GCODE_MATH_IS_EQUAL (_block->gcode->tool_zpos, _z)) \
+        if (!GCODE_TOOL_AT (_block, tool_zpos, 2, _z)) \
         { \
           char _string[256]; \
           gsprintf (_string, _block->gcode->decimals, "G00 Z%z ", _z); \
@@ -524,7 +579,7 @@ void strswp (char *target, char oldchar, char newchar);
         }}
 
 #define GCODE_PULL_UP(_block, _depth) { \
-        if (!GCODE_MATH_IS_EQUAL (_block->gcode->tool_zpos, _depth)) \
+        if (!GCODE_TOOL_AT (_block, tool_zpos, 2, _depth)) \
         { \
           char _string[256]; \
           gsprintf (_string, _block->gcode->decimals, "G00 Z%z ", _depth); \
@@ -545,17 +600,17 @@ void strswp (char *target, char oldchar, char newchar);
         _block->gcode->tool_ypos = _y; }
 
 #define GCODE_2D_MOVE(_block, _x, _y, _comment) { \
-        if (!GCODE_MATH_IS_EQUAL (_block->gcode->tool_xpos, _x) || \
-            !GCODE_MATH_IS_EQUAL (_block->gcode->tool_ypos, _y)) \
+        if (!GCODE_TOOL_AT (_block, tool_xpos, 0, _x) || \
+            !GCODE_TOOL_AT (_block, tool_ypos, 1, _y)) \
         { \
           char _string[256]; \
           GCODE_APPEND (_block, "G00"); \
-          if (!GCODE_MATH_IS_EQUAL (_block->gcode->tool_xpos, _x)) \
+          if (!GCODE_TOOL_AT (_block, tool_xpos, 0, _x)) \
           { \
             gsprintf (_string, _block->gcode->decimals, " X%z", _x); \
             GCODE_APPEND (_block, _string); \
           } \
-          if (!GCODE_MATH_IS_EQUAL (_block->gcode->tool_ypos, _y)) \
+          if (!GCODE_TOOL_AT (_block, tool_ypos, 1, _y)) \
           { \
             gsprintf (_string, _block->gcode->decimals, " Y%z", _y); \
             GCODE_APPEND (_block, _string); \
@@ -567,17 +622,17 @@ void strswp (char *target, char oldchar, char newchar);
         }}
 
 #define GCODE_2D_LINE(_block, _x, _y, _comment) { \
-        if (!GCODE_MATH_IS_EQUAL (_block->gcode->tool_xpos, _x) || \
-            !GCODE_MATH_IS_EQUAL (_block->gcode->tool_ypos, _y)) \
+        if (!GCODE_TOOL_AT (_block, tool_xpos, 0, _x) || \
+            !GCODE_TOOL_AT (_block, tool_ypos, 1, _y)) \
         { \
           char _string[256]; \
           GCODE_APPEND (_block, "G01"); \
-          if (!GCODE_MATH_IS_EQUAL (_block->gcode->tool_xpos, _x)) \
+          if (!GCODE_TOOL_AT (_block, tool_xpos, 0, _x)) \
           { \
             gsprintf (_string, _block->gcode->decimals, " X%z", _x); \
             GCODE_APPEND (_block, _string); \
           } \
-          if (!GCODE_MATH_IS_EQUAL (_block->gcode->tool_ypos, _y)) \
+          if (!GCODE_TOOL_AT (_block, tool_ypos, 1, _y)) \
           { \
             gsprintf (_string, _block->gcode->decimals, " Y%z", _y); \
             GCODE_APPEND (_block, _string); \
@@ -589,23 +644,23 @@ void strswp (char *target, char oldchar, char newchar);
         }}
 
 #define GCODE_3D_LINE(_block, _x, _y, _z, _comment) { \
-        if (!GCODE_MATH_IS_EQUAL (_block->gcode->tool_xpos, _x) || \
-            !GCODE_MATH_IS_EQUAL (_block->gcode->tool_ypos, _y) || \
-            !GCODE_MATH_IS_EQUAL (_block->gcode->tool_zpos, _z)) \
+        if (!GCODE_TOOL_AT (_block, tool_xpos, 0, _x) || \
+            !GCODE_TOOL_AT (_block, tool_ypos, 1, _y) || \
+            !GCODE_TOOL_AT (_block, tool_zpos, 2, _z)) \
         { \
           char _string[256]; \
           GCODE_APPEND (_block, "G01"); \
-          if (!GCODE_MATH_IS_EQUAL (_block->gcode->tool_xpos, _x)) \
+          if (!GCODE_TOOL_AT (_block, tool_xpos, 0, _x)) \
           { \
             gsprintf (_string, _block->gcode->decimals, " X%z", _x); \
             GCODE_APPEND (_block, _string); \
           } \
-          if (!GCODE_MATH_IS_EQUAL (_block->gcode->tool_ypos, _y)) \
+          if (!GCODE_TOOL_AT (_block, tool_ypos, 1, _y)) \
           { \
             gsprintf (_string, _block->gcode->decimals, " Y%z", _y); \
             GCODE_APPEND (_block, _string); \
           } \
-          if (!GCODE_MATH_IS_EQUAL (_block->gcode->tool_zpos, _z)) \
+          if (!GCODE_TOOL_AT (_block, tool_zpos, 2, _z)) \
           { \
             gsprintf (_string, _block->gcode->decimals, " Z%z", _z); \
             GCODE_APPEND (_block, _string); \
@@ -677,15 +732,15 @@ void strswp (char *target, char oldchar, char newchar);
         _block->gcode->tool_zpos = FLT_MAX; }
 
 #define GCODE_MOVE_TO(_block, _x, _y, _z, _travel_z, _touch_z, _tool, _target) { \
-        if (!GCODE_MATH_IS_EQUAL (_block->gcode->tool_xpos, _x) || \
-            !GCODE_MATH_IS_EQUAL (_block->gcode->tool_ypos, _y)) \
+        if (!GCODE_TOOL_AT (_block, tool_xpos, 0, _x) || \
+            !GCODE_TOOL_AT (_block, tool_ypos, 1, _y)) \
         { \
           char _remark[256]; \
           sprintf (_remark, "move to %s", _target); \
           GCODE_RETRACT (_block, _travel_z); \
           GCODE_2D_MOVE (_block, _x, _y, _remark); \
         } \
-        if (!GCODE_MATH_IS_EQUAL (_block->gcode->tool_zpos, _z)) \
+        if (!GCODE_TOOL_AT (_block, tool_zpos, 2, _z)) \
         { \
           if (_touch_z >= _z) \
           { \
@@ -779,16 +834,27 @@ void strswp (char *target, char oldchar, char newchar);
         fprintf (_file, " %s=\"%X\"", _name, _value); }
 
 #define GCODE_WRITE_XML_ATTR_1D_FLT(_file, _name, _value) { \
-        fprintf (_file, " %s=\"%f\"", _name, _value); }
+        char _x[384]; \
+        gfixed (_x, _value, 6); \
+        fprintf (_file, " %s=\"%s\"", _name, _x); }
 
 #define GCODE_WRITE_XML_ATTR_2D_FLT(_file, _name, _value) { \
-        fprintf (_file, " %s=\"%f %f\"", _name, _value[0], _value[1]); }
+        char _x[384], _y[384]; \
+        gfixed (_x, _value[0], 6); \
+        gfixed (_y, _value[1], 6); \
+        fprintf (_file, " %s=\"%s %s\"", _name, _x, _y); }
 
 #define GCODE_WRITE_XML_ATTR_3D_FLT(_file, _name, _value) { \
-        fprintf (_file, " %s=\"%f %f %f\"", _name, _value[0], _value[1], _value[2]); }
+        char _x[384], _y[384], _z[384]; \
+        gfixed (_x, _value[0], 6); \
+        gfixed (_y, _value[1], 6); \
+        gfixed (_z, _value[2], 6); \
+        fprintf (_file, " %s=\"%s %s %s\"", _name, _x, _y, _z); }
 
 #define GCODE_WRITE_XML_CONTENT_FLT(_file, _value) { \
-        fprintf (_file, "%f ", _value); }
+        char _x[384]; \
+        gfixed (_x, _value, 6); \
+        fprintf (_file, "%s ", _x); }
 
 #define GCODE_WRITE_XML_END_OF_LINE(_file) { \
         fprintf (_file, "\n"); }
@@ -811,12 +877,12 @@ void strswp (char *target, char oldchar, char newchar);
         (sscanf (_string, "%X", &_value) == 1)
 
 #define GCODE_PARSE_XML_ATTR_1D_FLT(_value, _string) \
-        (sscanf (_string, "%lf", &_value) == 1)
+        (gscan (_string, &_value, 1) == 1)
 
 #define GCODE_PARSE_XML_ATTR_2D_FLT(_value, _string) \
-        (sscanf (_string, "%lf %lf", &_value[0], &_value[1]) == 2)
+        (gscan (_string, _value, 2) == 2)
 
 #define GCODE_PARSE_XML_ATTR_3D_FLT(_value, _string) \
-        (sscanf (_string, "%lf %lf %lf", &_value[0], &_value[1], &_value[2]) == 3)
+        (gscan (_string, _value, 3) == 3)
 
 #endif
@@ -72,7 +72,7 @@ gcode_line_init (gcode_block_t **block, gcode_t *gcode, gcode_block_t *parent)
 void
 gcode_line_free (gcode_block_t **block)
 {
-  free ((*block)->code);
+  GCODE_FREE ((*block));
   free ((*block)->pdata);
   free (*block);
   *block = NULL;
@@ -0,0 +1,407 @@
+/**
+ *  gcode_motion.c
+ *  Source code file for G-Code generation, simulation, and visualization
+ *  library.
+ *
+ *  Copyright (C) 2006 - 2010 by Justin Shumaker
+ *  Copyright (C) 2014 - 2020 by Asztalos Attila Oszkár
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gcode_motion.h"
+#include "gcode_util.h"
+
+void
+gcode_motion_state_init (gcode_motion_state_t *state, gcode_t *gcode)
+{
+  /**
+   * Position (0,0,0) refers to the left, back, top most corner.
+   * This allows us to treat the work piece as though it's in
+   * Quadrant-I of a 2d cartesian map.
+   */
+  GCODE_MATH_VEC3D_SET (state->pos, 0.0, 0.0, GCODE_PRECISION);
+  GCODE_MATH_VEC3D_SET (state->origin, 0.0, 0.0, 0.0);
+
+  state->tool_diameter = 1.0;
+
+  state->feed = 10;
+
+  if (gcode->units == GCODE_UNITS_MILLIMETER)
+    state->feed *= GCODE_INCH2MM;
+
+  state->absolute = 1;
+  state->units = gcode->units;
+  state->target_units = gcode->units;
+
+  state->cycle = 0;
+  state->G83_depth = 0.0;
+  state->G83_retract = 0.0;
+}
+
+void
+gcode_motion_list_init (gcode_motion_list_t *list)
+{
+  list->motion = NULL;
+  list->number = 0;
+  list->alloc = 0;
+}
+
+void
+gcode_motion_list_free (gcode_motion_list_t *list)
+{
+  free (list->motion);
+  gcode_motion_list_init (list);
+}
+
+/**
+ * Append a motion of 'type' to the list, stamped with the modal feed and tool
+ */
+
+static gcode_motion_t *
+gcode_motion_push (gcode_motion_list_t *list, gcode_motion_state_t *state, uint8_t type, uint32_t block)
+{
+  gcode_motion_t *motion;
+
+  if (list->number == list->alloc)
+  {
+    list->alloc = list->alloc ? 2 * list->alloc : 1024;
+    list->motion = realloc (list->motion, list->alloc * sizeof (gcode_motion_t));
+  }
+
+  motion = &list->motion[list->number++];
+
+  motion->type = type;
+  motion->block = block;
+  motion->feed = state->feed;
+  motion->tool_diameter = state->tool_diameter;
+
+  GCODE_MATH_VEC3D_SET (motion->ijk, 0.0, 0.0, 0.0);
+
+  return (motion);
+}
+
+/**
+ * Read the number right after a word letter, spanning only the characters a
+ * G-code number can have (so that "X1.0E2" reads 1.0, not 100).
+ */
+
+static gfloat_t
+gcode_motion_number (char *args, uint8_t *len)
+{
+  char string[32];
+
+  *len = strspn (args, "-.0123456789");
+
+  if (*len > sizeof (string) - 1)
+    *len = sizeof (string) - 1;
+
+  memcpy (string, args, *len);
+  string[*len] = '\0';
+
+  return (gstrtod (string, NULL));
+}
+
+/**
+ * Resolve the words of a motion: the target starts out as the current position
+ * with the words given overriding its axes (or, in relative mode, moving them
+ * by as much - the axes left out staying where they are either way).
+ */
+
+static void
+gcode_motion_words (gcode_motion_state_t *state, char *args, gcode_vec3d_t xyz, gcode_vec3d_t ijk, gfloat_t *rad)
+{
+  gcode_vec3d_t base;
+  gfloat_t scale, value;
+  uint8_t sind, len;
+
+  GCODE_MATH_VEC3D_SET (ijk, 0.0, 0.0, 0.0);
+  *rad = 0.0;
+
+  GCODE_MATH_VEC3D_COPY (xyz, state->pos);
+
+  if (state->absolute == 1)
+  {
+    GCODE_MATH_VEC3D_SET (base, 0.0, 0.0, 0.0);
+  }
+  else
+  {
+    GCODE_MATH_VEC3D_COPY (base, state->pos);
+  }
+
+  /* Code written in other units than the project gets converted on the fly */
+  if (state->units == state->target_units)
+    scale = 1.0;
+  else if (state->units == GCODE_UNITS_INCH)
+    scale = GCODE_INCH2MM;
+  else
+    scale = GCODE_MM2INCH;
+
+  sind = 0;
+
+  while (args[sind])
+  {
+    sind++;
+
+    value = scale * gcode_motion_number (&args[sind], &len);
+
+    switch (args[sind - 1])
+    {
+      case 'F':
+      case 'f':
+        state->feed = value;
+        break;
+
+      case 'I':
+      case 'i':
+        ijk[0] = value;
+        break;
+
+      case 'J':
+      case 'j':
+        ijk[1] = value;
+        break;
+
+      case 'K':
+      case 'k':
+        ijk[2] = value;
+        break;
+
+      case 'R':
+      case 'r':
+        *rad = value;
+        break;
+
+      case 'X':
+      case 'x':
+        xyz[0] = base[0] + value;
+        break;
+
+      case 'Y':
+      case 'y':
+        xyz[1] = base[1] + value;
+        break;
+
+      case 'Z':
+      case 'z':
+        xyz[2] = base[2] + value;
+        break;
+
+      default:
+        break;
+    }
+
+    sind += len;
+  }
+}
+
+static void
+gcode_motion_line (gcode_motion_list_t *list, gcode_motion_state_t *state, char *args, uint32_t block)
+{
+  gcode_motion_t *motion;
+  gcode_vec3d_t xyz, ijk;
+  gfloat_t rad;
+
+  gcode_motion_words (state, args, xyz, ijk, &rad);
+
+  motion = gcode_motion_push (list, state, GCODE_MOTION_LINE, block);
+  GCODE_MATH_VEC3D_COPY (motion->xyz, xyz);
+
+  GCODE_MATH_VEC3D_COPY (state->pos, xyz);
+}
+
+static void
+gcode_motion_arc (gcode_motion_list_t *list, gcode_motion_state_t *state, char *args, uint32_t block, int clockwise)
+{
+  gcode_motion_t *motion;
+  gcode_vec3d_t xyz, ijk;
+  gfloat_t rad;
+
+  gcode_motion_words (state, args, xyz, ijk, &rad);
+
+  if (rad > GCODE_PRECISION)                                                    /* XYZ Radius format */
+  {
+    /* Not implemented yet. */
+  }
+  else if (fabs (ijk[0]) > GCODE_PRECISION || fabs (ijk[1]) > GCODE_PRECISION || fabs (ijk[2]) > GCODE_PRECISION)       /* IJK format */
+  {
+    motion = gcode_motion_push (list, state, clockwise ? GCODE_MOTION_ARC_CW : GCODE_MOTION_ARC_CCW, block);
+    GCODE_MATH_VEC3D_COPY (motion->xyz, xyz);
+    GCODE_MATH_VEC3D_COPY (motion->ijk, ijk);
+
+    GCODE_MATH_VEC3D_COPY (state->pos, xyz);
+  }
+}
+
+/**
+ * Canned drilling cycle (G81 / G83, or just X / Y words while one is in effect):
+ * jump over the hole at the retract height, then plunge to the final depth.
+ */
+
+static void
+gcode_motion_drill (gcode_motion_list_t *list, gcode_motion_state_t *state, char *args, uint32_t block, int init)
+{
+  gcode_motion_t *motion;
+  gcode_vec3d_t xyz, ijk;
+  gfloat_t retract;
+
+  gcode_motion_words (state, args, xyz, ijk, &retract);
+
+  if (init)
+  {
+    state->G83_retract = retract;
+    state->G83_depth = xyz[2];
+  }
+
+  motion = gcode_motion_push (list, state, GCODE_MOTION_JUMP, block);
+  GCODE_MATH_VEC3D_SET (motion->xyz, xyz[0], xyz[1], state->G83_retract);
+
+  motion = gcode_motion_push (list, state, GCODE_MOTION_LINE, block);
+  GCODE_MATH_VEC3D_SET (motion->xyz, xyz[0], xyz[1], state->G83_depth);
+
+  GCODE_MATH_VEC3D_COPY (state->pos, motion->xyz);
+}
+
+/**
+ * Compile one line of G-code into zero or more motions appended to 'list', the
+ * line being modified in place (spaces and comments are stripped).
+ */
+
+void
+gcode_motion_compile_line (gcode_motion_list_t *list, gcode_motion_state_t *state, char *line, uint32_t block)
+{
+  gcode_motion_t *motion;
+  char *gv;
+  uint8_t sind, len;
+  int i;
+
+  sind = 0;
+
+  /* Scan for comments of the form (Tool diameter: VALUE) */
+  gv = strstr (line, "Tool Diameter:");
+
+  if (gv && (gv = strpbrk (line, ".0123456789")))
+    state->tool_diameter = gcode_motion_number (gv, &len);
+
+  /* Scan for comments of the form (Origin offset: X=VALUE Y=VALUE Z=VALUE) */
+  gv = strstr (line, "Origin Offset:");
+
+  if (gv)
+  {
+    for (i = 0; i < 3 && (gv = strpbrk (gv, ".0123456789")); i++)
+    {
+      state->origin[i] = gcode_motion_number (gv, &len);
+      state->pos[i] += state->origin[i];
+      gv += len;
+    }
+
+    motion = gcode_motion_push (list, state, GCODE_MOTION_ORIGIN, block);
+    GCODE_MATH_VEC3D_COPY (motion->xyz, state->origin);
+  }
+
+  /* Remove the spaces */
+  gcode_util_remove_spaces (line);
+
+  /* Strip comments */
+  gcode_util_remove_comment (line);
+
+  switch (line[sind])
+  {
+    case 'G':
+    {
+      int number;
+
+      sind++;
+
+      /* The Number */
+      len = strspn (&line[sind], "0123456789");
+      number = len ? atoi (&line[sind]) : 0;
+      sind += len;
+
+      switch (number)
+      {
+        case 0:
+        case 1:
+          gcode_motion_line (list, state, &line[sind], block);
+          break;
+
+        case 2:
+          gcode_motion_arc (list, state, &line[sind], block, 1);
+          break;
+
+        case 3:
+          gcode_motion_arc (list, state, &line[sind], block, 0);
+          break;
+
+        case 4:
+          /* Dwell */
+          break;
+
+        case 20:
+          state->units = GCODE_UNITS_INCH;
+          break;
+
+        case 21:
+          state->units = GCODE_UNITS_MILLIMETER;
+          break;
+
+        case 81:
+        case 83:
+          gcode_motion_drill (list, state, &line[sind], block, 1);
+          state->cycle = 83;
+          break;
+
+        case 90:
+          state->absolute = 1;
+          break;
+
+        case 91:
+          state->absolute = 0;
+          break;
+
+        default:
+          break;
+      }
+      break;
+    }
+
+    case 'F':
+    {
+      gfloat_t value;
+
+      sind++;
+
+      value = gcode_motion_number (&line[sind], &len);
+
+      if (state->units != state->target_units)
+        value *= (state->units == GCODE_UNITS_INCH) ? GCODE_INCH2MM : GCODE_MM2INCH;
+
+      state->feed = value;
+      break;
+    }
+
+    case 'X':
+    case 'Y':
+    {
+      if (state->cycle == 83)
+      {
+        gcode_motion_drill (list, state, &line[sind], block, 0);
+      }
+      break;
+    }
+
+    default:
+      break;
+  }
+}
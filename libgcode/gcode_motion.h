@@ -0,0 +1,81 @@
+/**
+ *  gcode_motion.h
+ *  Source code file for G-Code generation, simulation, and visualization
+ *  library.
+ *
+ *  Copyright (C) 2006 - 2010 by Justin Shumaker
+ *  Copyright (C) 2014 - 2020 by Asztalos Attila Oszkár
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _GCODE_MOTION_H
+#define _GCODE_MOTION_H
+
+#include "gcode_internal.h"
+
+#define GCODE_MOTION_LINE           0x00                                        /* Linear move (G00, G01 or a canned cycle plunge) */
+#define GCODE_MOTION_ARC_CW         0x01                                        /* Clockwise arc (G02) */
+#define GCODE_MOTION_ARC_CCW        0x02                                        /* Counter-clockwise arc (G03) */
+#define GCODE_MOTION_JUMP           0x03                                        /* Reposition without cutting (canned cycle retract) */
+#define GCODE_MOTION_ORIGIN         0x04                                        /* New material origin, shifting the position along */
+
+/**
+ * A single motion compiled from G-code: everything needed to carry it out is
+ * resolved at compile time (modal words, absolute targets, units), so that the
+ * consumers only ever loop over a flat array of these.
+ */
+
+typedef struct gcode_motion_s
+{
+  uint8_t type;                                                                 // GCODE_MOTION_*
+  uint32_t block;                                                               // Index of the top-level block the motion comes from
+  gfloat_t feed;                                                                // Units per minute
+  gfloat_t tool_diameter;                                                       // End mill diameter
+  gcode_vec3d_t xyz;                                                            // Target position (or the new origin)
+  gcode_vec3d_t ijk;                                                            // Arc center, relative to the start
+} gcode_motion_t;
+
+/**
+ * Modal state of the G-code compiler, carried from one line (and one block) to
+ * the next; a copy of it is all it takes to resume compiling somewhere else.
+ */
+
+typedef struct gcode_motion_state_s
+{
+  gcode_vec3d_t pos;                                                            // Current position
+  gfloat_t origin[3];                                                           // Material origin
+  gfloat_t tool_diameter;                                                       // End mill diameter
+  gfloat_t feed;                                                                // Units per minute
+  uint8_t absolute;                                                             // Absolute (G90) or relative (G91) coordinates
+  uint8_t units;                                                                // Units of the code (G20 / G21)
+  uint8_t target_units;                                                         // Units of the project, all motions get converted to
+  uint32_t cycle;                                                               // Canned cycle in effect (83) or 0
+  gfloat_t G83_depth;                                                           // Canned cycle final depth
+  gfloat_t G83_retract;                                                         // Canned cycle retract height
+} gcode_motion_state_t;
+
+typedef struct gcode_motion_list_s
+{
+  gcode_motion_t *motion;
+  uint32_t number;
+  uint32_t alloc;
+} gcode_motion_list_t;
+
+void gcode_motion_state_init (gcode_motion_state_t *state, gcode_t *gcode);
+void gcode_motion_list_init (gcode_motion_list_t *list);
+void gcode_motion_list_free (gcode_motion_list_t *list);
+void gcode_motion_compile_line (gcode_motion_list_t *list, gcode_motion_state_t *state, char *line, uint32_t block);
+
+#endif
@@ -22,6 +22,7 @@
 
 #include "gcode_pocket.h"
 #include "gcode_util.h"
+#include "gcode_arc.h"
 #include "gcode_line.h"
 #include "gcode_tool.h"
 #include "gcode.h"
@@ -36,6 +37,8 @@ gcode_pocket_init (gcode_pocket_t *pocket, gcode_block_t *target, gcode_tool_t *
   pocket->first_block = NULL;
   pocket->final_block = NULL;
   pocket->row_array = NULL;
+
+  gcode_index_init (&pocket->index);
 }
 
 void
@@ -49,6 +52,82 @@ gcode_pocket_free (gcode_pocket_t *pocket)
   }
 
   free (pocket->row_array);
+
+  gcode_index_free (&pocket->index);
+}
+
+/**
+ * An edge of the contour as seen by the scanline: the block itself and the
+ * range of 'y' its 'eval' can possibly return anything for (a bit on the wide
+ * side, so the block gets asked rather than skipped when in doubt);
+ */
+
+typedef struct pocket_edge_s
+{
+  gcode_block_t *block;
+  gfloat_t y_min;
+  gfloat_t y_max;
+} pocket_edge_t;
+
+static void
+pocket_edge_span (pocket_edge_t *edge)
+{
+  gcode_vec2d_t p0, p1, normal, center;
+  gfloat_t radius, start_angle, margin;
+
+  margin = 2 * GCODE_PRECISION;
+
+  switch (edge->block->type)
+  {
+    case GCODE_TYPE_LINE:
+
+      gcode_line_with_offset (edge->block, p0, p1, normal);                     // Lines answer within precision of their endpoints' 'y';
+
+      edge->y_min = fmin (p0[1], p1[1]) - margin;
+      edge->y_max = fmax (p0[1], p1[1]) + margin;
+
+      break;
+
+    case GCODE_TYPE_ARC:                                                        // Arcs answer anywhere their full circle does;
+
+      gcode_arc_with_offset (edge->block, p0, center, p1, &radius, &start_angle);
+
+      edge->y_min = center[1] - fabs (radius) - GCODE_PRECISION_FLOOR - margin;
+      edge->y_max = center[1] + fabs (radius) + GCODE_PRECISION_FLOOR + margin;
+
+      break;
+
+    default:
+
+      edge->y_min = -DBL_MAX;                                                   // Anything else gets asked on every row;
+      edge->y_max = DBL_MAX;
+  }
+}
+
+static int
+pocket_edge_compare (const void *a, const void *b)
+{
+  const pocket_edge_t *edge_a, *edge_b;
+
+  edge_a = (const pocket_edge_t *)a;
+  edge_b = (const pocket_edge_t *)b;
+
+  return ((edge_a->y_min > edge_b->y_min) - (edge_a->y_min < edge_b->y_min));
+}
+
+/**
+ * Make sure 'row' has room for at least one more line than it has now;
+ */
+
+static void
+pocket_row_reserve (gcode_pocket_row_t *row)
+{
+  if (row->line_count < row->line_alloc)
+    return;
+
+  row->line_alloc = row->line_alloc ? 2 * row->line_alloc : 4;
+
+  row->line_array = realloc (row->line_array, row->line_alloc * sizeof (gcode_vec2d_t));
 }
 
 void
@@ -57,10 +136,14 @@ gcode_pocket_prep (gcode_pocket_t *pocket, gcode_block_t *first_block, gcode_blo
   gcode_t *gcode;
   gcode_block_t *index_block;
   gcode_pocket_row_t *row;
-  gfloat_t x_array[1024], y;
-  uint32_t x_index, i;
+  pocket_edge_t *edge_array;
+  pocket_edge_t **active_array;
+  gfloat_t *x_array, y;
+  uint32_t x_index, x_alloc, i;
+  uint32_t edge_count, edge_index, active_count;
   gfloat_t y_min, y_max;
   gfloat_t y_resolution;
+  int row_alloc;
 
   gcode = pocket->target->gcode;
 
@@ -70,39 +153,84 @@ gcode_pocket_prep (gcode_pocket_t *pocket, gcode_block_t *first_block, gcode_blo
   y_resolution = pocket->tool->diameter * (1 - gcode->roughing_overlap);
 
   /**
-   * Call eval on each block and get the x values. Next, sort the x values.
-   * Using odd/even fill/nofill gapping, generate lines to fill the gaps.
+   * Sort the blocks of the contour by the lowest 'y' they reach, then sweep a
+   * horizontal line upwards across the material one raster row at a time: the
+   * blocks the line has reached enter the "active edge list", the ones it has
+   * left behind drop out, and only the active ones get their 'eval' called to
+   * get the x values. Next, sort the x values. Using odd/even fill/nofill
+   * gapping, generate lines to fill the gaps.
    */
 
-  pocket->row_count = (int)(1 + gcode->material_size[1] / y_resolution);
+  edge_count = 0;
+
+  for (index_block = first_block; index_block != final_block; index_block = index_block->next)
+    edge_count++;
+
+  edge_array = malloc ((edge_count ? edge_count : 1) * sizeof (pocket_edge_t));
+  active_array = malloc ((edge_count ? edge_count : 1) * sizeof (pocket_edge_t *));
+
+  edge_count = 0;
+
+  for (index_block = first_block; index_block != final_block; index_block = index_block->next)
+  {
+    edge_array[edge_count].block = index_block;
+
+    pocket_edge_span (&edge_array[edge_count]);
+
+    edge_count++;
+  }
+
+  qsort (edge_array, edge_count, sizeof (pocket_edge_t), pocket_edge_compare);
+
+  x_alloc = 64;
+  x_array = malloc (x_alloc * sizeof (gfloat_t));
+
+  row_alloc = (int)(2 + gcode->material_size[1] / y_resolution);
 
-  pocket->row_array = malloc (pocket->row_count * sizeof (gcode_pocket_row_t));
+  pocket->row_array = malloc (row_alloc * sizeof (gcode_pocket_row_t));
 
   pocket->row_count = 0;
 
   y_min = 0.0 - gcode->material_origin[1];
   y_max = y_min + gcode->material_size[1];
 
-  for (y = y_min; y <= y_max; y += y_resolution)
+  edge_index = 0;
+  active_count = 0;
+
+  for (y = y_min; (y <= y_max) && (pocket->row_count < row_alloc); y += y_resolution)
   {
     row = &pocket->row_array[pocket->row_count];
 
-    row->line_array = malloc (64 * sizeof (gcode_vec2d_t));
+    while ((edge_index < edge_count) && (edge_array[edge_index].y_min <= y))    // Let the edges the line has reached by now into the active list,
+      active_array[active_count++] = &edge_array[edge_index++];
 
-    x_index = 0;
+    for (i = 0; i < active_count; )                                             // and drop the ones it has moved past (their order does not matter);
+    {
+      if (active_array[i]->y_max < y)
+        active_array[i] = active_array[--active_count];
+      else
+        i++;
+    }
 
-    index_block = first_block;
+    x_index = 0;
 
-    while ((index_block != final_block) && (x_index < MAX_ELEMENTS (x_array) - 2))
+    for (i = 0; i < active_count; i++)
     {
-      index_block->eval (index_block, y, x_array, &x_index);
-      index_block = index_block->next;
+      if (x_index + 2 > x_alloc)                                                // No block ever returns more than two x values;
+      {
+        x_alloc *= 2;
+        x_array = realloc (x_array, x_alloc * sizeof (gfloat_t));
+      }
+
+      active_array[i]->block->eval (active_array[i]->block, y, x_array, &x_index);
     }
 
     qsort (x_array, x_index, sizeof (gfloat_t), gcode_util_qsort_compare_asc);
     gcode_util_remove_duplicate_scalars (x_array, &x_index);
 
     row->line_count = 0;
+    row->line_alloc = 0;
+    row->line_array = NULL;
 
     /* Generate the Lines */
 
@@ -110,6 +238,8 @@ gcode_pocket_prep (gcode_pocket_t *pocket, gcode_block_t *first_block, gcode_blo
     {
       for (i = 0; i + 1 < x_index; i += 2)
       {
+        pocket_row_reserve (row);
+
         row->line_array[row->line_count][0] = x_array[i];
         row->line_array[row->line_count][1] = x_array[i + 1];
         row->line_count++;
@@ -121,6 +251,10 @@ gcode_pocket_prep (gcode_pocket_t *pocket, gcode_block_t *first_block, gcode_blo
 
     pocket->row_count++;
   }
+
+  free (x_array);
+  free (active_array);
+  free (edge_array);
 }
 
 /**
@@ -131,7 +265,7 @@ gcode_pocket_prep (gcode_pocket_t *pocket, gcode_block_t *first_block, gcode_blo
 static int
 now_at_depth (gcode_pocket_t *pocket, gfloat_t z)
 {
-  if (GCODE_MATH_IS_EQUAL (pocket->target->gcode->tool_zpos, z))
+  if (GCODE_TOOL_AT (pocket->target, tool_zpos, 2, z))
     return (1);
   else
     return (0);
@@ -142,7 +276,8 @@ now_at_depth (gcode_pocket_t *pocket, gfloat_t z)
  * from the current tool position (stored in the gcode of the pocket's target)
  * to (x,y) in a straight line without ever hitting the contour of 'pocket';
  * unfortunately, finding that out that implies intersecting every segment of
- * the contour with the line starting where the tool is and ending in (x,y);
+ * the contour near the line starting where the tool is and ending in (x,y) -
+ * the contour gets a spatial index so the far away segments are left alone;
  * NOTE: pockets are created ('prepped') based on a list of blocks that are
  * already offset according to the depth 'z' the pocket is meant to be milled
  * out at AND according to the appropriate tool radius; pockets keep pointers
@@ -158,8 +293,8 @@ path_within_pocket (gcode_pocket_t *pocket, gfloat_t x, gfloat_t y)
   gcode_block_t *index_block;
   gcode_vec2d_t p0, p1;
   gcode_vec2d_t lmin, lmax;
-  gcode_vec2d_t bmin, bmax;
   gcode_vec2d_t ip_array[2];
+  uint32_t i;
   int ip_count;
   int result;
 
@@ -168,6 +303,9 @@ path_within_pocket (gcode_pocket_t *pocket, gfloat_t x, gfloat_t y)
   p0[0] = gcode->tool_xpos;                                                     // The starting point 'p0' is the current position of the tool;
   p0[1] = gcode->tool_ypos;
 
+  if (p0[0] == GCODE_OPEN_POSITION || p0[1] == GCODE_OPEN_POSITION)             // If that was left open, the code made only holds for the very entry it was made from;
+    gcode_make_probe (gcode, -1, 0.0);
+
   p1[0] = x;                                                                    // The target point 'p1' is the (x,y) coordinates supplied;
   p1[1] = y;
 
@@ -179,36 +317,34 @@ path_within_pocket (gcode_pocket_t *pocket, gfloat_t x, gfloat_t y)
 
   gcode_line_qdbb (line_block, lmin, lmax);                                     // Get a quick-and-dirty bounding box for the line;
 
-  index_block = pocket->first_block;                                            // Traverse the source block list starting from the saved reference;
+  if (!pocket->index.cell_first)                                                // The contour only gets indexed the first time it's needed;
+    gcode_index_blocks (&pocket->index, pocket->first_block, pocket->final_block);
+
+  gcode_index_box (&pocket->index, lmin, lmax);                                 // Only blocks whose bounding boxes don't clear the line's are worth intersecting;
 
-  while (index_block != pocket->final_block)
+  for (i = 0; i < pocket->index.found_number && result; i++)                    // Once the path is ruled out, there is no need to look any further;
   {
-    gcode_util_qdbb (index_block, bmin, bmax);                                  // Get a quick-and-dirty bounding box for the current block too;
+    index_block = (gcode_block_t *)pocket->index.item_data[pocket->index.found[i]];
 
-    if (!GCODE_MATH_IS_APART (lmin, lmax, bmin, bmax))                          // If the bounding boxes clear each other, don't even try to intersect;
+    if (gcode_util_intersect (line_block, index_block, ip_array, &ip_count) == 0)
     {
-      if (gcode_util_intersect (line_block, index_block, ip_array, &ip_count) == 0)
-      {
-        gfloat_t dist0, dist1;                                                  // So we do have intersection - that in itself does not rule out this path;
+      gfloat_t dist0, dist1;                                                    // So we do have intersection - that in itself does not rule out this path;
 
-        dist0 = GCODE_MATH_2D_DISTANCE (p0, ip_array[0]);                       // The intersection point is compared to the proposed path's endpoints;
-        dist1 = GCODE_MATH_2D_DISTANCE (p1, ip_array[0]);
+      dist0 = GCODE_MATH_2D_DISTANCE (p0, ip_array[0]);                         // The intersection point is compared to the proposed path's endpoints;
+      dist1 = GCODE_MATH_2D_DISTANCE (p1, ip_array[0]);
 
-        if ((dist0 > GCODE_PRECISION) && (dist1 > GCODE_PRECISION))             // If it coincides with neither of them though, this path would cross outside
-          result = FALSE;                                                       // the pocket's contour removing material that it should not: it's not viable.
+      if ((dist0 > GCODE_PRECISION) && (dist1 > GCODE_PRECISION))               // If it coincides with neither of them though, this path would cross outside
+        result = FALSE;                                                         // the pocket's contour removing material that it should not: it's not viable.
 
-        if (ip_count > 1)                                                       // If there's a second intersection point, it's compared to the endpoints too;
-        {
-          dist0 = GCODE_MATH_2D_DISTANCE (p0, ip_array[1]);
-          dist1 = GCODE_MATH_2D_DISTANCE (p1, ip_array[1]);
+      if (ip_count > 1)                                                         // If there's a second intersection point, it's compared to the endpoints too;
+      {
+        dist0 = GCODE_MATH_2D_DISTANCE (p0, ip_array[1]);
+        dist1 = GCODE_MATH_2D_DISTANCE (p1, ip_array[1]);
 
-          if ((dist0 > GCODE_PRECISION) && (dist1 > GCODE_PRECISION))           // The same logic applies: if it's not one of the ends of the proposed path,
-            result = FALSE;                                                     // this path is not viable.
-        }
+        if ((dist0 > GCODE_PRECISION) && (dist1 > GCODE_PRECISION))             // The same logic applies: if it's not one of the ends of the proposed path,
+          result = FALSE;                                                       // this path is not viable.
       }
     }
-
-    index_block = index_block->next;                                            // Move on to the next block in the pocket contour;
   }
 
   line_block->free (&line_block);                                               // Dispose of the line block we created;
@@ -476,6 +612,8 @@ gcode_pocket_subtract (gcode_pocket_t *pocket_a, gcode_pocket_t *pocket_b)
             row_b->line_array[k][1] - GCODE_PRECISION <= row_a->line_array[j][1])
         {
           /* CASE 1: split into 2 lines, shift all lines up one, insert new line into free slot */
+          pocket_row_reserve (row_a);
+
           for (l = row_a->line_count - 1; l > j; l--)
           {
             row_a->line_array[l + 1][0] = row_a->line_array[l][0];
@@ -25,10 +25,12 @@
 
 #include "gcode_internal.h"
 #include "gcode_tool.h"
+#include "gcode_index.h"
 
 typedef struct gcode_pocket_row_s
 {
   int line_count;
+  int line_alloc;
   gcode_vec2d_t *line_array;
   gfloat_t y;
 } gcode_pocket_row_t;
@@ -42,6 +44,7 @@ typedef struct gcode_pocket_s
   gcode_block_t *first_block;
   gcode_block_t *final_block;
   gcode_pocket_row_t *row_array;
+  gcode_index_t index;                                                          // Spatial index of the contour, built on the first path check
 } gcode_pocket_t;
 
 void gcode_pocket_init (gcode_pocket_t *pocket, gcode_block_t *target, gcode_tool_t *tool);
@@ -64,7 +64,7 @@ gcode_point_init (gcode_block_t **block, gcode_t *gcode, gcode_block_t *parent)
 void
 gcode_point_free (gcode_block_t **block)
 {
-  free ((*block)->code);
+  GCODE_FREE ((*block));
   free ((*block)->pdata);
   free (*block);
   *block = NULL;
@@ -0,0 +1,217 @@
+/**
+ *  gcode_rope.c
+ *  Source code file for G-Code generation, simulation, and visualization
+ *  library.
+ *
+ *  Copyright (C) 2006 - 2010 by Justin Shumaker
+ *  Copyright (C) 2014 - 2020 by Asztalos Attila Oszkár
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gcode_rope.h"
+#include "gcode_internal.h"
+
+/**
+ * Make room for one more piece at the end of the rope
+ */
+
+static gcode_rope_piece_t *
+gcode_rope_push (gcode_rope_t *rope)
+{
+  gcode_rope_piece_t *piece;
+
+  if (rope->piece_number == rope->piece_alloc)
+  {
+    piece = realloc (rope->piece, (rope->piece_alloc ? 2 * rope->piece_alloc : 16) * sizeof (gcode_rope_piece_t));
+
+    if (!piece)
+    {
+      REMARK ("Failed to allocate memory for G-code\n");
+      return (NULL);
+    }
+
+    rope->piece = piece;
+    rope->piece_alloc = rope->piece_alloc ? 2 * rope->piece_alloc : 16;
+  }
+
+  return (&rope->piece[rope->piece_number++]);
+}
+
+/**
+ * Let go of one reference to 'chunk', freeing it once nothing refers to it
+ */
+
+static void
+gcode_rope_release (gcode_rope_chunk_t *chunk)
+{
+  if (--chunk->refs == 0)
+    free (chunk);
+}
+
+void
+gcode_rope_init (gcode_rope_t *rope)
+{
+  rope->tail = NULL;
+  rope->piece = NULL;
+  rope->piece_number = 0;
+  rope->piece_alloc = 0;
+  rope->len = 0;
+}
+
+/**
+ * Empty the rope, letting go of its pieces; the tail chunk stays with the rope,
+ * and starts over from its first byte if no other rope refers to it any more.
+ */
+
+void
+gcode_rope_clear (gcode_rope_t *rope)
+{
+  uint32_t i;
+
+  for (i = 0; i < rope->piece_number; i++)
+    gcode_rope_release (rope->piece[i].chunk);
+
+  if (rope->tail && rope->tail->refs == 1)
+    rope->tail->len = 0;
+
+  rope->piece_number = 0;
+  rope->len = 0;
+}
+
+void
+gcode_rope_free (gcode_rope_t *rope)
+{
+  gcode_rope_clear (rope);
+
+  if (rope->tail)
+    gcode_rope_release (rope->tail);
+
+  free (rope->piece);
+  gcode_rope_init (rope);
+}
+
+/**
+ * Append 'len' bytes of 'string' into the tail chunk, or into a new tail chunk
+ * if they do not fit; the last piece just grows when it ends at the tail's end.
+ */
+
+void
+gcode_rope_append (gcode_rope_t *rope, const char *string, size_t len)
+{
+  gcode_rope_piece_t *piece;
+  gcode_rope_chunk_t *chunk;
+  size_t alloc;
+
+  if (!len)
+    return;
+
+  chunk = rope->tail;
+
+  if (!chunk || chunk->alloc - chunk->len < len)
+  {
+    alloc = (len > GCODE_ROPE_CHUNK_SIZE) ? len : GCODE_ROPE_CHUNK_SIZE;
+
+    chunk = malloc (sizeof (gcode_rope_chunk_t) + alloc);
+
+    if (!chunk)
+    {
+      REMARK ("Failed to allocate memory for G-code\n");
+      return;
+    }
+
+    chunk->refs = 1;
+    chunk->len = 0;
+    chunk->alloc = alloc;
+
+    if (rope->tail)
+      gcode_rope_release (rope->tail);
+
+    rope->tail = chunk;
+  }
+
+  piece = rope->piece_number ? &rope->piece[rope->piece_number - 1] : NULL;
+
+  if (!piece || piece->chunk != chunk || piece->offset + piece->len != chunk->len)
+  {
+    piece = gcode_rope_push (rope);
+
+    if (!piece)
+      return;
+
+    piece->chunk = chunk;
+    piece->offset = chunk->len;
+    piece->len = 0;
+
+    chunk->refs++;
+  }
+
+  memcpy (&chunk->data[chunk->len], string, len);
+  chunk->len += len;
+  piece->len += len;
+
+  rope->len += len;
+}
+
+/**
+ * Append all of 'source' by reference: its pieces get shared, not copied, and
+ * stay valid even once 'source' gets cleared or freed.
+ */
+
+void
+gcode_rope_splice (gcode_rope_t *rope, gcode_rope_t *source)
+{
+  gcode_rope_piece_t *piece, *last;
+  uint32_t i;
+
+  for (i = 0; i < source->piece_number; i++)
+  {
+    last = rope->piece_number ? &rope->piece[rope->piece_number - 1] : NULL;
+
+    /* Pieces that follow on within the same chunk merge back into one */
+    if (last && last->chunk == source->piece[i].chunk && last->offset + last->len == source->piece[i].offset)
+    {
+      last->len += source->piece[i].len;
+    }
+    else
+    {
+      piece = gcode_rope_push (rope);
+
+      if (!piece)
+        return;
+
+      *piece = source->piece[i];
+      piece->chunk->refs++;
+    }
+
+    rope->len += source->piece[i].len;
+  }
+}
+
+/**
+ * The last byte of the rope, '\0' if it is empty
+ */
+
+char
+gcode_rope_last (gcode_rope_t *rope)
+{
+  gcode_rope_piece_t *piece;
+
+  if (!rope->piece_number)
+    return ('\0');
+
+  piece = &rope->piece[rope->piece_number - 1];
+
+  return (piece->chunk->data[piece->offset + piece->len - 1]);
+}
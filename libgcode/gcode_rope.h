@@ -0,0 +1,73 @@
+/**
+ *  gcode_rope.h
+ *  Source code file for G-Code generation, simulation, and visualization
+ *  library.
+ *
+ *  Copyright (C) 2006 - 2010 by Justin Shumaker
+ *  Copyright (C) 2014 - 2020 by Asztalos Attila Oszkár
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _GCODE_ROPE_H
+#define _GCODE_ROPE_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#define GCODE_ROPE_CHUNK_SIZE       (1 << 16)                                   /* Bytes per chunk, unless a single append needs more */
+
+/**
+ * A chunk of generated code; bytes only ever get added past 'len', never changed,
+ * so any number of ropes can share what is already there.
+ */
+
+typedef struct gcode_rope_chunk_s
+{
+  uint32_t refs;                                                                // Number of rope pieces referring to the chunk
+  uint32_t len;                                                                 // Bytes written so far
+  uint32_t alloc;                                                               // Bytes 'data' can hold
+  char data[];
+} gcode_rope_chunk_t;
+
+typedef struct gcode_rope_piece_s
+{
+  gcode_rope_chunk_t *chunk;
+  uint32_t offset;                                                              // First byte of the piece within the chunk
+  uint32_t len;
+} gcode_rope_piece_t;
+
+/**
+ * The G-code of a block: a list of pieces of chunks, read in order. Appending
+ * writes into the rope's own 'tail' chunk (which no other rope writes into),
+ * and appending a whole rope (a child block's code) only refers to its chunks.
+ */
+
+typedef struct gcode_rope_s
+{
+  gcode_rope_chunk_t *tail;                                                     // The chunk appends get written into, kept across clears
+  gcode_rope_piece_t *piece;
+  uint32_t piece_number;
+  uint32_t piece_alloc;
+  size_t len;                                                                   // Total bytes of all the pieces
+} gcode_rope_t;
+
+void gcode_rope_init (gcode_rope_t *rope);
+void gcode_rope_clear (gcode_rope_t *rope);
+void gcode_rope_free (gcode_rope_t *rope);
+void gcode_rope_append (gcode_rope_t *rope, const char *string, size_t len);
+void gcode_rope_splice (gcode_rope_t *rope, gcode_rope_t *source);
+char gcode_rope_last (gcode_rope_t *rope);
+
+#endif
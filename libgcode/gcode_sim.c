@@ -21,12 +21,130 @@
 
 #include "gcode_sim.h"
 #include <string.h>
+#include <unistd.h>
+
+/**
+ * The per-cell test of the stepped stamp: is the center of cell 'xind' (on a row
+ * 'yd' away from the tool) within the disk of radius 'rad' around 'pos'?
+ */
+
+static int
+gcode_sim_disk_test (gcode_t *gcode, gcode_sim_t *sim, int xind, gfloat_t yd, gfloat_t *pos, gfloat_t rad)
+{
+  gfloat_t xd;
+
+  xd = ((gfloat_t)xind * sim->vn_inv[0]) * gcode->material_size[0] - pos[0];
+
+  return ((xd * xd + yd * yd) <= rad * rad);
+}
+
+/**
+ * Find the run of cells along row 'yind' whose centers fall within the disk of
+ * radius 'rad' around 'pos', clamped to [min, max]. The bounds are solved for
+ * analytically, then nudged by the exact per-cell test of the original stamp so
+ * that rounding never makes the two disagree; returns zero if the run is empty.
+ */
+
+static int
+gcode_sim_disk_row (gcode_t *gcode, gcode_sim_t *sim, int yind, gfloat_t *pos, gfloat_t rad, int *min, int *max)
+{
+  int lo, hi;
+  gfloat_t yt, yd, k;
+
+  yt = ((gfloat_t)yind * sim->vn_inv[1]) * gcode->material_size[1];
+  yd = yt - pos[1];
+
+  if (yd * yd > rad * rad)
+    return (0);
+
+  k = sqrt (rad * rad - yd * yd);
+
+  lo = (int)ceil ((gfloat_t)gcode->voxel_number[0] * (pos[0] - k) / gcode->material_size[0]);
+  hi = (int)floor ((gfloat_t)gcode->voxel_number[0] * (pos[0] + k) / gcode->material_size[0]);
+
+  if (lo < *min)
+    lo = *min;
+
+  if (hi > *max)
+    hi = *max;
+
+  while (lo > *min && gcode_sim_disk_test (gcode, sim, lo - 1, yd, pos, rad))
+    lo--;
+
+  while (lo <= hi && !gcode_sim_disk_test (gcode, sim, lo, yd, pos, rad))
+    lo++;
+
+  while (hi < *max && gcode_sim_disk_test (gcode, sim, hi + 1, yd, pos, rad))
+    hi++;
+
+  while (hi >= lo && !gcode_sim_disk_test (gcode, sim, hi, yd, pos, rad))
+    hi--;
+
+  *min = lo;
+  *max = hi;
+
+  return (lo <= hi);
+}
+
+/**
+ * Lower every height map cell under the end mill to the level of its tip;
+ * unlike the voxel map, this assumes an infinitely long flute, which is a
+ * perfectly good approximation for 2.5D jobs and saves the whole Z column.
+ */
+
+static void
+gcode_sim_intersect_height_map (gcode_t *gcode, gcode_sim_t *sim, gfloat_t *pos, gfloat_t rad)
+{
+  int xind, yind, min[2], max[2], span[2];
+  gfloat_t level;
+  uint16_t *row, top;
+
+  level = (gfloat_t)GCODE_HEIGHT_MAP_TOP * (gcode->material_size[2] + pos[2]) / gcode->material_size[2];
+
+  if (level >= (gfloat_t)GCODE_HEIGHT_MAP_TOP)                                  // The tip is above the stock: nothing to cut
+    return;
+
+  top = (level < 0.0) ? 0 : (uint16_t)level;
+
+  min[0] = (int)((gfloat_t)gcode->voxel_number[0]) * (pos[0] - rad) / gcode->material_size[0];
+  min[1] = (int)((gfloat_t)gcode->voxel_number[1]) * (pos[1] - rad) / gcode->material_size[1];
+
+  max[0] = (int)((gfloat_t)gcode->voxel_number[0]) * (pos[0] + rad) / gcode->material_size[0];
+  max[1] = (int)((gfloat_t)gcode->voxel_number[1]) * (pos[1] + rad) / gcode->material_size[1];
+
+  if (min[0] < sim->clip_min[0])
+    min[0] = sim->clip_min[0];
+
+  if (min[1] < sim->clip_min[1])
+    min[1] = sim->clip_min[1];
+
+  if (max[0] > sim->clip_max[0])
+    max[0] = sim->clip_max[0];
+
+  if (max[1] > sim->clip_max[1])
+    max[1] = sim->clip_max[1];
+
+  for (yind = min[1]; yind <= max[1]; yind++)
+  {
+    span[0] = min[0];
+    span[1] = max[0];
+
+    if (!gcode_sim_disk_row (gcode, sim, yind, pos, rad, &span[0], &span[1]))
+      continue;
+
+    /* Branch free over the whole run so that the compiler can vectorize it */
+    row = &gcode->height_map[yind * gcode->voxel_number[0]];
+
+    for (xind = span[0]; xind <= span[1]; xind++)
+      row[xind] = row[xind] < top ? row[xind] : top;
+  }
+}
 
 static void
 gcode_sim_intersect (gcode_t *gcode, gcode_sim_t *sim)
 {
-  int xind, yind, zind, min[3], max[3];
-  gfloat_t pos[3], xt, yt, xd, yd, rad;
+  int yind, min[3], max[3], span[2];
+  gfloat_t pos[3], rad;
 
   rad = 0.5 * sim->tool_diameter + 100.0 * GCODE_PRECISION;
 
@@ -37,6 +155,12 @@ gcode_sim_intersect (gcode_t *gcode, gcode_sim_t *sim)
   pos[1] = sim->pos[1] + sim->origin[1];
   pos[2] = sim->pos[2] - sim->origin[2];
 
+  if (gcode->stock_model == GCODE_STOCK_HEIGHT_MAP)
+  {
+    gcode_sim_intersect_height_map (gcode, sim, pos, rad);
+    return;
+  }
+
   /* Take into account the origin of the cutter relative to the position of the cutter */
   min[0] = (int)((gfloat_t)gcode->voxel_number[0]) * (pos[0] - rad) / gcode->material_size[0];
   min[1] = (int)((gfloat_t)gcode->voxel_number[1]) * (pos[1] - rad) / gcode->material_size[1];
@@ -48,183 +172,457 @@ gcode_sim_intersect (gcode_t *gcode, gcode_sim_t *sim)
   /* Because tool cutting length isn't used yet, use 10x the tool radius */
   max[2] = (int)((gfloat_t)gcode->voxel_number[2]) * (gcode->material_size[2] + pos[2] + (10.0 * rad)) / gcode->material_size[2];
 
-  if (min[0] < 0)
-    min[0] = 0;
+  /* Only carve within the clipping box (the whole map, or the tile of a worker thread) */
+  if (min[0] < sim->clip_min[0])
+    min[0] = sim->clip_min[0];
 
-  if (min[1] < 0)
-    min[1] = 0;
+  if (min[1] < sim->clip_min[1])
+    min[1] = sim->clip_min[1];
 
   if (min[2] < 0)
     min[2] = 0;
 
-  if (max[0] < 0)
-    max[0] = min[0] - 1;
+  if (max[0] > sim->clip_max[0])
+    max[0] = sim->clip_max[0];
 
-  if (max[1] < 0)
-    max[1] = min[1] - 1;
+  if (max[1] > sim->clip_max[1])
+    max[1] = sim->clip_max[1];
 
   if (max[2] < 0)
     max[2] = min[2] - 1;
 
-  if (max[0] >= gcode->voxel_number[0])
-    max[0] = gcode->voxel_number[0] - 1;
+  if (max[2] >= (int)gcode->voxel_number[2])
+    max[2] = gcode->voxel_number[2] - 1;
+
+  if (min[2] >= (int)gcode->voxel_number[2])
+    min[2] = max[2] + 1;
 
-  if (max[1] >= gcode->voxel_number[1])
-    max[1] = gcode->voxel_number[1] - 1;
+  if (min[2] > max[2])
+    return;
 
-  if (max[2] >= gcode->voxel_number[2])
-    max[2] = gcode->voxel_number[2] - 1;
+  /**
+   * Each row of the disk is a single run of cells, cleared in one go from 'min[2]'
+   * to 'max[2]' (with memset, whose wide stores beat a per-voxel strided loop).
+   */
+  for (yind = min[1]; yind <= max[1]; yind++)
+  {
+    span[0] = min[0];
+    span[1] = max[0];
 
-  if (min[0] >= gcode->voxel_number[0])
-    min[0] = max[0] + 1;
+    if (!gcode_sim_disk_row (gcode, sim, yind, pos, rad, &span[0], &span[1]))
+      continue;
 
-  if (min[1] >= gcode->voxel_number[1])
-    min[1] = max[1] + 1;
+    gcode_voxel_clear (&gcode->voxel_map, span[0], span[1], yind, min[2], max[2]);
+  }
+}
 
-  if (min[2] >= gcode->voxel_number[2])
-    min[2] = max[2] + 1;
+/**
+ * Remove the material of a single XY cell from the tip of the end mill upwards;
+ * 'z' is the lowest tip level the cell ever sees during the swept motion, so a
+ * cell is carved exactly once per motion segment regardless of its length.
+ */
 
-  for (yind = min[1]; yind <= max[1]; yind++)
+static void
+gcode_sim_carve_cell (gcode_t *gcode, int xind, int yind, gfloat_t z, gfloat_t rad)
+{
+  int min, max;
+  gfloat_t level;
+  uint16_t *cell;
+
+  if (gcode->stock_model == GCODE_STOCK_HEIGHT_MAP)
+  {
+    level = (gfloat_t)GCODE_HEIGHT_MAP_TOP * (gcode->material_size[2] + z) / gcode->material_size[2];
+
+    if (level >= (gfloat_t)GCODE_HEIGHT_MAP_TOP)
+      return;
+
+    cell = &gcode->height_map[yind * gcode->voxel_number[0] + xind];
+
+    if (level < 0.0)
+      *cell = 0;
+    else if (*cell > (uint16_t)level)
+      *cell = (uint16_t)level;
+
+    return;
+  }
+
+  min = (int)((gfloat_t)gcode->voxel_number[2] * (gcode->material_size[2] + z) / gcode->material_size[2]);
+  max = (int)((gfloat_t)gcode->voxel_number[2] * (gcode->material_size[2] + z + (10.0 * rad)) / gcode->material_size[2]);
+
+  if (min < 0)
+    min = 0;
+
+  if (max >= (int)gcode->voxel_number[2])
+    max = gcode->voxel_number[2] - 1;
+
+  gcode_voxel_clear (&gcode->voxel_map, xind, xind, yind, min, max);
+}
+
+/**
+ * Convert an X interval (in stock coordinates) to the range of cell indices it
+ * covers along X; returns zero if the clamped range turns out to be empty.
+ */
+
+static int
+gcode_sim_cell_span (gcode_t *gcode, gcode_sim_t *sim, gfloat_t x0, gfloat_t x1, int *min, int *max)
+{
+  *min = (int)floor ((gfloat_t)gcode->voxel_number[0] * x0 / gcode->material_size[0]);
+  *max = (int)floor ((gfloat_t)gcode->voxel_number[0] * x1 / gcode->material_size[0]) + 1;
+
+  if (*min < sim->clip_min[0])
+    *min = sim->clip_min[0];
+
+  if (*max > sim->clip_max[0])
+    *max = sim->clip_max[0];
+
+  return (*min <= *max);
+}
+
+/**
+ * Rasterize the capsule swept by a flat end mill of radius 'rad' moving along a
+ * straight line from 'p0' to 'p1' (stock coordinates). Every cell the capsule
+ * covers is visited once; the tip level it gets carved to is the minimum of the
+ * (linear) Z over the parameter interval during which the cell is under the mill.
+ */
+
+static void
+gcode_sim_sweep_line (gcode_t *gcode, gcode_sim_t *sim, gcode_vec3d_t p0, gcode_vec3d_t p1, gfloat_t rad)
+{
+  int xind, yind, ymin, ymax, xmin, xmax;
+  gfloat_t vx, vy, vv, vlen, xt, yt, wx, wy, b, c, disc, t0, t1, z;
+  gfloat_t span[2], lo, hi, a0, a1, k;
+
+  vx = p1[0] - p0[0];
+  vy = p1[1] - p0[1];
+  vv = vx * vx + vy * vy;
+  vlen = sqrt (vv);
+
+  ymin = (int)floor ((gfloat_t)gcode->voxel_number[1] * (fmin (p0[1], p1[1]) - rad) / gcode->material_size[1]);
+  ymax = (int)floor ((gfloat_t)gcode->voxel_number[1] * (fmax (p0[1], p1[1]) + rad) / gcode->material_size[1]) + 1;
+
+  if (ymin < sim->clip_min[1])
+    ymin = sim->clip_min[1];
+
+  if (ymax > sim->clip_max[1])
+    ymax = sim->clip_max[1];
+
+  for (yind = ymin; yind <= ymax; yind++)
   {
     yt = ((gfloat_t)yind * sim->vn_inv[1]) * gcode->material_size[1];
-    yd = yt - pos[1];
 
-    for (xind = min[0]; xind <= max[0]; xind++)
+    /**
+     * The capsule is convex, so its intersection with this row is a single
+     * interval: the union of the spans of the two end disks and the strip.
+     */
+
+    span[0] = FLT_MAX;
+    span[1] = -FLT_MAX;
+
+    if (fabs (yt - p0[1]) <= rad)
+    {
+      k = sqrt (rad * rad - (yt - p0[1]) * (yt - p0[1]));
+      span[0] = fmin (span[0], p0[0] - k);
+      span[1] = fmax (span[1], p0[0] + k);
+    }
+
+    if (fabs (yt - p1[1]) <= rad)
+    {
+      k = sqrt (rad * rad - (yt - p1[1]) * (yt - p1[1]));
+      span[0] = fmin (span[0], p1[0] - k);
+      span[1] = fmax (span[1], p1[0] + k);
+    }
+
+    if (vlen > GCODE_PRECISION)
+    {
+      lo = -FLT_MAX;
+      hi = FLT_MAX;
+
+      /* Perpendicular distance within 'rad': |vx * (yt - y0) - vy * (x - x0)| <= rad * vlen */
+      if (fabs (vy) > GCODE_PRECISION)
+      {
+        a0 = p0[0] + (vx * (yt - p0[1]) - rad * vlen) / vy;
+        a1 = p0[0] + (vx * (yt - p0[1]) + rad * vlen) / vy;
+        lo = fmax (lo, fmin (a0, a1));
+        hi = fmin (hi, fmax (a0, a1));
+      }
+      else if (fabs (yt - p0[1]) > rad)
+      {
+        hi = lo;
+      }
+
+      /* Projection within the segment: 0 <= vx * (x - x0) + vy * (yt - y0) <= vv */
+      if (fabs (vx) > GCODE_PRECISION)
+      {
+        a0 = p0[0] - vy * (yt - p0[1]) / vx;
+        a1 = p0[0] + (vv - vy * (yt - p0[1])) / vx;
+        lo = fmax (lo, fmin (a0, a1));
+        hi = fmin (hi, fmax (a0, a1));
+      }
+      else if (vy * (yt - p0[1]) < 0.0 || vy * (yt - p0[1]) > vv)
+      {
+        hi = lo;
+      }
+
+      if (lo < hi)
+      {
+        span[0] = fmin (span[0], lo);
+        span[1] = fmax (span[1], hi);
+      }
+    }
+
+    if (span[0] > span[1])
+      continue;
+
+    if (!gcode_sim_cell_span (gcode, sim, span[0], span[1], &xmin, &xmax))
+      continue;
+
+    wy = yt - p0[1];
+
+    for (xind = xmin; xind <= xmax; xind++)
     {
       xt = ((gfloat_t)xind * sim->vn_inv[0]) * gcode->material_size[0];
-      xd = xt - pos[0];
+      wx = xt - p0[0];
+
+      c = wx * wx + wy * wy - rad * rad;
+
+      if (vv < GCODE_PRECISION * GCODE_PRECISION)                               // Plunge or retract: a single disk
+      {
+        if (c <= 0.0)
+          gcode_sim_carve_cell (gcode, xind, yind, fmin (p0[2], p1[2]), rad);
+
+        continue;
+      }
+
+      /* Solve |w - t * v|^2 <= rad^2 for t, then clip to the segment */
+      b = wx * vx + wy * vy;
+      disc = b * b - vv * c;
 
-      if ((xd * xd + yd * yd) <= rad * rad)
-        for (zind = min[2]; zind <= max[2]; zind++)
-          gcode->voxel_map[(zind * gcode->voxel_number[1] + yind) * gcode->voxel_number[0] + xind] = 0;
+      if (disc < 0.0)
+        continue;
+
+      disc = sqrt (disc);
+      t0 = (b - disc) / vv;
+      t1 = (b + disc) / vv;
+
+      if (t0 < 0.0)
+        t0 = 0.0;
+
+      if (t1 > 1.0)
+        t1 = 1.0;
+
+      if (t0 > t1)
+        continue;
+
+      z = fmin (p0[2] + t0 * (p1[2] - p0[2]), p0[2] + t1 * (p1[2] - p0[2]));
+
+      gcode_sim_carve_cell (gcode, xind, yind, z, rad);
     }
   }
 }
 
+/**
+ * Rasterize the annulus sector swept by a flat end mill of radius 'rad' moving
+ * along a (possibly helical) arc of radius 'arad' around 'center', starting at
+ * angle 'start' and sweeping 'sweep' radians (negative for clockwise) while its
+ * tip goes linearly from 'z0' to 'z1'. Each cell is visited once; the angular
+ * range during which it is under the mill is found in closed form.
+ */
+
 static void
-gcode_sim_parse_args (gcode_sim_t *sim, char *args, gcode_vec3d_t xyz, gcode_vec3d_t ijk, gfloat_t *rad)
+gcode_sim_sweep_arc (gcode_t *gcode, gcode_sim_t *sim, gcode_vec2d_t center, gfloat_t arad, gfloat_t start, gfloat_t sweep, gfloat_t z0, gfloat_t z1, gfloat_t rad)
 {
-  uint8_t sind, len;
-  char string[256];
+  int xind, yind, ymin, ymax, xmin, xmax, piece, pieces;
+  gfloat_t length, sign, xt, yt, dx, dy, d, k, alpha, c0, s0, s1, z, outer, inner;
+  gfloat_t span[2][2];
 
-  GCODE_MATH_VEC3D_SET (ijk, 0.0, 0.0, 0.0);
-  *rad = 0.0;
+  sign = (sweep < 0.0) ? -1.0 : 1.0;
+  length = fabs (sweep);
 
-  if (sim->absolute == 1)
-  {
-    GCODE_MATH_VEC3D_COPY (xyz, sim->pos);
-  }
-  else
-  {
-    GCODE_MATH_VEC3D_SET (xyz, 0.0, 0.0, 0.0);
-  }
+  if (length < GCODE_PRECISION)
+    return;
 
-  /**
-   * Extract arguments
-   * Scan for 'X', 'Y', and 'Z'
-   */
-  sind = 0;
+  ymin = (int)floor ((gfloat_t)gcode->voxel_number[1] * (center[1] - arad - rad) / gcode->material_size[1]);
+  ymax = (int)floor ((gfloat_t)gcode->voxel_number[1] * (center[1] + arad + rad) / gcode->material_size[1]) + 1;
+
+  if (ymin < sim->clip_min[1])
+    ymin = sim->clip_min[1];
 
-  while (args[sind])
+  if (ymax > sim->clip_max[1])
+    ymax = sim->clip_max[1];
+
+  for (yind = ymin; yind <= ymax; yind++)
   {
-    sind++;
+    yt = ((gfloat_t)yind * sim->vn_inv[1]) * gcode->material_size[1];
+    dy = yt - center[1];
 
-    len = strspn (&args[sind], "-.0123456789");
-    memset (string, 0, 256);
-    memcpy (string, &args[sind], len);
+    if (fabs (dy) > arad + rad)
+      continue;
 
-    switch (args[sind - 1])
+    /* The row crosses the outer circle of the annulus, and maybe the inner one */
+    outer = sqrt ((arad + rad) * (arad + rad) - dy * dy);
+
+    if (arad - rad > fabs (dy))
     {
-      case 'F':
-      case 'f':
-        sim->feed = atof (string);
-        break;
+      inner = sqrt ((arad - rad) * (arad - rad) - dy * dy);
+      span[0][0] = center[0] - outer;
+      span[0][1] = center[0] - inner;
+      span[1][0] = center[0] + inner;
+      span[1][1] = center[0] + outer;
+      pieces = 2;
+    }
+    else
+    {
+      span[0][0] = center[0] - outer;
+      span[0][1] = center[0] + outer;
+      pieces = 1;
+    }
 
-      case 'I':
-      case 'i':
-        ijk[0] = atof (string);
-        break;
+    for (piece = 0; piece < pieces; piece++)
+    {
+      if (!gcode_sim_cell_span (gcode, sim, span[piece][0], span[piece][1], &xmin, &xmax))
+        continue;
 
-      case 'J':
-      case 'j':
-        ijk[1] = atof (string);
-        break;
+      for (xind = xmin; xind <= xmax; xind++)
+      {
+        xt = ((gfloat_t)xind * sim->vn_inv[0]) * gcode->material_size[0];
+        dx = xt - center[0];
+        d = sqrt (dx * dx + dy * dy);
 
-      case 'K':
-      case 'k':
-        ijk[2] = atof (string);
-        break;
+        /* The cell is under the mill while cos (angle - phi) >= k */
+        if (d < GCODE_PRECISION)
+          k = (arad <= rad) ? -1.0 : 2.0;
+        else
+          k = (d * d + arad * arad - rad * rad) / (2.0 * d * arad);
 
-      case 'R':
-      case 'r':
-        *rad = atof (string);
-        break;
+        if (k > 1.0)
+          continue;
 
-      case 'X':
-      case 'x':
-        xyz[0] = atof (string);
-        break;
+        if (k <= -1.0)
+        {
+          gcode_sim_carve_cell (gcode, xind, yind, fmin (z0, z1), rad);
+          continue;
+        }
 
-      case 'Y':
-      case 'y':
-        xyz[1] = atof (string);
-        break;
+        alpha = acos (k);
 
-      case 'Z':
-      case 'z':
-        xyz[2] = atof (string);
-        break;
+        /* Offset (along the sweep) of the first angle at which the cell gets covered */
+        c0 = fmod (sign * (atan2 (dy, dx) - start) - alpha, GCODE_2PI);
 
-      default:
-        break;
-    }
+        if (c0 < 0.0)
+          c0 += GCODE_2PI;
+
+        z = FLT_MAX;
+
+        /* The covered window is [c0, c0 + 2 alpha], possibly wrapping around past 2 pi */
+        s0 = c0;
+        s1 = fmin (c0 + 2.0 * alpha, length);
+
+        if (s0 <= s1)
+          z = fmin (z, fmin (z0 + (z1 - z0) * s0 / length, z0 + (z1 - z0) * s1 / length));
+
+        s0 = 0.0;
+        s1 = fmin (c0 + 2.0 * alpha - GCODE_2PI, length);
 
-    sind += len;
+        if (s0 <= s1)
+          z = fmin (z, fmin (z0, z0 + (z1 - z0) * s1 / length));
+
+        if (z < FLT_MAX)
+          gcode_sim_carve_cell (gcode, xind, yind, z, rad);
+      }
+    }
   }
 }
 
-void
-gcode_sim_init (gcode_sim_t *sim, gcode_t *gcode)
+/**
+ * Swept (analytic) counterparts of the stepped motion simulation: convert the
+ * motion to stock coordinates, rasterize it once and account for its length.
+ * The stepped ones below stamp the end mill every 'step_res' along the move.
+ */
+
+static void
+gcode_sim_swept_line (gcode_t *gcode, gcode_sim_t *sim, gcode_vec3d_t xyz)
 {
-  sim->absolute = 1;
+  gcode_vec3d_t p0, p1;
+  gfloat_t dist;
 
-  sim->feed = 10;
-  sim->tool_diameter = 1.0;
+  GCODE_MATH_VEC3D_DIST (dist, xyz, sim->pos);
 
-  if (gcode->units == GCODE_UNITS_MILLIMETER)
-    sim->feed *= GCODE_INCH2MM;
+  if (dist < GCODE_PRECISION)
+    return;
 
-  sim->time_elapsed = 0.0;
+  p0[0] = sim->pos[0] + sim->origin[0];
+  p0[1] = sim->pos[1] + sim->origin[1];
+  p0[2] = sim->pos[2] - sim->origin[2];
 
-  sim->step_res = 1.0 / (gfloat_t)gcode->voxel_resolution;                      /* Default to 1/voxel_res inch stepping */
+  p1[0] = xyz[0] + sim->origin[0];
+  p1[1] = xyz[1] + sim->origin[1];
+  p1[2] = xyz[2] - sim->origin[2];
 
-  if (gcode->units == GCODE_UNITS_MILLIMETER)
-    sim->step_res *= GCODE_INCH2MM;
+  gcode_sim_sweep_line (gcode, sim, p0, p1, 0.5 * sim->tool_diameter + 100.0 * GCODE_PRECISION);
 
-  /**
-   * Position (0,0,0) refers to the left, back, top most corner.
-   * This allows us to treat the work piece as though it's in
-   * Quadrant-I of a 2d cartesian map.
-   */
-  GCODE_MATH_VEC3D_SET (sim->pos, 0.0, 0.0, GCODE_PRECISION);
+  sim->time_elapsed += dist;
+
+  GCODE_MATH_VEC3D_COPY (sim->pos, xyz);
 }
 
-void
-gcode_sim_free (gcode_sim_t *sim)
+static void
+gcode_sim_swept_arc (gcode_t *gcode, gcode_sim_t *sim, gcode_vec3d_t xyz, gcode_vec3d_t ijk, int clockwise)
 {
+  gcode_vec2d_t center;
+  gfloat_t arad, start, end, sweep;
+
+  arad = sqrt (ijk[0] * ijk[0] + ijk[1] * ijk[1]);
+
+  if (arad < GCODE_PRECISION)
+    return;
+
+  start = atan2 (-ijk[1], -ijk[0]);
+  end = atan2 (xyz[1] - sim->pos[1] - ijk[1], xyz[0] - sim->pos[0] - ijk[0]);
+
+  /* Equal start and end angles mean a complete circle, just like the stepped version */
+  if (clockwise)
+  {
+    sweep = fmod (start - end, GCODE_2PI);
+
+    if (sweep < 0.0)
+      sweep += GCODE_2PI;
+
+    if (sweep < GCODE_PRECISION)
+      sweep += GCODE_2PI;
+
+    sweep = -sweep;
+  }
+  else
+  {
+    sweep = fmod (end - start, GCODE_2PI);
+
+    if (sweep < 0.0)
+      sweep += GCODE_2PI;
+
+    if (sweep < GCODE_PRECISION)
+      sweep += GCODE_2PI;
+  }
+
+  center[0] = sim->pos[0] + ijk[0] + sim->origin[0];
+  center[1] = sim->pos[1] + ijk[1] + sim->origin[1];
+
+  gcode_sim_sweep_arc (gcode, sim, center, arad, start, sweep, sim->pos[2] - sim->origin[2], xyz[2] - sim->origin[2],
+                       0.5 * sim->tool_diameter + 100.0 * GCODE_PRECISION);
+
+  sim->time_elapsed += sqrt (arad * sweep * arad * sweep + (xyz[2] - sim->pos[2]) * (xyz[2] - sim->pos[2]));
+
+  GCODE_MATH_VEC3D_COPY (sim->pos, xyz);
 }
 
-void
-gcode_sim_G00 (gcode_t *gcode, gcode_sim_t *sim, char *args)
-{
-  gcode_vec3d_t xyz, ijk, dvec, orig;
-  gfloat_t cur_dist, tot_dist, mag, rad;
+/**
+ * Stepped linear motion: stamp the end mill every 'step_res' along the move
+ */
 
-  /**
-   * Rapid Move
-   * Move from the current position to the one derived from args.
-   */
-  gcode_sim_parse_args (sim, args, xyz, ijk, &rad);
+static void
+gcode_sim_stepped_line (gcode_t *gcode, gcode_sim_t *sim, gcode_vec3d_t xyz)
+{
+  gcode_vec3d_t dvec, orig;
+  gfloat_t cur_dist, tot_dist, mag;
 
   GCODE_MATH_VEC3D_COPY (orig, sim->pos);
   GCODE_MATH_VEC3D_DIST (tot_dist, xyz, orig);
@@ -251,12 +649,6 @@ gcode_sim_G00 (gcode_t *gcode, gcode_sim_t *sim, char *args)
     /* Clamp the position once it gets close to its destination */
     if (cur_dist > tot_dist)
     {
-      gcode_vec3d_t tvec;
-      gfloat_t tmag;
-
-      GCODE_MATH_VEC3D_SUB (tvec, sim->pos, xyz);
-      GCODE_MATH_VEC3D_MAG (tmag, tvec);
-
       GCODE_MATH_VEC3D_COPY (sim->pos, xyz);
     }
 
@@ -265,53 +657,41 @@ gcode_sim_G00 (gcode_t *gcode, gcode_sim_t *sim, char *args)
   } while (cur_dist < tot_dist);
 }
 
-void
-gcode_sim_G01 (gcode_t *gcode, gcode_sim_t *sim, char *args)
-{
-  gcode_sim_G00 (gcode, sim, args);
-}
+/**
+ * Stepped arc motion: stamp the end mill every 'step_res' of arc length
+ */
 
-void
-gcode_sim_G02 (gcode_t *gcode, gcode_sim_t *sim, char *args)
+static void
+gcode_sim_stepped_arc (gcode_t *gcode, gcode_sim_t *sim, gcode_vec3d_t xyz, gcode_vec3d_t ijk, int clockwise)
 {
-  gcode_vec3d_t xyz, ijk, tvec, orig;
+  gcode_vec3d_t tvec, orig;
   gfloat_t rad, step_angle, src_angle, dst_angle;
 
+  /* Calculate the origin */
+  GCODE_MATH_VEC3D_ADD (orig, sim->pos, ijk);
+
   /**
-   * Clockwise Arc
-   * Move clockwise until reaching the arc length specificed
-   * by xyz.
+   * Radius is determined by the magnitude of ijk.
    */
-  gcode_sim_parse_args (sim, args, xyz, ijk, &rad);
-
-  if (rad > GCODE_PRECISION)                                                    /* XYZ Radius format */
-  {
-    /* Not implemented yet. */
-  }
-  else if (fabs (ijk[0]) > GCODE_PRECISION || fabs (ijk[1]) > GCODE_PRECISION || fabs (ijk[2]) > GCODE_PRECISION)       /* IJK format */
-  {
-    /* Calculate the origin */
-    GCODE_MATH_VEC3D_ADD (orig, sim->pos, ijk);
+  GCODE_MATH_VEC3D_MAG (rad, ijk);
 
-    /**
-     * Radius is determined by the magnitude of ijk.
-     */
-    GCODE_MATH_VEC3D_MAG (rad, ijk);
+  step_angle = sim->step_res / rad;
 
-    step_angle = sim->step_res / rad;
+  GCODE_MATH_VEC3D_SUB (tvec, sim->pos, orig);
+  GCODE_MATH_VEC3D_UNITIZE (tvec);
+  GCODE_MATH_VEC3D_ANGLE (src_angle, tvec[0], tvec[1]);
 
-    GCODE_MATH_VEC3D_SUB (tvec, sim->pos, orig);
-    GCODE_MATH_VEC3D_UNITIZE (tvec);
-    GCODE_MATH_VEC3D_ANGLE (src_angle, tvec[0], tvec[1]);
+  GCODE_MATH_VEC3D_SUB (tvec, xyz, orig);
+  GCODE_MATH_VEC3D_UNITIZE (tvec);
+  GCODE_MATH_VEC3D_ANGLE (dst_angle, tvec[0], tvec[1]);
 
-    GCODE_MATH_VEC3D_SUB (tvec, xyz, orig);
-    GCODE_MATH_VEC3D_UNITIZE (tvec);
-    GCODE_MATH_VEC3D_ANGLE (dst_angle, tvec[0], tvec[1]);
-    /**
-     * Add 2Pi to dst_angle for 2 reasons:
-     * - Solves the problem of having dst_angle equal to src_angle for a complete circle.
-     * - Solves the problem of going from 270 degrees clockwise to 90 degrees.
-     */
+  /**
+   * Add 2Pi to src_angle (clockwise) or dst_angle (counter-clockwise) for 2 reasons:
+   * - Solves the problem of having dst_angle equal to src_angle for a complete circle.
+   * - Solves the problem of going from 270 degrees clockwise to 90 degrees.
+   */
+  if (clockwise)
+  {
     if (src_angle - GCODE_PRECISION <= dst_angle)
       src_angle += GCODE_2PI;
 
@@ -326,54 +706,11 @@ gcode_sim_G02 (gcode_t *gcode, gcode_sim_t *sim, char *args)
 
       src_angle -= step_angle;
     }
-    GCODE_MATH_VEC3D_COPY (sim->pos, xyz);
   }
-}
-
-void
-gcode_sim_G03 (gcode_t *gcode, gcode_sim_t *sim, char *args)
-{
-  gcode_vec3d_t xyz, ijk, tvec, orig;
-  gfloat_t rad, step_angle, src_angle, dst_angle;
-
-  /**
-   * Clockwise Arc
-   * Move clockwise until reaching the arc length specificed
-   * by xyz.
-   */
-  gcode_sim_parse_args (sim, args, xyz, ijk, &rad);
-
-  if (rad > GCODE_PRECISION)                                                    /* XYZ Radius format */
-  {
-    /* Not implemented yet. */
-  }
-  else if (fabs (ijk[0]) > GCODE_PRECISION || fabs (ijk[1]) > GCODE_PRECISION || fabs (ijk[2]) > GCODE_PRECISION)       /* IJK format */
+  else
   {
-    /* Calculate the origin */
-    GCODE_MATH_VEC3D_ADD (orig, sim->pos, ijk);
-
-    /**
-     * Radius is determined by the magnitude of ijk.
-     */
-    GCODE_MATH_VEC3D_MAG (rad, ijk);
-
-    step_angle = sim->step_res / rad;
-
-    GCODE_MATH_VEC3D_SUB (tvec, sim->pos, orig);
-    GCODE_MATH_VEC3D_UNITIZE (tvec);
-    GCODE_MATH_VEC3D_ANGLE (src_angle, tvec[0], tvec[1]);
-
-    GCODE_MATH_VEC3D_SUB (tvec, xyz, orig);
-    GCODE_MATH_VEC3D_UNITIZE (tvec);
-    GCODE_MATH_VEC3D_ANGLE (dst_angle, tvec[0], tvec[1]);
-
-    /**
-     * Add 2Pi to dst_angle for 2 reasons:
-     * - Solves the problem of having dst_angle equal to src_angle for a complete circle.
-     * - Solves the problem of going from 270 degrees clockwise to 90 degrees.
-     */
-    if (src_angle + GCODE_PRECISION >= dst_angle)
-      dst_angle += GCODE_2PI;
+    if (src_angle + GCODE_PRECISION >= dst_angle)
+      dst_angle += GCODE_2PI;
 
     /* Go from src_angle to dst_angle by step_angle increments */
     while (src_angle + step_angle < dst_angle)
@@ -386,64 +723,736 @@ gcode_sim_G03 (gcode_t *gcode, gcode_sim_t *sim, char *args)
 
       src_angle += step_angle;
     }
-    GCODE_MATH_VEC3D_COPY (sim->pos, xyz);
   }
+
+  GCODE_MATH_VEC3D_COPY (sim->pos, xyz);
+}
+
+/**
+ * Remember a motion segment (starting at the current position) so that it can
+ * be carved later by 'gcode_sim_flush', along with the (inclusive) range of XY
+ * cells it can possibly touch, so worker threads can skip it quickly.
+ */
+
+static void
+gcode_sim_record (gcode_t *gcode, gcode_sim_t *sim, uint8_t type, gcode_vec3d_t xyz, gcode_vec3d_t ijk)
+{
+  gcode_sim_segment_t *segment;
+  gfloat_t rad, arad, min[2], max[2];
+  int i;
+
+  if (sim->segment_number == sim->segment_alloc)
+  {
+    sim->segment_alloc = sim->segment_alloc ? 2 * sim->segment_alloc : 1024;
+    sim->segment_list = realloc (sim->segment_list, sim->segment_alloc * sizeof (gcode_sim_segment_t));
+  }
+
+  segment = &sim->segment_list[sim->segment_number++];
+
+  segment->type = type;
+  segment->tool_diameter = sim->tool_diameter;
+
+  GCODE_MATH_VEC3D_COPY (segment->origin, sim->origin);
+  GCODE_MATH_VEC3D_COPY (segment->pos, sim->pos);
+  GCODE_MATH_VEC3D_COPY (segment->xyz, xyz);
+  GCODE_MATH_VEC3D_SET (segment->ijk, 0.0, 0.0, 0.0);
+
+  rad = 0.5 * sim->tool_diameter + 100.0 * GCODE_PRECISION;
+
+  if (type == GCODE_SIM_SEGMENT_LINE)
+  {
+    for (i = 0; i < 2; i++)
+    {
+      min[i] = fmin (sim->pos[i], xyz[i]) + sim->origin[i] - rad;
+      max[i] = fmax (sim->pos[i], xyz[i]) + sim->origin[i] + rad;
+    }
+  }
+  else
+  {
+    GCODE_MATH_VEC3D_COPY (segment->ijk, ijk);
+    GCODE_MATH_VEC3D_MAG (arad, ijk);
+
+    for (i = 0; i < 2; i++)
+    {
+      min[i] = sim->pos[i] + ijk[i] + sim->origin[i] - arad - rad;
+      max[i] = sim->pos[i] + ijk[i] + sim->origin[i] + arad + rad;
+    }
+  }
+
+  for (i = 0; i < 2; i++)
+  {
+    segment->min[i] = (int)floor ((gfloat_t)gcode->voxel_number[i] * min[i] / gcode->material_size[i]) - 1;
+    segment->max[i] = (int)floor ((gfloat_t)gcode->voxel_number[i] * max[i] / gcode->material_size[i]) + 1;
+  }
+}
+
+/**
+ * Common entry points of all linear and arc motions, whichever way they get simulated
+ */
+
+static void
+gcode_sim_line (gcode_t *gcode, gcode_sim_t *sim, gcode_vec3d_t xyz)
+{
+  if (sim->record)
+    gcode_sim_record (gcode, sim, GCODE_SIM_SEGMENT_LINE, xyz, NULL);
+
+  if (sim->mode == GCODE_SIM_SWEPT)
+    gcode_sim_swept_line (gcode, sim, xyz);
+  else
+    gcode_sim_stepped_line (gcode, sim, xyz);
+}
+
+static void
+gcode_sim_arc (gcode_t *gcode, gcode_sim_t *sim, gcode_vec3d_t xyz, gcode_vec3d_t ijk, int clockwise)
+{
+  if (sim->record)
+    gcode_sim_record (gcode, sim, clockwise ? GCODE_SIM_SEGMENT_ARC_CW : GCODE_SIM_SEGMENT_ARC_CCW, xyz, ijk);
+
+  if (sim->mode == GCODE_SIM_SWEPT)
+    gcode_sim_swept_arc (gcode, sim, xyz, ijk, clockwise);
+  else
+    gcode_sim_stepped_arc (gcode, sim, xyz, ijk, clockwise);
+}
+
+/**
+ * Carve a recorded segment again, from the state it was recorded in
+ */
+
+static void
+gcode_sim_replay (gcode_t *gcode, gcode_sim_t *sim, gcode_sim_segment_t *segment)
+{
+  GCODE_MATH_VEC3D_COPY (sim->pos, segment->pos);
+  GCODE_MATH_VEC3D_COPY (sim->origin, segment->origin);
+  sim->tool_diameter = segment->tool_diameter;
+
+  switch (segment->type)
+  {
+    case GCODE_SIM_SEGMENT_LINE:
+
+      if (sim->mode == GCODE_SIM_SWEPT)
+        gcode_sim_swept_line (gcode, sim, segment->xyz);
+      else
+        gcode_sim_stepped_line (gcode, sim, segment->xyz);
+
+      break;
+
+    case GCODE_SIM_SEGMENT_ARC_CW:
+    case GCODE_SIM_SEGMENT_ARC_CCW:
+
+      if (sim->mode == GCODE_SIM_SWEPT)
+        gcode_sim_swept_arc (gcode, sim, segment->xyz, segment->ijk, segment->type == GCODE_SIM_SEGMENT_ARC_CW);
+      else
+        gcode_sim_stepped_arc (gcode, sim, segment->xyz, segment->ijk, segment->type == GCODE_SIM_SEGMENT_ARC_CW);
+
+      break;
+  }
+}
+
+/**
+ * Worker thread of 'gcode_sim_flush': keep taking tiles off the shared counter
+ * and replay every recorded segment overlapping the tile, clipped to the tile.
+ * Tiles are disjoint and carving is idempotent, so no locking is needed on the
+ * map itself; each worker runs on a private copy of the simulator state.
+ */
+
+static void *
+gcode_sim_worker (void *data)
+{
+  gcode_sim_job_t *job;
+  gcode_sim_t sim;
+  gcode_sim_segment_t *segment;
+  int tile, tx, ty;
+  uint32_t i;
+
+  job = (gcode_sim_job_t *)data;
+
+  sim = *job->sim;
+  sim.record = 0;
+
+  for (;;)
+  {
+    pthread_mutex_lock (&job->lock);
+    tile = job->next_tile++;
+    pthread_mutex_unlock (&job->lock);
+
+    if (tile >= job->tiles[0] * job->tiles[1])
+      break;
+
+    if (pthread_equal (pthread_self (), job->caller) && job->gcode->progress_callback)
+      job->gcode->progress_callback (job->gcode->gui, (gfloat_t)tile / (gfloat_t)(job->tiles[0] * job->tiles[1]));
+
+    tx = tile % job->tiles[0];
+    ty = tile / job->tiles[0];
+
+    /* Tile edges fall on brick edges, so that no two tiles share a sparse map brick */
+    sim.clip_min[0] = (tx * job->bricks[0]) / job->tiles[0] * GCODE_VOXEL_BRICK_SIZE;
+    sim.clip_max[0] = ((tx + 1) * job->bricks[0]) / job->tiles[0] * GCODE_VOXEL_BRICK_SIZE - 1;
+    sim.clip_min[1] = (ty * job->bricks[1]) / job->tiles[1] * GCODE_VOXEL_BRICK_SIZE;
+    sim.clip_max[1] = ((ty + 1) * job->bricks[1]) / job->tiles[1] * GCODE_VOXEL_BRICK_SIZE - 1;
+
+    if (sim.clip_max[0] >= (int)job->gcode->voxel_number[0])
+      sim.clip_max[0] = job->gcode->voxel_number[0] - 1;
+
+    if (sim.clip_max[1] >= (int)job->gcode->voxel_number[1])
+      sim.clip_max[1] = job->gcode->voxel_number[1] - 1;
+
+    for (i = 0; i < job->sim->segment_number; i++)
+    {
+      segment = &job->sim->segment_list[i];
+
+      if (segment->max[0] < sim.clip_min[0] || segment->min[0] > sim.clip_max[0] ||
+          segment->max[1] < sim.clip_min[1] || segment->min[1] > sim.clip_max[1])
+        continue;
+
+      gcode_sim_replay (job->gcode, &sim, segment);
+    }
+  }
+
+  return (NULL);
 }
 
 void
-gcode_sim_G83 (gcode_t *gcode, gcode_sim_t *sim, char *args, gfloat_t *G83_depth, gfloat_t *G83_retract, int init)
+gcode_sim_init (gcode_sim_t *sim, gcode_t *gcode)
 {
-  gcode_vec3d_t xyz, ijk, dvec, orig;
-  gfloat_t cur_dist, tot_dist, mag, retract;
+  sim->mode = gcode->sim_mode;
+
+  sim->tool_diameter = 1.0;
+
+  GCODE_MATH_VEC3D_SET (sim->origin, 0.0, 0.0, 0.0);
+
+  sim->time_elapsed = 0.0;
+
+  if (gcode->stock_model == GCODE_STOCK_HEIGHT_MAP)
+    sim->step_res = 1.0 / (gfloat_t)gcode->height_resolution;                   /* Height maps are finer, step accordingly */
+  else
+    sim->step_res = 1.0 / (gfloat_t)gcode->voxel_resolution;                    /* Default to 1/voxel_res inch stepping */
+
+  if (gcode->units == GCODE_UNITS_MILLIMETER)
+    sim->step_res *= GCODE_INCH2MM;
+
+  /**
+   * Position (0,0,0) refers to the left, back, top most corner.
+   * This allows us to treat the work piece as though it's in
+   * Quadrant-I of a 2d cartesian map.
+   */
+  GCODE_MATH_VEC3D_SET (sim->pos, 0.0, 0.0, GCODE_PRECISION);
+
+  /**
+   * With a single thread, motions are carved right away over the whole map;
+   * with several, they are only recorded (and timed) while the code is being
+   * parsed, with an empty clipping box, then carved by 'gcode_sim_flush'.
+   * A final part render always records ('gcode_sim_resume'), one block at a
+   * time, so that it can checkpoint the stock between blocks.
+   */
+
+  sim->threads = gcode->sim_threads;
+
+#ifdef _SC_NPROCESSORS_ONLN
+  if (sim->threads == 0)
+    sim->threads = sysconf (_SC_NPROCESSORS_ONLN);
+#endif
+
+  if (sim->threads < 1)
+    sim->threads = 1;
+
+  if (sim->threads > GCODE_SIM_MAX_THREADS)
+    sim->threads = GCODE_SIM_MAX_THREADS;
+
+  sim->record = (sim->threads > 1);
+
+  sim->segment_list = NULL;
+  sim->segment_number = 0;
+  sim->segment_alloc = 0;
 
-  gcode_sim_parse_args (sim, args, xyz, ijk, &retract);
+  sim->clip_min[0] = 0;
+  sim->clip_min[1] = 0;
 
-  if (init)
+  if (sim->record)
   {
-    *G83_retract = retract;
-    *G83_depth = xyz[2];
+    sim->clip_max[0] = -1;
+    sim->clip_max[1] = -1;
   }
+  else
+  {
+    sim->clip_max[0] = gcode->voxel_number[0] - 1;
+    sim->clip_max[1] = gcode->voxel_number[1] - 1;
+  }
+}
 
-  sim->pos[0] = xyz[0];
-  sim->pos[1] = xyz[1];
-  sim->pos[2] = *G83_retract;
-  xyz[2] = *G83_depth;
+void
+gcode_sim_free (gcode_sim_t *sim)
+{
+  free (sim->segment_list);
 
-  GCODE_MATH_VEC3D_COPY (orig, sim->pos);
-  GCODE_MATH_VEC3D_DIST (tot_dist, xyz, orig);
+  sim->segment_list = NULL;
+  sim->segment_number = 0;
+  sim->segment_alloc = 0;
+}
 
-  /* Build delta vector */
-  GCODE_MATH_VEC3D_SUB (dvec, xyz, orig);
+/**
+ * Carry out a list of motions compiled from G-code
+ */
 
-  /* If the delta vector is zero, no work to do */
-  GCODE_MATH_VEC3D_MAG (mag, dvec);
+void
+gcode_sim_run (gcode_t *gcode, gcode_sim_t *sim, gcode_motion_list_t *list)
+{
+  gcode_motion_t *motion;
+  gcode_vec3d_t xyz, ijk;
+  uint32_t i;
 
-  if (mag < GCODE_PRECISION)
+  for (i = 0; i < list->number; i++)
+  {
+    motion = &list->motion[i];
+
+    sim->tool_diameter = motion->tool_diameter;
+
+    GCODE_MATH_VEC3D_COPY (xyz, motion->xyz);
+    GCODE_MATH_VEC3D_COPY (ijk, motion->ijk);
+
+    switch (motion->type)
+    {
+      case GCODE_MOTION_LINE:
+        gcode_sim_line (gcode, sim, xyz);
+        break;
+
+      case GCODE_MOTION_ARC_CW:
+        gcode_sim_arc (gcode, sim, xyz, ijk, 1);
+        break;
+
+      case GCODE_MOTION_ARC_CCW:
+        gcode_sim_arc (gcode, sim, xyz, ijk, 0);
+        break;
+
+      case GCODE_MOTION_JUMP:
+        GCODE_MATH_VEC3D_COPY (sim->pos, xyz);
+        break;
+
+      case GCODE_MOTION_ORIGIN:
+        GCODE_MATH_VEC3D_COPY (sim->origin, xyz);
+        GCODE_MATH_VEC3D_ADD (sim->pos, sim->pos, xyz);
+        break;
+
+      default:
+        break;
+    }
+  }
+}
+
+/**
+ * Carve all the motion segments recorded so far, splitting the stock into a grid
+ * of XY tiles shared out among 'threads' workers (the calling thread included,
+ * which is the only one reporting progress); a no-op with a single thread.
+ */
+
+void
+gcode_sim_flush (gcode_t *gcode, gcode_sim_t *sim)
+{
+  gcode_sim_job_t job;
+  pthread_t thread[GCODE_SIM_MAX_THREADS];
+  int i, tiles, started;
+
+  if (!sim->record || !sim->segment_number)
     return;
 
-  GCODE_MATH_VEC3D_UNITIZE (dvec);
-  GCODE_MATH_VEC3D_MUL_SCALAR (dvec, dvec, sim->step_res);
-  GCODE_MATH_VEC3D_MAG (mag, dvec);
+  /* A single thread gains nothing from tiles, it only has to replay more */
+  tiles = (sim->threads > 1) ? sim->threads * GCODE_SIM_TILES_PER_THREAD : 1;
 
-  do
+  job.tiles[0] = (int)ceil (sqrt ((gfloat_t)tiles * (gfloat_t)gcode->voxel_number[0] / (gfloat_t)gcode->voxel_number[1]));
+
+  if (job.tiles[0] < 1)
+    job.tiles[0] = 1;
+
+  job.bricks[0] = (gcode->voxel_number[0] + GCODE_VOXEL_BRICK_SIZE - 1) / GCODE_VOXEL_BRICK_SIZE;
+  job.bricks[1] = (gcode->voxel_number[1] + GCODE_VOXEL_BRICK_SIZE - 1) / GCODE_VOXEL_BRICK_SIZE;
+
+  if (job.tiles[0] > job.bricks[0])
+    job.tiles[0] = job.bricks[0];
+
+  job.tiles[1] = (tiles + job.tiles[0] - 1) / job.tiles[0];
+
+  if (job.tiles[1] > job.bricks[1])
+    job.tiles[1] = job.bricks[1];
+
+  job.gcode = gcode;
+  job.sim = sim;
+  job.next_tile = 0;
+  job.caller = pthread_self ();
+
+  pthread_mutex_init (&job.lock, NULL);
+
+  started = 0;
+
+  for (i = 1; i < sim->threads; i++)
   {
-    GCODE_MATH_VEC3D_ADD (sim->pos, sim->pos, dvec);
+    if (pthread_create (&thread[started], NULL, gcode_sim_worker, &job) == 0)
+      started++;
+  }
 
-    GCODE_MATH_VEC3D_DIST (cur_dist, sim->pos, orig);
+  /* The calling thread works too (and reports progress, safely) */
+  gcode_sim_worker (&job);
 
-    /* Clamp the position once it gets close to its destination */
-    if (cur_dist > tot_dist)
+  for (i = 0; i < started; i++)
+    pthread_join (thread[i], NULL);
+
+  pthread_mutex_destroy (&job.lock);
+
+  if (gcode->progress_callback)
+    gcode->progress_callback (gcode->gui, 0.0);
+
+  sim->segment_number = 0;
+}
+
+/**
+ * Append a run to a tile snapshot
+ */
+
+static void
+gcode_sim_tile_push (gcode_sim_tile_t *tile, uint32_t *run_alloc, uint32_t run)
+{
+  if (tile->run_number == *run_alloc)
+  {
+    *run_alloc = *run_alloc ? 2 * *run_alloc : 256;
+    tile->run_list = realloc (tile->run_list, *run_alloc * sizeof (uint32_t));
+  }
+
+  tile->run_list[tile->run_number++] = run;
+}
+
+/**
+ * Take a snapshot of the stock within tile (tx, ty)
+ */
+
+static void
+gcode_sim_tile_save (gcode_t *gcode, gcode_sim_tile_t *tile, int tx, int ty)
+{
+  int x, y, z, nz;
+  uint32_t run, run_alloc;
+  uint16_t *row;
+  uint8_t solid;
+
+  tile->min[0] = tx * GCODE_SIM_SNAPSHOT_TILE;
+  tile->min[1] = ty * GCODE_SIM_SNAPSHOT_TILE;
+  tile->max[0] = tile->min[0] + GCODE_SIM_SNAPSHOT_TILE - 1;
+  tile->max[1] = tile->min[1] + GCODE_SIM_SNAPSHOT_TILE - 1;
+
+  if (tile->max[0] >= (int)gcode->voxel_number[0])
+    tile->max[0] = gcode->voxel_number[0] - 1;
+
+  if (tile->max[1] >= (int)gcode->voxel_number[1])
+    tile->max[1] = gcode->voxel_number[1] - 1;
+
+  tile->run_list = NULL;
+  tile->run_number = 0;
+  run_alloc = 0;
+
+  for (y = tile->min[1]; y <= tile->max[1]; y++)
+  {
+    if (gcode->stock_model == GCODE_STOCK_HEIGHT_MAP)
     {
-      gcode_vec3d_t tvec;
-      gfloat_t tmag;
+      row = &gcode->height_map[y * gcode->voxel_number[0]];
 
-      GCODE_MATH_VEC3D_SUB (tvec, sim->pos, xyz);
-      GCODE_MATH_VEC3D_MAG (tmag, tvec);
+      for (x = tile->min[0]; x <= tile->max[0]; x += run)
+      {
+        for (run = 1; x + run <= tile->max[0] && row[x + run] == row[x]; run++);
 
-      GCODE_MATH_VEC3D_COPY (sim->pos, xyz);
+        gcode_sim_tile_push (tile, &run_alloc, run);
+        gcode_sim_tile_push (tile, &run_alloc, row[x]);
+      }
+
+      continue;
     }
 
-    /* Perform Intersection test */
-    gcode_sim_intersect (gcode, sim);
-  } while (cur_dist < tot_dist);
+    nz = gcode->voxel_number[2];
+
+    for (x = tile->min[0]; x <= tile->max[0]; x++)
+    {
+      solid = 1;
+
+      for (z = 0; z < nz; z += run, solid ^= 1)
+      {
+        for (run = 0; z + run < nz && gcode_voxel_get (&gcode->voxel_map, x, y, z + run) == solid; run++);
+
+        gcode_sim_tile_push (tile, &run_alloc, run);
+      }
+    }
+  }
+}
+
+/**
+ * Put the stock within a tile back the way its snapshot has it
+ */
+
+static void
+gcode_sim_tile_restore (gcode_t *gcode, gcode_sim_tile_t *tile)
+{
+  int x, y, z, nz;
+  uint32_t i, j, run;
+  uint16_t *row;
+  uint8_t solid;
+
+  i = 0;
+
+  for (y = tile->min[1]; y <= tile->max[1]; y++)
+  {
+    if (gcode->stock_model == GCODE_STOCK_HEIGHT_MAP)
+    {
+      row = &gcode->height_map[y * gcode->voxel_number[0]];
+
+      for (x = tile->min[0]; x <= tile->max[0]; i += 2)
+        for (j = 0; j < tile->run_list[i]; j++)
+          row[x++] = tile->run_list[i + 1];
+
+      continue;
+    }
+
+    nz = gcode->voxel_number[2];
+
+    for (x = tile->min[0]; x <= tile->max[0]; x++)
+    {
+      gcode_voxel_fill_column (&gcode->voxel_map, x, y);
+
+      solid = 1;
+
+      for (z = 0; z < nz; z += run, solid ^= 1)
+      {
+        run = tile->run_list[i++];
+
+        if (!solid && run)
+          gcode_voxel_clear (&gcode->voxel_map, x, x, y, z, z + run - 1);
+      }
+    }
+  }
+}
+
+static void
+gcode_sim_checkpoint_free (gcode_sim_checkpoint_t *checkpoint)
+{
+  uint32_t i;
+
+  for (i = 0; i < checkpoint->tile_number; i++)
+    free (checkpoint->tile_list[i].run_list);
+
+  free (checkpoint->tile_list);
+
+  checkpoint->tile_list = NULL;
+  checkpoint->tile_number = 0;
+}
+
+void
+gcode_sim_history_free (gcode_t *gcode)
+{
+  gcode_sim_history_t *history;
+  uint32_t i;
+
+  history = gcode->sim_history;
+
+  if (!history)
+    return;
+
+  for (i = 0; i < history->checkpoint_number; i++)
+    gcode_sim_checkpoint_free (&history->checkpoint_list[i]);
+
+  free (history->checkpoint_list);
+  free (history->touched);
+  free (history);
+
+  gcode->sim_history = NULL;
+}
+
+/**
+ * Get ready to simulate a program made of 'block_number' top-level blocks, the
+ * code up to the end of each being hashed into 'hash_list'. The stock is rolled
+ * back to the last checkpoint the previous render has in common with this one
+ * (or is restored in full if there is none) and the simulator is put back into
+ * the state it was in there; returns the index of the first block to simulate.
+ * From here on, motions are only recorded, then carved at each checkpoint.
+ */
+
+uint32_t
+gcode_sim_resume (gcode_t *gcode, gcode_sim_t *sim, gcode_motion_state_t *state, uint64_t *hash_list, uint32_t block_number)
+{
+  gcode_sim_history_t *history;
+  gcode_sim_checkpoint_t *checkpoint;
+  uint32_t i, j, first;
+
+  sim->record = 1;
+  sim->clip_max[0] = -1;
+  sim->clip_max[1] = -1;
+
+  history = gcode->sim_history;
+
+  if (history &&
+      (history->stock_model != gcode->stock_model ||
+       history->sim_mode != gcode->sim_mode ||
+       history->units != gcode->units ||
+       history->voxel_resolution != gcode->voxel_resolution ||
+       history->height_resolution != gcode->height_resolution ||
+       history->voxel_number[0] != gcode->voxel_number[0] ||
+       history->voxel_number[1] != gcode->voxel_number[1] ||
+       history->voxel_number[2] != gcode->voxel_number[2] ||
+       history->material_size[0] != gcode->material_size[0] ||
+       history->material_size[1] != gcode->material_size[1] ||
+       history->material_size[2] != gcode->material_size[2]))
+  {
+    gcode_sim_history_free (gcode);
+    history = NULL;
+  }
+
+  if (!history)
+  {
+    /* Turn all the voxels back on (or raise every height map cell back to the top) */
+    if (gcode->stock_model == GCODE_STOCK_HEIGHT_MAP)
+      memset (gcode->height_map, 0xFF, (size_t)gcode->voxel_number[0] * gcode->voxel_number[1] * sizeof (uint16_t));
+    else
+      gcode_voxel_fill (&gcode->voxel_map);
+
+    history = calloc (1, sizeof (gcode_sim_history_t));
+
+    if (!history)
+    {
+      REMARK ("Failed to allocate memory for simulation checkpoints\n");
+      return (0);
+    }
+
+    history->stock_model = gcode->stock_model;
+    history->sim_mode = gcode->sim_mode;
+    history->units = gcode->units;
+    history->voxel_resolution = gcode->voxel_resolution;
+    history->height_resolution = gcode->height_resolution;
+    history->voxel_number[0] = gcode->voxel_number[0];
+    history->voxel_number[1] = gcode->voxel_number[1];
+    history->voxel_number[2] = gcode->voxel_number[2];
+    history->material_size[0] = gcode->material_size[0];
+    history->material_size[1] = gcode->material_size[1];
+    history->material_size[2] = gcode->material_size[2];
+
+    history->tiles[0] = (gcode->voxel_number[0] + GCODE_SIM_SNAPSHOT_TILE - 1) / GCODE_SIM_SNAPSHOT_TILE;
+    history->tiles[1] = (gcode->voxel_number[1] + GCODE_SIM_SNAPSHOT_TILE - 1) / GCODE_SIM_SNAPSHOT_TILE;
+    history->touched = calloc ((size_t)history->tiles[0] * history->tiles[1], 1);
+
+    if (!history->touched)
+    {
+      REMARK ("Failed to allocate memory for simulation checkpoints\n");
+      free (history);
+      return (0);
+    }
+
+    gcode->sim_history = history;
+  }
+
+  /* Keep the checkpoints whose code (and all the code before it) is unchanged */
+  for (first = 0; first < history->checkpoint_number && first < block_number; first++)
+    if (!hash_list[first] || history->checkpoint_list[first].hash != hash_list[first])
+      break;
+
+  /* Roll the stock back, block by block, undoing everything after them */
+  for (i = history->checkpoint_number; i > first; i--)
+  {
+    checkpoint = &history->checkpoint_list[i - 1];
+
+    for (j = checkpoint->tile_number; j > 0; j--)
+      gcode_sim_tile_restore (gcode, &checkpoint->tile_list[j - 1]);
+
+    gcode_sim_checkpoint_free (checkpoint);
+  }
+
+  history->checkpoint_number = first;
+
+  if (first)
+  {
+    checkpoint = &history->checkpoint_list[first - 1];
+
+    GCODE_MATH_VEC3D_COPY (sim->pos, checkpoint->pos);
+    GCODE_MATH_VEC3D_COPY (sim->origin, checkpoint->origin);
+    sim->tool_diameter = checkpoint->tool_diameter;
+    sim->time_elapsed = checkpoint->time_elapsed;
+
+    *state = checkpoint->state;
+  }
+
+  return (first);
+}
+
+/**
+ * Close the top-level block whose code (with everything before it) hashes to
+ * 'hash': snapshot the tiles its recorded motions are about to carve, carve them
+ * and append a checkpoint holding the simulator state right after the block.
+ */
+
+void
+gcode_sim_checkpoint (gcode_t *gcode, gcode_sim_t *sim, gcode_motion_state_t *state, uint64_t hash)
+{
+  gcode_sim_history_t *history;
+  gcode_sim_checkpoint_t *checkpoint;
+  gcode_sim_segment_t *segment;
+  int tx, ty, min[2], max[2];
+  uint32_t i;
+
+  history = gcode->sim_history;
+
+  if (!history)
+  {
+    gcode_sim_flush (gcode, sim);
+    return;
+  }
+
+  if (history->checkpoint_number == history->checkpoint_alloc)
+  {
+    history->checkpoint_alloc = history->checkpoint_alloc ? 2 * history->checkpoint_alloc : 64;
+    history->checkpoint_list = realloc (history->checkpoint_list, history->checkpoint_alloc * sizeof (gcode_sim_checkpoint_t));
+  }
+
+  checkpoint = &history->checkpoint_list[history->checkpoint_number++];
+
+  checkpoint->hash = hash;
+  checkpoint->tile_list = NULL;
+  checkpoint->tile_number = 0;
+
+  /* Find the tiles touched by the block */
+  for (i = 0; i < sim->segment_number; i++)
+  {
+    segment = &sim->segment_list[i];
+
+    min[0] = (segment->min[0] < 0 ? 0 : segment->min[0]) / GCODE_SIM_SNAPSHOT_TILE;
+    min[1] = (segment->min[1] < 0 ? 0 : segment->min[1]) / GCODE_SIM_SNAPSHOT_TILE;
+    max[0] = (segment->max[0] < 0 ? -1 : segment->max[0] / GCODE_SIM_SNAPSHOT_TILE);
+    max[1] = (segment->max[1] < 0 ? -1 : segment->max[1] / GCODE_SIM_SNAPSHOT_TILE);
+
+    if (max[0] >= history->tiles[0])
+      max[0] = history->tiles[0] - 1;
+
+    if (max[1] >= history->tiles[1])
+      max[1] = history->tiles[1] - 1;
+
+    for (ty = min[1]; ty <= max[1]; ty++)
+      for (tx = min[0]; tx <= max[0]; tx++)
+        if (!history->touched[ty * history->tiles[0] + tx])
+        {
+          history->touched[ty * history->tiles[0] + tx] = 1;
+          checkpoint->tile_number++;
+        }
+  }
+
+  /* Save them as they are before the block carves them */
+  if (checkpoint->tile_number)
+  {
+    checkpoint->tile_list = malloc (checkpoint->tile_number * sizeof (gcode_sim_tile_t));
+    checkpoint->tile_number = 0;
+
+    for (ty = 0; ty < history->tiles[1]; ty++)
+      for (tx = 0; tx < history->tiles[0]; tx++)
+        if (history->touched[ty * history->tiles[0] + tx])
+        {
+          history->touched[ty * history->tiles[0] + tx] = 0;
+          gcode_sim_tile_save (gcode, &checkpoint->tile_list[checkpoint->tile_number++], tx, ty);
+        }
+  }
+
+  gcode_sim_flush (gcode, sim);
+
+  GCODE_MATH_VEC3D_COPY (checkpoint->pos, sim->pos);
+  GCODE_MATH_VEC3D_COPY (checkpoint->origin, sim->origin);
+  checkpoint->tool_diameter = sim->tool_diameter;
+  checkpoint->time_elapsed = sim->time_elapsed;
+  checkpoint->state = *state;
 }
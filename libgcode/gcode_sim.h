@@ -23,26 +23,117 @@
 #define _GCODE_SIM_H
 
 #include "gcode_internal.h"
+#include "gcode_motion.h"
+#include <pthread.h>
+
+#define GCODE_SIM_TILES_PER_THREAD  4                                           /* More tiles than threads balance the load */
+#define GCODE_SIM_SNAPSHOT_TILE     32                                          /* Cells along each side of a checkpoint tile */
+
+#define GCODE_SIM_SEGMENT_LINE      0x00
+#define GCODE_SIM_SEGMENT_ARC_CW    0x01
+#define GCODE_SIM_SEGMENT_ARC_CCW   0x02
+
+typedef struct gcode_sim_segment_s
+{
+  uint8_t type;                                                                 /* line, clockwise or counter-clockwise arc */
+  gfloat_t tool_diameter;                                                       /* end mill diameter */
+  gcode_vec3d_t origin;                                                         /* material origin */
+  gcode_vec3d_t pos;                                                            /* start position */
+  gcode_vec3d_t xyz;                                                            /* end position */
+  gcode_vec3d_t ijk;                                                            /* arc center, relative to the start */
+  int min[2];                                                                   /* first XY cell possibly touched */
+  int max[2];                                                                   /* last XY cell possibly touched */
+} gcode_sim_segment_t;
 
 typedef struct gcode_sim_s
 {
+  uint8_t mode;                                                                 /* stepped or swept simulation */
   gcode_vec3d_t pos;                                                            /* end mill position */
   gfloat_t tool_diameter;                                                       /* end mill diameter */
   gfloat_t origin[3];                                                           /* material origin */
-  gfloat_t feed;                                                                /* units per minute */
-  uint8_t absolute;                                                             /* absolute or relative coordinates */
   gfloat_t time_elapsed;                                                        /* time elapsed */
   gfloat_t step_res;                                                            /* step resolution */
   gcode_vec3d_t vn_inv;                                                         /* voxel number inverse */
+  int clip_min[2];                                                              /* first XY cell that may be carved */
+  int clip_max[2];                                                              /* last XY cell that may be carved */
+  int threads;                                                                  /* number of carving threads */
+  uint8_t record;                                                               /* record segments instead of carving */
+  gcode_sim_segment_t *segment_list;                                            /* recorded segments, carved by flush */
+  uint32_t segment_number;
+  uint32_t segment_alloc;
 } gcode_sim_t;
 
+/**
+ * The state of the stock within one tile, stored as runs: alternately material
+ * and air up each column (voxel map) or (length, level) pairs along each row
+ * (height map), which is what makes keeping one per carved tile affordable.
+ */
+
+typedef struct gcode_sim_tile_s
+{
+  int min[2];                                                                   /* first XY cell of the tile */
+  int max[2];                                                                   /* last XY cell of the tile */
+  uint32_t *run_list;
+  uint32_t run_number;
+} gcode_sim_tile_t;
+
+/**
+ * What the simulation looks like right after a top-level block: the state of the
+ * simulator and of the G-code compiler, plus every tile the block carved as it
+ * was before the block, which is all it takes to roll the stock back from any
+ * later point to this one.
+ */
+
+typedef struct gcode_sim_checkpoint_s
+{
+  uint64_t hash;                                                                /* code of every top-level block up to this one */
+  gcode_vec3d_t pos;
+  gfloat_t tool_diameter;
+  gfloat_t origin[3];
+  gfloat_t time_elapsed;
+  gcode_motion_state_t state;                                                   /* G-code compiler state after the block */
+  gcode_sim_tile_t *tile_list;                                                  /* tiles carved by the block, before the block */
+  uint32_t tile_number;
+} gcode_sim_checkpoint_t;
+
+/**
+ * Checkpoints of the last final part render, valid for as long as the stock and
+ * the simulation settings stay what they were then.
+ */
+
+typedef struct gcode_sim_history_s
+{
+  uint8_t stock_model;
+  uint8_t sim_mode;
+  uint8_t units;
+  uint32_t voxel_resolution;
+  uint32_t height_resolution;
+  uint32_t voxel_number[3];
+  gfloat_t material_size[3];
+  int tiles[2];                                                                 /* number of checkpoint tiles along X and Y */
+  uint8_t *touched;                                                             /* tiles carved by the block being simulated */
+  gcode_sim_checkpoint_t *checkpoint_list;
+  uint32_t checkpoint_number;
+  uint32_t checkpoint_alloc;
+} gcode_sim_history_t;
+
+typedef struct gcode_sim_job_s
+{
+  gcode_t *gcode;
+  gcode_sim_t *sim;
+  pthread_mutex_t lock;                                                         /* protects next_tile */
+  int next_tile;
+  int tiles[2];                                                                 /* number of tiles along X and Y */
+  int bricks[2];                                                                /* number of sparse map bricks along X and Y */
+  pthread_t caller;                                                             /* the only thread reporting progress */
+} gcode_sim_job_t;
+
 void gcode_sim_init (gcode_sim_t *sim, gcode_t *gcode);
 void gcode_sim_free (gcode_sim_t *sim);
-
-void gcode_sim_G00 (gcode_t *gcode, gcode_sim_t *sim, char *args);
-void gcode_sim_G01 (gcode_t *gcode, gcode_sim_t *sim, char *args);
-void gcode_sim_G02 (gcode_t *gcode, gcode_sim_t *sim, char *args);
-void gcode_sim_G03 (gcode_t *gcode, gcode_sim_t *sim, char *args);
-void gcode_sim_G83 (gcode_t *gcode, gcode_sim_t *sim, char *args, gfloat_t *G83_depth, gfloat_t *G83_retract, int init);
+void gcode_sim_run (gcode_t *gcode, gcode_sim_t *sim, gcode_motion_list_t *list);
+void gcode_sim_flush (gcode_t *gcode, gcode_sim_t *sim);
+uint32_t gcode_sim_resume (gcode_t *gcode, gcode_sim_t *sim, gcode_motion_state_t *state, uint64_t *hash_list, uint32_t block_number);
+void gcode_sim_checkpoint (gcode_t *gcode, gcode_sim_t *sim, gcode_motion_state_t *state, uint64_t hash);
+void gcode_sim_history_free (gcode_t *gcode);
 
 #endif
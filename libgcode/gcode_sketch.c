@@ -26,6 +26,7 @@
 #include "gcode_pocket.h"
 #include "gcode_arc.h"
 #include "gcode_line.h"
+#include "gcode_index.h"
 #include "gcode.h"
 
 #define SHARPNESS_LIMIT       -0.5
@@ -324,6 +325,8 @@ gcode_sketch_fwd_first_outside (gcode_block_t *block, gcode_block_t *listhead, g
  * account, but obtained intersection points are then assigned as new endpoints
  * DIRECTLY, without trying to apply to them any of those offsets "in reverse";
  * As it is, it's the CALLER's responsibility to make sure there are NO OFFSETS.
+ * NOTE: 'offset' is the offset the list was originally built with - it is only
+ * used to size the region of interest around each sharp point;
  */
 
 static void
@@ -602,12 +605,11 @@ gcode_sketch_insert_transitions (gcode_block_t *listhead, int closed)
  */
 
 static void
-gcode_sketch_check_sharp_points (gcode_block_t **listhead, int closed)
+gcode_sketch_check_sharp_points (gcode_block_t **listhead, gcode_offset_t *offset, int closed)
 {
   gcode_block_t *head, *tail;
   gcode_block_t *index_block, *focus_block;
   gcode_block_t *incoming_block, *outgoing_block;
-  gcode_sketch_t *sketch;
   gcode_vec2d_t datum;
   gfloat_t radius, index;
 
@@ -622,9 +624,7 @@ gcode_sketch_check_sharp_points (gcode_block_t **listhead, int closed)
   if (head->parent->type != GCODE_TYPE_SKETCH)                                  // If the parent of these blocks isn't a sketch, leave;
     return;
 
-  sketch = (gcode_sketch_t *)head->parent->pdata;                               // Acquire a reference to the sketch data of the parent block;
-
-  radius = (sketch->offset.eval + sketch->offset.tool) * 2;                     // Establish the radius of interest around a sharp point;
+  radius = (offset->eval + offset->tool) * 2;                                   // Establish the radius of interest around a sharp point (by the original offset);
 
   if (radius < GCODE_PRECISION)                                                 // If there is no offset present in this contour, leave;
     return;
@@ -747,6 +747,199 @@ gcode_sketch_check_sharp_points (gcode_block_t **listhead, int closed)
   gcode_util_remove_tagged_blocks (listhead);                                   // Everything unneeded has been tagged - proceed to remove all of it;
 }
 
+/**
+ * Return the signed area swept by the radius from the origin to a point that
+ * travels along 'block' from 'from' to 'to' (both on the block, null meaning
+ * the block's own endpoints); added up along a closed chain, this yields the
+ * area the chain encloses - positive for a chain running counter-clockwise,
+ * negative for a clockwise one. For arcs, the part between the arc and its
+ * chord is added on top of the triangle spanned by the chord.
+ * NOTE: this RELIES on 'block' being linked to an offset of ZERO.
+ */
+
+static gfloat_t
+gcode_sketch_swept_area (gcode_block_t *block, gfloat_t *from, gfloat_t *to)
+{
+  gcode_vec2d_t p0, p1, center;
+  gfloat_t area, sweep, angle0, angle1;
+
+  block->ends (block, p0, p1, GCODE_GET);                                       // Start out with the ends of the block, then replace them as asked to;
+
+  if (from)
+    GCODE_MATH_VEC2D_COPY (p0, from);
+
+  if (to)
+    GCODE_MATH_VEC2D_COPY (p1, to);
+
+  area = 0.5 * (p0[0] * p1[1] - p1[0] * p0[1]);                                 // This is the triangle between the origin and the chord;
+
+  if (block->type == GCODE_TYPE_ARC)
+  {
+    gcode_arc_t *arc;
+
+    arc = (gcode_arc_t *)block->pdata;
+
+    sweep = arc->sweep_angle;
+
+    if (from || to)                                                             // Only part of the arc is involved: find out how much of the sweep that is,
+    {                                                                           // going around the same way the arc itself does;
+      gcode_arc_center (block, center, GCODE_GET);
+
+      gcode_math_xy_to_angle (center, p0, &angle0);
+      gcode_math_xy_to_angle (center, p1, &angle1);
+
+      sweep = angle1 - angle0;
+
+      if (arc->sweep_angle > 0.0 && sweep < 0.0)
+        sweep += 360.0;
+
+      if (arc->sweep_angle < 0.0 && sweep > 0.0)
+        sweep -= 360.0;
+    }
+
+    sweep *= GCODE_DEG2RAD;
+
+    area += 0.5 * arc->radius * arc->radius * (sweep - sin (sweep));            // The segment between the arc and its chord comes on top of that;
+  }
+
+  return (area);
+}
+
+/**
+ * Offsetting a closed contour inwards past a narrow neck or a tight bend (or
+ * outwards around a deep notch) makes it cross itself far away from any sharp
+ * point, leaving a loop that runs the opposite way than the contour itself -
+ * this finds such crossings between blocks that are not neighbors (indexing
+ * the blocks by their bounding box, so only the nearby ones get intersected),
+ * and where one of the two loops a crossing splits the contour into encloses
+ * a negative area relative to the whole, trims the loop off at the crossing;
+ * loops running the same way as the contour are left alone, since those are
+ * legitimate parts of a contour that got pinched in two;
+ * NOTE: crossings right at the ends of either block are left to the other
+ * stages, as they only come from contours touching themselves at a corner;
+ * NOTE: this RELIES on all blocks in the list being linked to an offset of ZERO.
+ */
+
+static void
+gcode_sketch_remove_inverted_loops (gcode_block_t **listhead)
+{
+  gcode_block_t **block_array;
+  gcode_block_t *index_block;
+  gcode_index_t index;
+  gcode_vec2d_t bmin, bmax;
+  gcode_vec2d_t ip_array[2];
+  gcode_vec2d_t p0_i, p1_i, p0_j, p1_j;
+  gfloat_t total_area, loop_area;
+  uint32_t block_count, i, j, k, l;
+  int ip_count, ip_index, trimmed, attempt;
+
+  block_count = 0;
+
+  for (index_block = *listhead; index_block; index_block = index_block->next)
+    block_count++;
+
+  if (block_count < 4)                                                          // At least four blocks are needed for two of them to not be neighbors;
+    return;
+
+  block_array = malloc (block_count * sizeof (gcode_block_t *));
+
+  for (attempt = 0; attempt < (int)block_count; attempt++)                      // Every loop removed takes at least one block along - that's a hard limit;
+  {
+    block_count = 0;
+
+    for (index_block = *listhead; index_block; index_block = index_block->next)
+      block_array[block_count++] = index_block;
+
+    if (block_count < 4)
+      break;
+
+    total_area = 0.0;
+
+    for (i = 0; i < block_count; i++)
+      total_area += gcode_sketch_swept_area (block_array[i], NULL, NULL);
+
+    gcode_index_init (&index);
+    gcode_index_blocks (&index, *listhead, NULL);
+
+    trimmed = 0;
+
+    for (i = 0; i < block_count && !trimmed; i++)
+    {
+      gcode_util_qdbb (block_array[i], bmin, bmax);
+
+      gcode_index_box (&index, bmin, bmax);
+
+      block_array[i]->ends (block_array[i], p0_i, p1_i, GCODE_GET);
+
+      for (k = 0; k < index.found_number && !trimmed; k++)
+      {
+        j = index.found[k];                                                     // Blocks come out of the index by their position in the list;
+
+        if ((j <= i + 1) || (i == 0 && j == block_count - 1))                   // Each pair is only looked at once, and neighbors are not looked at all;
+          continue;
+
+        if (gcode_util_intersect (block_array[i], block_array[j], ip_array, &ip_count) != 0)
+          continue;
+
+        block_array[j]->ends (block_array[j], p0_j, p1_j, GCODE_GET);
+
+        for (ip_index = 0; ip_index < ip_count && !trimmed; ip_index++)
+        {
+          gfloat_t *ip;
+
+          ip = ip_array[ip_index];
+
+          if ((GCODE_MATH_2D_DISTANCE (ip, p0_i) < GCODE_PRECISION) || (GCODE_MATH_2D_DISTANCE (ip, p1_i) < GCODE_PRECISION) ||
+              (GCODE_MATH_2D_DISTANCE (ip, p0_j) < GCODE_PRECISION) || (GCODE_MATH_2D_DISTANCE (ip, p1_j) < GCODE_PRECISION))
+            continue;
+
+          loop_area = gcode_sketch_swept_area (block_array[i], ip, NULL);       // The loop from the crossing along the rest of 'i', up to 'j' and
+                                                                                // back along the start of 'j' to the crossing;
+          for (l = i + 1; l < j; l++)
+            loop_area += gcode_sketch_swept_area (block_array[l], NULL, NULL);
+
+          loop_area += gcode_sketch_swept_area (block_array[j], NULL, ip);      // The other loop encloses whatever remains of the total;
+
+          if (fabs (loop_area) < GCODE_PRECISION * GCODE_PRECISION)             // A loop too small to tell which way it goes is not worth trimming;
+            continue;
+
+          if ((loop_area < 0.0) != (total_area < 0.0))                          // If the loop between 'i' and 'j' runs the wrong way, cut it out:
+          {                                                                     // 'i' ends and 'j' starts at the crossing, everything between goes;
+            gcode_util_trim_both (block_array[i], block_array[j], ip);
+
+            for (l = i + 1; l < j; l++)
+              GCODE_UTIL_TAG_BLOCK (block_array[l]);
+
+            trimmed = 1;
+          }
+          else if ((fabs (total_area - loop_area) > GCODE_PRECISION * GCODE_PRECISION) &&
+                   ((total_area - loop_area < 0.0) != (total_area < 0.0)))      // If it's the other loop that runs the wrong way, keep this one instead:
+          {                                                                     // 'j' ends and 'i' starts at the crossing, everything else goes;
+            gcode_util_trim_both (block_array[j], block_array[i], ip);
+
+            for (l = 0; l < i; l++)
+              GCODE_UTIL_TAG_BLOCK (block_array[l]);
+
+            for (l = j + 1; l < block_count; l++)
+              GCODE_UTIL_TAG_BLOCK (block_array[l]);
+
+            trimmed = 1;
+          }
+        }
+      }
+    }
+
+    gcode_index_free (&index);
+
+    if (!trimmed)                                                               // No more loops to remove, the contour is done;
+      break;
+
+    gcode_util_remove_tagged_blocks (listhead);
+  }
+
+  free (block_array);
+}
+
 static void
 gcode_sketch_add_up_path_length (gcode_block_t *listhead, gfloat_t *length)
 {
@@ -792,6 +985,426 @@ gcode_sketch_flip_direction (gcode_block_t **listhead)
   }
 }
 
+/**
+ * Build in 'listhead' the contour of the sub-chain 'start_block' -> 'end_block'
+ * as offset by 'offset': take a working snapshot of the sub-chain linked to that
+ * offset, recalculate it to a zero offset, then trim and reconnect the result;
+ * the zero offset the contour ends up linked to must be freed with the list.
+ * NOTE: this only reads the sketch and 'offset', so contours for any number of
+ * different offsets can be built at the same time (on different threads);
+ */
+
+static void
+gcode_sketch_contour (gcode_block_t **listhead, gcode_block_t *start_block, gcode_block_t *end_block, gcode_offset_t *offset, int closed)
+{
+  gcode_block_t *index_block;
+
+  gcode_util_get_sublist_snapshot (listhead, start_block, end_block);           // Take a working snapshot, so the original sub-chain can be preserved;
+
+  for (index_block = *listhead; index_block; index_block = index_block->next)   // The snapshot is linked to the offset of the sketch: re-link it to 'offset';
+    index_block->offset = offset;
+
+  if (*listhead)                                                                // Join runs of short lines that make up a longer line or arc, if asked to;
+    gcode_util_fit_list (listhead, GCODE_UNITS ((*listhead)->gcode, (*listhead)->gcode->fit_tolerance));
+
+  gcode_util_convert_to_no_offset (*listhead);                                  // Recalculate that snapshot with offsets included & link it to a zero offset;
+  gcode_util_tag_null_size_blocks (*listhead);                                  // Tag but do not remove anything that BECAME zero-sized by applying the offset;
+
+  gcode_sketch_trim_intersections (*listhead, closed);                          // Find and trim intersecting primitives back to the intersection point;
+  gcode_sketch_insert_transitions (*listhead, closed);                          // Add transition arcs wherever connected endpoints were pulled apart;
+
+  gcode_util_remove_tagged_blocks (listhead);                                   // Remove the tagged blocks - they are no longer needed, the contour is done;
+
+  gcode_sketch_check_sharp_points (listhead, offset, closed);
+
+  if (closed)                                                                   // Offsets crossing themselves away from sharp points get cleaned up last;
+    gcode_sketch_remove_inverted_loops (listhead);
+}
+
+/**
+ * The fingerprint of the geometry of the children of 'block' - everything its
+ * sorted snapshot and any of the contours built from that depend on, besides
+ * the offset a contour gets built with;
+ */
+
+static uint64_t
+gcode_sketch_stamp (gcode_block_t *block)
+{
+  gcode_block_t *index_block;
+  gcode_vec2d_t e0, e1;
+  uint64_t hash;
+
+  hash = 0xCBF29CE484222325ULL;
+
+  hash = gcode_make_hash (hash, &block->gcode->fit_tolerance, sizeof (gfloat_t));
+
+  for (index_block = block->listhead; index_block; index_block = index_block->next)
+  {
+    hash = gcode_make_hash (hash, &index_block->type, sizeof (uint8_t));
+
+    switch (index_block->type)
+    {
+      case GCODE_TYPE_LINE:
+        hash = gcode_make_hash (hash, index_block->pdata, sizeof (gcode_line_t));
+        break;
+
+      case GCODE_TYPE_ARC:
+        hash = gcode_make_hash (hash, index_block->pdata, sizeof (gcode_arc_t));
+        break;
+
+      default:
+        index_block->ends (index_block, e0, e1, GCODE_GET);
+        hash = gcode_make_hash (hash, e0, sizeof (gcode_vec2d_t));
+        hash = gcode_make_hash (hash, e1, sizeof (gcode_vec2d_t));
+        break;
+    }
+  }
+
+  return (hash);
+}
+
+/**
+ * Re-link every block of 'listhead' to 'gcode' (the cache may outlive the copy
+ * of the project some earlier make was done with);
+ */
+
+static void
+gcode_sketch_relink (gcode_block_t *listhead, gcode_t *gcode)
+{
+  gcode_block_t *index_block;
+
+  for (index_block = listhead; index_block; index_block = index_block->next)
+    index_block->gcode = gcode;
+}
+
+static void
+gcode_sketch_cache_flush (gcode_sketch_cache_t *cache)
+{
+  int i;
+
+  for (i = 0; i < cache->contour_number; i++)
+  {
+    if (cache->contour[i].listhead)
+      free (cache->contour[i].listhead->offset);
+
+    gcode_list_free (&cache->contour[i].listhead);
+  }
+
+  cache->contour_number = 0;
+
+  gcode_list_free (&cache->sorted_listhead);
+}
+
+/**
+ * Start a make or a draw ('user') of 'block' off the cache: build the snapshot
+ * of the children again only if they changed since it was last built, and note
+ * none of the contours is in use by 'user' yet; returns the sorted snapshot.
+ */
+
+static gcode_block_t *
+gcode_sketch_cache_begin (gcode_block_t *block, uint8_t user)
+{
+  gcode_sketch_cache_t *cache;
+  uint64_t stamp;
+  int i;
+
+  cache = &((gcode_sketch_t *)block->pdata)->cache;
+
+  stamp = gcode_sketch_stamp (block);
+
+  if (!cache->sorted_listhead || stamp != cache->stamp)
+  {
+    gcode_sketch_cache_flush (cache);
+
+    gcode_util_get_sublist_snapshot (&cache->sorted_listhead, block->listhead, NULL);    // First off, we need a working snapshot of the entire list ('sorted_listhead')
+    gcode_util_remove_null_sections (&cache->sorted_listhead);                  // We also need to remove any zero-sized features that could screw up the math;
+    gcode_util_merge_list_fragments (&cache->sorted_listhead);                  // But why is it called 'sorted' when it's a straight copy? Oh, that's why...
+
+    cache->stamp = stamp;
+  }
+
+  gcode_sketch_relink (cache->sorted_listhead, block->gcode);
+
+  for (i = 0; i < cache->contour_number; i++)
+  {
+    gcode_sketch_relink (cache->contour[i].listhead, block->gcode);
+    cache->contour[i].used &= ~user;
+  }
+
+  return (cache->sorted_listhead);
+}
+
+/**
+ * Finish a make or a draw of 'block': drop the contours neither the latest make
+ * nor the latest draw asked for;
+ */
+
+static void
+gcode_sketch_cache_end (gcode_block_t *block)
+{
+  gcode_sketch_cache_t *cache;
+  int i, kept;
+
+  cache = &((gcode_sketch_t *)block->pdata)->cache;
+
+  kept = 0;
+
+  for (i = 0; i < cache->contour_number; i++)
+  {
+    if (cache->contour[i].used)
+    {
+      cache->contour[kept++] = cache->contour[i];
+      continue;
+    }
+
+    if (cache->contour[i].listhead)
+      free (cache->contour[i].listhead->offset);
+
+    gcode_list_free (&cache->contour[i].listhead);
+  }
+
+  cache->contour_number = kept;
+}
+
+static int
+gcode_sketch_same_offset (gcode_offset_t *a, gcode_offset_t *b)
+{
+  return (a->origin[0] == b->origin[0] && a->origin[1] == b->origin[1] &&
+          a->rotation == b->rotation && a->side == b->side &&
+          a->tool == b->tool && a->eval == b->eval);
+}
+
+/**
+ * The cache entry of the contour of the sub-chain starting with 'start_block' as
+ * offset by 'offset', now marked as used by 'user'; NULL if there is none (yet);
+ */
+
+static gcode_sketch_contour_t *
+gcode_sketch_cached_contour (gcode_sketch_cache_t *cache, gcode_block_t *start_block, gcode_offset_t *offset, uint8_t user)
+{
+  int i;
+
+  for (i = 0; i < cache->contour_number; i++)
+  {
+    if (cache->contour[i].chain == start_block && gcode_sketch_same_offset (&cache->contour[i].offset, offset))
+    {
+      cache->contour[i].used |= user;
+      return (&cache->contour[i]);
+    }
+  }
+
+  return (NULL);
+}
+
+/**
+ * Get in 'listhead' the contour of the sub-chain 'start_block' -> 'end_block'
+ * (part of the cached sorted snapshot) as offset by 'offset' for 'user': it is
+ * only built if not in the cache yet. What 'listhead' gets is a copy, linked
+ * to a zero offset of its own, to use up and free just like a contour built by
+ * 'gcode_sketch_contour'. Safe to call from several threads at once.
+ */
+
+static void
+gcode_sketch_get_contour (gcode_block_t **listhead, gcode_block_t *block, gcode_block_t *start_block, gcode_block_t *end_block, gcode_offset_t *offset, int closed, uint8_t user)
+{
+  gcode_sketch_cache_t *cache;
+  gcode_sketch_contour_t *contour;
+  gcode_block_t *index_block, *cached_listhead, *built_listhead;
+  gcode_offset_t *zero_offset;
+
+  cache = &((gcode_sketch_t *)block->pdata)->cache;
+
+  pthread_mutex_lock (&cache->lock);
+
+  contour = gcode_sketch_cached_contour (cache, start_block, offset, user);
+  cached_listhead = contour ? contour->listhead : NULL;
+
+  pthread_mutex_unlock (&cache->lock);
+
+  if (!contour)                                                                 // Not in the cache: build it (outside the lock, that is the slow part);
+  {
+    gcode_sketch_contour (&built_listhead, start_block, end_block, offset, closed);
+
+    pthread_mutex_lock (&cache->lock);
+
+    contour = gcode_sketch_cached_contour (cache, start_block, offset, user);
+
+    if (contour)                                                                // Another thread has built and cached the same contour meanwhile;
+    {
+      cached_listhead = contour->listhead;
+
+      if (built_listhead)
+        free (built_listhead->offset);
+
+      gcode_list_free (&built_listhead);
+    }
+    else
+    {
+      if (cache->contour_number == cache->contour_alloc)
+      {
+        cache->contour_alloc = cache->contour_alloc ? 2 * cache->contour_alloc : 64;
+        cache->contour = realloc (cache->contour, cache->contour_alloc * sizeof (gcode_sketch_contour_t));
+      }
+
+      contour = &cache->contour[cache->contour_number++];
+
+      contour->chain = start_block;
+      contour->offset = *offset;
+      contour->listhead = built_listhead;
+      contour->used = user;
+
+      cached_listhead = built_listhead;
+    }
+
+    pthread_mutex_unlock (&cache->lock);
+  }
+
+  gcode_util_get_sublist_snapshot (listhead, cached_listhead, NULL);            // The cached contour is only ever copied, never used up itself;
+
+  if (!cached_listhead)
+    return;
+
+  zero_offset = malloc (sizeof (gcode_offset_t));
+  *zero_offset = *cached_listhead->offset;
+
+  for (index_block = *listhead; index_block; index_block = index_block->next)
+    index_block->offset = zero_offset;
+}
+
+/**
+ * Work out the contours and the pocket (if any) of the pass 'i' of 'job';
+ * POCKETING:
+ *   Implies that sketch section is closed.
+ *   Perform inside pocketing if explicitly set or automatically do:
+ *   - Outside pocket if extrusion is outward
+ *   - Inside pocket if extrusion is inward (same as explicitly set)
+ */
+
+static void
+gcode_sketch_prep_pass (gcode_sketch_job_t *job, int i)
+{
+  gcode_sketch_pass_t *pass;
+  gcode_extrusion_t *extrusion;
+  gfloat_t current_proffset;
+
+  pass = &job->pass[i];
+
+  gcode_sketch_get_contour (&pass->contour, job->block, job->start_block, job->end_block, &pass->offset, job->closed, GCODE_SKETCH_CACHE_MAKE);
+
+  pass->outer = NULL;
+  pass->pocketed = 0;
+
+  if (!job->pocketing)
+    return;
+
+  extrusion = (gcode_extrusion_t *)job->block->extruder->pdata;
+
+  current_proffset = pass->offset.eval;
+
+  switch (extrusion->cut_side)
+  {
+    case GCODE_EXTRUSION_INSIDE:                                                // Inward Taper;
+    {
+      gcode_pocket_init (&pass->pocket, job->block, job->tool);                 // Create a pocket for the contour;
+      gcode_pocket_prep (&pass->pocket, pass->contour, NULL);                   // Create a raster of paths based on the contour;
+
+      pass->pocketed = 1;
+
+      break;
+    }
+
+    case GCODE_EXTRUSION_OUTSIDE:                                               // Outward Taper;
+    {
+      gcode_pocket_t inner_pocket;
+
+      /**
+       *  Pocketing applied automatically to the difference between the
+       *  outer[final z value] offset and inner[current z value] offset.
+       */
+
+      if (fabs (job->maximum_proffset - current_proffset) > GCODE_PRECISION)    // If the current profile offset is equal to the largest profile offset,
+      {                                                                         // there is no need at all for the outer pass, it matches the inner one;
+        gcode_sketch_get_contour (&pass->outer, job->block, job->start_block, job->end_block, &job->outer_offset, job->closed, GCODE_SKETCH_CACHE_MAKE);
+
+        if (fabs (job->maximum_proffset - current_proffset) > job->tool->diameter)      // The thing is, if the current profile offset is less than a tool diameter
+        {                                                                       // away from the maximum profile offset, there is no need to pocket at all;
+          gcode_pocket_init (&inner_pocket, job->block, job->tool);             // Create two pockets, one for the inner contour, one for the outer;
+          gcode_pocket_init (&pass->pocket, job->block, job->tool);
+
+          gcode_pocket_prep (&inner_pocket, pass->contour, NULL);               // Create the inner pocket from the current 'z' depth contour / list;
+          gcode_pocket_prep (&pass->pocket, pass->outer, NULL);                 // Create the outer pocket from the final 'z1' depth contour / list;
+
+          gcode_pocket_subtract (&pass->pocket, &inner_pocket);                 // Subtract the inner pocket from the outer one - what remains gets milled;
+          gcode_pocket_free (&inner_pocket);
+
+          pass->pocketed = 1;
+        }
+      }
+
+      break;
+    }
+  }
+}
+
+/**
+ * Worker thread of 'gcode_sketch_prep_passes': keep taking passes off the shared
+ * counter and work out their contours and pockets;
+ */
+
+static void *
+gcode_sketch_prep_worker (void *data)
+{
+  gcode_sketch_job_t *job;
+  int i;
+
+  job = (gcode_sketch_job_t *)data;
+
+  for (;;)
+  {
+    pthread_mutex_lock (&job->lock);
+    i = job->next_pass++;
+    pthread_mutex_unlock (&job->lock);
+
+    if (i >= job->pass_number)
+      break;
+
+    gcode_sketch_prep_pass (job, i);
+  }
+
+  return (NULL);
+}
+
+/**
+ * Work out the contours and pockets of all passes of 'job' on 'threads' threads
+ * (the calling one included); the passes do not depend on each other at all.
+ */
+
+static void
+gcode_sketch_prep_passes (gcode_sketch_job_t *job, int threads)
+{
+  pthread_t thread[GCODE_MAKE_MAX_THREADS];
+  int i, started;
+
+  job->next_pass = 0;
+
+  pthread_mutex_init (&job->lock, NULL);
+
+  started = 0;
+
+  for (i = 1; i < threads; i++)
+  {
+    if (pthread_create (&thread[started], NULL, gcode_sketch_prep_worker, job) == 0)
+      started++;
+  }
+
+  gcode_sketch_prep_worker (job);
+
+  for (i = 0; i < started; i++)
+    pthread_join (thread[i], NULL);
+
+  pthread_mutex_destroy (&job->lock);
+}
+
 void
 gcode_sketch_init (gcode_block_t **block, gcode_t *gcode, gcode_block_t *parent)
 {
@@ -843,6 +1456,14 @@ gcode_sketch_init (gcode_block_t **block, gcode_t *gcode, gcode_block_t *parent)
   sketch->offset.z[0] = 0.0;
   sketch->offset.z[1] = 0.0;
 
+  sketch->cache.stamp = 0;
+  sketch->cache.sorted_listhead = NULL;
+  sketch->cache.contour = NULL;
+  sketch->cache.contour_number = 0;
+  sketch->cache.contour_alloc = 0;
+
+  pthread_mutex_init (&sketch->cache.lock, NULL);
+
   (*block)->offref = &sketch->offset;
 
   /* Create default extrusion */
@@ -855,8 +1476,16 @@ gcode_sketch_init (gcode_block_t **block, gcode_t *gcode, gcode_block_t *parent)
 void
 gcode_sketch_free (gcode_block_t **block)
 {
+  gcode_sketch_t *sketch;
   gcode_block_t *index_block, *tmp;
 
+  sketch = (gcode_sketch_t *)(*block)->pdata;
+
+  /* Free the cached geometry */
+  gcode_sketch_cache_flush (&sketch->cache);
+  free (sketch->cache.contour);
+  pthread_mutex_destroy (&sketch->cache.lock);
+
   /* Free the extrusion list */
   (*block)->extruder->free (&(*block)->extruder);
 
@@ -870,7 +1499,7 @@ gcode_sketch_free (gcode_block_t **block)
     tmp->free (&tmp);
   }
 
-  free ((*block)->code);
+  GCODE_FREE ((*block));
   free ((*block)->pdata);
   free (*block);
   *block = NULL;
@@ -1094,10 +1723,12 @@ gcode_sketch_make (gcode_block_t *block)
   gcode_block_t *sorted_listhead, *offset_listhead;
   gcode_block_t *start_block, *index_block, *index2_block;
   gcode_vec2d_t p0, p1, e0, e1, t;
+  gcode_sketch_job_t job;
+  gcode_sketch_pass_t *pass;
   gfloat_t z, z0, z1, safe_z, touch_z;
-  gfloat_t current_proffset, maximum_proffset;
   gfloat_t tool_radius, accum_length, path_length, path_drop, length_coef;
   int inside, closed, tapered, helical, initial;
+  int pass_alloc, i;
   char string[256];
 
   GCODE_CLEAR (block);                                                          // Clean up the g-code string of this block to an empty string;
@@ -1118,6 +1749,12 @@ gcode_sketch_make (gcode_block_t *block)
 
   tool_radius = tool->diameter * 0.5;                                           // If a tool was found, obtain its radius;
 
+  job.block = block;                                                            // Set up the job the passes of each sub-chain will be shared out through;
+  job.tool = tool;
+  job.pass = NULL;
+
+  pass_alloc = 0;
+
   GCODE_NEWLINE (block);                                                        // Print some generic info and newlines into the g-code string;
 
   sprintf (string, "SKETCH: %s", block->comment);
@@ -1145,11 +1782,7 @@ gcode_sketch_make (gcode_block_t *block)
     z1 = p0[1];
   }
 
-  index_block = block->listhead;                                                // Start with the first child in the list;
-
-  gcode_util_get_sublist_snapshot (&sorted_listhead, index_block, NULL);        // First off, we need a working snapshot of the entire list ('sorted_listhead')
-  gcode_util_remove_null_sections (&sorted_listhead);                           // We also need to remove any zero-sized features that could screw up the math;
-  gcode_util_merge_list_fragments (&sorted_listhead);                           // But why is it called 'sorted' when it's a straight copy? Oh, that's why...
+  sorted_listhead = gcode_sketch_cache_begin (block, GCODE_SKETCH_CACHE_MAKE);  // Get the sorted snapshot of the children (rebuilt only if they changed);
 
   index_block = sorted_listhead;                                                // Start crawling along the sorted list;
 
@@ -1219,150 +1852,114 @@ gcode_sketch_make (gcode_block_t *block)
 
     GCODE_RETRACT (block, safe_z);                                              // Retract - should already be retracted, but here for safety reasons;
 
-    while (z >= z1)                                                             // Loop within the current sub-chain, creating one pass depth per loop;
-    {
-      GCODE_NEWLINE (block);
-
-      gsprintf (string, block->gcode->decimals, "Pass at depth: %z", z);
-      GCODE_COMMENT (block, string);
-
-      GCODE_NEWLINE (block);
-
-      sketch->offset.origin[0] = block->offset->origin[0];                      // Start by inheriting the offset of the parent; considering the taper's effect
-      sketch->offset.origin[1] = block->offset->origin[1];                      // changes with the depth, we need to re-apply this on every z-pass...
-      sketch->offset.rotation = block->offset->rotation;
+    job.pass_number = 0;
 
-      sketch->offset.origin[0] += sketch->taper_offset[0] * (z0 - z) / (z0 - z1);       // Anyway, the rest of the offset must be applied: the taper offset...
-      sketch->offset.origin[1] += sketch->taper_offset[1] * (z0 - z) / (z0 - z1);
-
-      gcode_extrusion_evaluate_offset (block->extruder, z, &current_proffset);  // ...and the extrusion profile offset calculated for the current z-depth;
-
-      sketch->offset.eval = current_proffset;
-
-      gcode_util_get_sublist_snapshot (&offset_listhead, start_block, index_block);     // Another working snapshot is needed, so we can preserve 'sorted_list';
-      gcode_util_convert_to_no_offset (offset_listhead);                        // Recalculate that snapshot with offsets included & link it to a zero offset;
-      gcode_util_tag_null_size_blocks (offset_listhead);                        // Tag but do not remove anything that BECAME zero-sized by applying the offset;
-
-      gcode_sketch_trim_intersections (offset_listhead, closed);                // Find and trim intersecting primitives back to the intersection point;
-      gcode_sketch_insert_transitions (offset_listhead, closed);                // Add transition arcs wherever connected endpoints were pulled apart;
-
-      gcode_util_remove_tagged_blocks (&offset_listhead);                       // Remove the tagged blocks - they are no longer needed, the contour is done;
-
-      gcode_sketch_check_sharp_points (&offset_listhead, closed);
-
-      /**
-       * POCKETING:
-       *   Implies that sketch section is closed.
-       *   Perform inside pocketing if explicitly set or automatically do:
-       *   - Outside pocket if extrusion is outward
-       *   - Inside pocket if extrusion is inward (same as explicitly set)
-       */
-
-      if (closed && (sketch->pocket || tapered))
+    while (z >= z1)                                                             // Collect the pass depths of the current sub-chain, one pass depth per loop;
+    {
+      if (job.pass_number == pass_alloc)
       {
-        switch (extrusion->cut_side)
-        {
-          case GCODE_EXTRUSION_INSIDE:                                          // Inward Taper;
-          {
-            gcode_pocket_t pocket;
-
-            gcode_pocket_init (&pocket, block, tool);                           // Create a pocket for 'offset_listhead';
-            gcode_pocket_prep (&pocket, offset_listhead, NULL);                 // Create a raster of paths based on the contour;
-            gcode_pocket_make (&pocket, z, touch_z);                            // Create the g-code from the pocket's path list;
-            gcode_pocket_free (&pocket);                                        // Dispose of the no longer needed pocket;
+        pass_alloc = pass_alloc ? 2 * pass_alloc : 16;
+        job.pass = realloc (job.pass, pass_alloc * sizeof (gcode_sketch_pass_t));
+      }
 
-            break;
-          }
+      pass = &job.pass[job.pass_number++];
 
-          case GCODE_EXTRUSION_OUTSIDE:                                         // Outward Taper;
-          {
-            gcode_pocket_t inner_pocket, outer_pocket;
-            gcode_block_t *inner_offset_listhead, *outer_offset_listhead;
+      pass->z = z;
+      pass->offset = sketch->offset;
 
-            /**
-             *  Pocketing applied automatically to the difference between the
-             *  outer[final z value] offset and inner[current z value] offset.
-             */
+      pass->offset.origin[0] = block->offset->origin[0];                        // Start by inheriting the offset of the parent; considering the taper's effect
+      pass->offset.origin[1] = block->offset->origin[1];                        // changes with the depth, we need to re-apply this on every z-pass...
+      pass->offset.rotation = block->offset->rotation;
 
-            inner_offset_listhead = offset_listhead;                            // The main contour becomes the inner island;
+      pass->offset.origin[0] += sketch->taper_offset[0] * (z0 - z) / (z0 - z1); // Anyway, the rest of the offset must be applied: the taper offset...
+      pass->offset.origin[1] += sketch->taper_offset[1] * (z0 - z) / (z0 - z1);
 
-            sketch->offset.origin[0] = block->offset->origin[0];                // We need to construct a whole new contour (with the offset at depth 'z1'),
-            sketch->offset.origin[1] = block->offset->origin[1];                // so have to redo everything we did to get the first list (for depth 'z');
-            sketch->offset.rotation = block->offset->rotation;                  // That means recalculating the offset origin, rotation and eval for 'z1';
+      gcode_extrusion_evaluate_offset (block->extruder, z, &pass->offset.eval); // ...and the extrusion profile offset calculated for the current z-depth;
 
-            sketch->offset.origin[0] += sketch->taper_offset[0];                // Anyway, the reason we can freely mess up the offset of the sketch is that
-            sketch->offset.origin[1] += sketch->taper_offset[1];                // it is already applied for this round and will be recalculated in the next;
+      if (z - z1 > extrusion->resolution)                                       // Go one level deeper if the remaining depth is larger than one depth step;
+        z = z - extrusion->resolution;
+      else if (z - z1 > GCODE_PRECISION)                                        // If it's less but still a significant amount, go to the final z1 instead;
+        z = z1;
+      else                                                                      // If the depth of the last pass is already indistinguishable from z1, quit;
+        break;
+    }
 
-            gcode_extrusion_evaluate_offset (block->extruder, z1, &maximum_proffset);
+    job.start_block = start_block;
+    job.end_block = index_block;
+    job.closed = closed;
+    job.pocketing = (closed && (sketch->pocket || tapered)) ? 1 : 0;
 
-            sketch->offset.eval = maximum_proffset;
+    if (job.pocketing && extrusion->cut_side == GCODE_EXTRUSION_OUTSIDE)        // An outward taper pockets out to the contour at depth 'z1' on every pass;
+    {
+      job.outer_offset = sketch->offset;
 
-            if (fabs (maximum_proffset - current_proffset) > GCODE_PRECISION)   // If the current profile offset is equal to the largest profile offset,
-            {                                                                   // there is no need at all for the outer pass, it matches the inner one;
-              gcode_util_get_sublist_snapshot (&outer_offset_listhead, start_block, index_block);       // Once the offset is ready, create another working snapshot;
-              gcode_util_convert_to_no_offset (outer_offset_listhead);          // Recalculate the snapshot with the new 'z1' offsets included & a zero offset;
-              gcode_util_tag_null_size_blocks (outer_offset_listhead);          // Tag but do not remove anything that BECAME zero-sized by applying the offset;
+      job.outer_offset.origin[0] = block->offset->origin[0] + sketch->taper_offset[0];
+      job.outer_offset.origin[1] = block->offset->origin[1] + sketch->taper_offset[1];
+      job.outer_offset.rotation = block->offset->rotation;
 
-              gcode_sketch_trim_intersections (outer_offset_listhead, closed);  // Find and trim intersecting primitives back to the intersection point;
-              gcode_sketch_insert_transitions (outer_offset_listhead, closed);  // Add transition arcs wherever connected endpoints were pulled apart;
+      gcode_extrusion_evaluate_offset (block->extruder, z1, &job.maximum_proffset);
 
-              gcode_util_remove_tagged_blocks (&outer_offset_listhead);         // Remove the tagged blocks - they are no longer needed, the contour is done;
+      job.outer_offset.eval = job.maximum_proffset;
+    }
 
-              gcode_sketch_check_sharp_points (&outer_offset_listhead, closed);
+    gcode_sketch_prep_passes (&job, gcode_make_threads (block->gcode, job.pass_number));        // Work out the contours & pockets of all the passes at once,
 
-              if (fabs (maximum_proffset - current_proffset) > tool->diameter)  // The thing is, if the current profile offset is less than a tool diameter
-              {                                                                 // away from the maximum profile offset, there is no need to pocket at all;
-                gcode_pocket_init (&inner_pocket, block, tool);                 // Create two pockets, one for the inner contour, one for the outer;
-                gcode_pocket_init (&outer_pocket, block, tool);
+    for (i = 0; i < job.pass_number; i++)                                       // then make the g-code of the passes one by one, in order of depth;
+    {
+      pass = &job.pass[i];
 
-                gcode_pocket_prep (&inner_pocket, inner_offset_listhead, NULL); // Create the inner pocket from the current 'z' depth contour / list;
-                gcode_pocket_prep (&outer_pocket, outer_offset_listhead, NULL); // Create the outer pocket from the final 'z1' depth contour / list;
+      z = pass->z;
 
-                gcode_pocket_subtract (&outer_pocket, &inner_pocket);           // Subtract the inner pocket from the outer one,
-                gcode_pocket_make (&outer_pocket, z, touch_z);                  // and create the g-code resulting from what remains;
+      GCODE_NEWLINE (block);
 
-                gcode_pocket_free (&inner_pocket);                              // The two pockets are no longer needed and can be disposed of;
-                gcode_pocket_free (&outer_pocket);
-              }
+      gsprintf (string, block->gcode->decimals, "Pass at depth: %z", z);
+      GCODE_COMMENT (block, string);
 
-              gcode_sketch_flip_direction (&outer_offset_listhead);             // Flip the outer contour in order to match the milling mode of the inner one;
+      GCODE_NEWLINE (block);
 
-              outer_offset_listhead->ends (outer_offset_listhead, e0, e1, GCODE_GET_WITH_OFFSET);
+      if (pass->pocketed)
+      {
+        gcode_pocket_make (&pass->pocket, z, touch_z);                          // Create the g-code from the pocket's path list;
+        gcode_pocket_free (&pass->pocket);                                      // Dispose of the no longer needed pocket;
+      }
 
-              GCODE_NEWLINE (block);
+      if (pass->outer)
+      {
+        gcode_sketch_flip_direction (&pass->outer);                             // Flip the outer contour in order to match the milling mode of the inner one;
 
-              GCODE_COMMENT (block, "Secondary Contour Milling Phase");
+        pass->outer->ends (pass->outer, e0, e1, GCODE_GET_WITH_OFFSET);
 
-              GCODE_NEWLINE (block);
+        GCODE_NEWLINE (block);
 
-              GCODE_MOVE_TO (block, e0[0], e0[1], z, safe_z, touch_z, tool, "start of contour");
+        GCODE_COMMENT (block, "Secondary Contour Milling Phase");
 
-              index2_block = outer_offset_listhead;
+        GCODE_NEWLINE (block);
 
-              while (index2_block)
-              {
-                index2_block->offset->z[0] = z;
-                index2_block->offset->z[1] = z;
+        GCODE_MOVE_TO (block, e0[0], e0[1], z, safe_z, touch_z, tool, "start of contour");
 
-                index2_block->make (index2_block);
-                GCODE_APPEND (block, index2_block->code);
+        index2_block = pass->outer;
 
-                index2_block = index2_block->next;
-              }
+        while (index2_block)
+        {
+          index2_block->offset->z[0] = z;
+          index2_block->offset->z[1] = z;
 
-              free (outer_offset_listhead->offset);                             // The specially created zero-offset of the list is no longer needed;
-              gcode_list_free (&outer_offset_listhead);                         // The pocket is done, we can get rid of the 'outer' / 'z1' list as well;
-            }
+          index2_block->make (index2_block);
+          GCODE_SPLICE (block, index2_block);
 
-            break;
-          }
+          index2_block = index2_block->next;
         }
+
+        free (pass->outer->offset);                                             // The specially created zero-offset of the list is no longer needed;
+        gcode_list_free (&pass->outer);                                         // The pocket is done, we can get rid of the 'outer' / 'z1' list as well;
       }
 
       /**
        * Pocketing is complete, get in position for the contour pass
        */
 
+      offset_listhead = pass->contour;
+
       offset_listhead->ends (offset_listhead, e0, e1, GCODE_GET_WITH_OFFSET);   // Find again the starting point of the first block;
 
       GCODE_NEWLINE (block);
@@ -1406,7 +2003,7 @@ gcode_sketch_make (gcode_block_t *block)
         }
 
         index2_block->make (index2_block);                                      // FINALLY! Just make that darned block and be done with it...
-        GCODE_APPEND (block, index2_block->code);
+        GCODE_SPLICE (block, index2_block);
 
         index2_block = index2_block->next;                                      // ...well, not before we do the same thing for each of them.
       }
@@ -1416,13 +2013,6 @@ gcode_sketch_make (gcode_block_t *block)
 
       initial = 0;                                                              // Further passes are not the 'first pass' any more;
       touch_z = z;                                                              // The current z depth is now the new boundary between air and material;
-
-      if (z - z1 > extrusion->resolution)                                       // Go one level deeper if the remaining depth is larger than one depth step;
-        z = z - extrusion->resolution;
-      else if (z - z1 > GCODE_PRECISION)                                        // If it's less but still a significant amount, go to the final z1 instead;
-        z = z1;
-      else                                                                      // If the depth of the last pass is already indistinguishable from z1, quit;
-        break;
     }
 
     index_block = index_block->next;                                            // Move on to the next sub-chain: continue with the first 'unconnected' block;
@@ -1430,7 +2020,9 @@ gcode_sketch_make (gcode_block_t *block)
 
   GCODE_RETRACT (block, safe_z);                                                // The entire sketch has been milled - raise to traverse height;
 
-  gcode_list_free (&sorted_listhead);                                           // Once the sketch is done, get rid of the sorted list;
+  gcode_sketch_cache_end (block);                                               // Once the sketch is done, drop the contours no longer needed;
+
+  free (job.pass);                                                              // and of the pass array as well;
 
   sketch->offset.side = 0.0;
   sketch->offset.tool = 0.0;
@@ -1489,11 +2081,7 @@ gcode_sketch_draw (gcode_block_t *block, gcode_block_t *selected)
 
   edited = (index_block == block) ? TRUE : FALSE;                               // We need that information later, but by then 'index_block' will be in use.
 
-  index_block = block->listhead;                                                // Start with the first child in the list;
-
-  gcode_util_get_sublist_snapshot (&sorted_listhead, index_block, NULL);        // First off, we need a working snapshot of the entire list ('sorted_listhead')
-  gcode_util_remove_null_sections (&sorted_listhead);                           // We also need to remove any zero-sized features that could screw up the math;
-  gcode_util_merge_list_fragments (&sorted_listhead);                           // But why is it called 'sorted' when it's a straight copy? Oh, that's why...
+  sorted_listhead = gcode_sketch_cache_begin (block, GCODE_SKETCH_CACHE_DRAW);  // Get the sorted snapshot of the children (rebuilt only if they changed);
 
   index_block = sorted_listhead;                                                // Start crawling along the sorted list;
 
@@ -1595,16 +2183,8 @@ gcode_sketch_draw (gcode_block_t *block, gcode_block_t *selected)
 
         gcode_extrusion_evaluate_offset (block->extruder, z, &sketch->offset.eval);     // ...and the extrusion profile offset calculated for the current z-depth;
 
-        gcode_util_get_sublist_snapshot (&offset_listhead, start_block, index_block);   // Another working snapshot is needed, so we can preserve 'sorted_list';
-        gcode_util_convert_to_no_offset (offset_listhead);                      // Recalculate that snapshot with offsets included & link it to a zero offset;
-        gcode_util_tag_null_size_blocks (offset_listhead);                      // Tag but do not remove anything that BECAME zero-sized by applying the offset;
-
-        gcode_sketch_trim_intersections (offset_listhead, closed);              // Find and trim intersecting primitives back to the intersection point;
-        gcode_sketch_insert_transitions (offset_listhead, closed);              // Add transition arcs wherever connected endpoints were pulled apart;
+        gcode_sketch_get_contour (&offset_listhead, block, start_block, index_block, &sketch->offset, closed, GCODE_SKETCH_CACHE_DRAW);
 
-        gcode_util_remove_tagged_blocks (&offset_listhead);                     // Remove the tagged blocks - they are no longer needed, the contour is done;
-
-        gcode_sketch_check_sharp_points (&offset_listhead, closed);
         gcode_sketch_add_up_path_length (offset_listhead, &path_length);        // Calculate the full path length for use in helical z-depth calculations;
 
         accum_length = 0.0;                                                     // Start logging distance along the path for helical z-depth calculations;
@@ -1653,7 +2233,7 @@ gcode_sketch_draw (gcode_block_t *block, gcode_block_t *selected)
     index_block = index_block->next;                                            // Move on to the next sub-chain: continue with the first 'unconnected' block;
   }
 
-  gcode_list_free (&sorted_listhead);                                           // The entire sketch has been drawn - get rid of the sorted list;
+  gcode_sketch_cache_end (block);                                               // The entire sketch has been drawn - drop the contours no longer needed;
 
   sketch->offset.side = 0.0;                                                    // Not of any importance strictly speaking (anywhere these actually matter they
   sketch->offset.tool = 0.0;                                                    // should be re-initialized appropriately anyway), but hey - let's play nice...
@@ -1871,6 +2451,8 @@ gcode_sketch_clone (gcode_block_t **block, gcode_t *gcode, gcode_block_t *model)
   sketch->pocket = model_sketch->pocket;
   sketch->zero_pass = model_sketch->zero_pass;
 
+  (*block)->extruder->free (&(*block)->extruder);                               // Scrap the default extruder 'init' came up with, the clone replaces it
+
   model->extruder->clone (&new_block, gcode, model->extruder);                  // Acquire a clone of the model's extruder, referenced as 'new_block'
 
   gcode_attach_as_extruder (*block, new_block);                                 // Attach the brand new extrusion clone as the extruder of this block
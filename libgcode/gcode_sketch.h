@@ -25,6 +25,8 @@
 
 #include "gcode_util.h"
 #include "gcode_internal.h"
+#include "gcode_pocket.h"
+#include <pthread.h>
 
 #define GCODE_BIN_DATA_SKETCH_EXTRUSION     0x00
 #define GCODE_BIN_DATA_SKETCH_NUMBER        0x01
@@ -38,6 +40,38 @@ static const char *GCODE_XML_ATTR_SKETCH_POCKET = "pocket";
 static const char *GCODE_XML_ATTR_SKETCH_ZERO_PASS = "zero-pass";
 static const char *GCODE_XML_ATTR_SKETCH_HELICAL = "helical";
 
+#define GCODE_SKETCH_CACHE_MAKE             0x01
+#define GCODE_SKETCH_CACHE_DRAW             0x02
+
+/**
+ * A contour of one sub-chain of the sketch as built with 'offset' (the 'z' depths
+ * do not matter), kept for as long as the latest make or draw still needs it.
+ */
+
+typedef struct gcode_sketch_contour_s
+{
+  gcode_block_t *chain;                                                         /* first block of the sub-chain, in 'sorted_listhead' */
+  gcode_offset_t offset;
+  gcode_block_t *listhead;
+  uint8_t used;                                                                 /* GCODE_SKETCH_CACHE_MAKE / _DRAW */
+} gcode_sketch_contour_t;
+
+/**
+ * The geometry 'make' and 'draw' share: the sorted snapshot of the children and
+ * the contours built from it, all valid as long as the children do not change
+ * (which 'stamp', the fingerprint of their geometry, is there to tell).
+ */
+
+typedef struct gcode_sketch_cache_s
+{
+  uint64_t stamp;
+  gcode_block_t *sorted_listhead;
+  gcode_sketch_contour_t *contour;
+  int contour_number;
+  int contour_alloc;
+  pthread_mutex_t lock;                                                         /* protects the contour array */
+} gcode_sketch_cache_t;
+
 typedef struct gcode_sketch_s
 {
   gcode_offset_t offset;
@@ -45,8 +79,47 @@ typedef struct gcode_sketch_s
   uint8_t pocket;
   uint8_t zero_pass;
   uint8_t helical;
+  gcode_sketch_cache_t cache;
 } gcode_sketch_t;
 
+/**
+ * One depth pass of a sketch sub-chain: the contour milled at depth 'z' and, if
+ * the extrusion calls for pocketing, the pocket cleared before it - for outward
+ * tapers, that is the area between 'contour' and 'outer', the final contour.
+ */
+
+typedef struct gcode_sketch_pass_s
+{
+  gfloat_t z;
+  gcode_offset_t offset;                                                        /* sketch offset at depth 'z' */
+  gcode_block_t *contour;
+  gcode_block_t *outer;                                                         /* outward taper only, otherwise NULL */
+  gcode_pocket_t pocket;
+  uint8_t pocketed;                                                             /* set if 'pocket' is prepared */
+} gcode_sketch_pass_t;
+
+/**
+ * The passes of one sub-chain shared out among the threads of 'gcode_sketch_make';
+ * each pass gets its contours and pocket worked out on its own, the g-code then
+ * gets made from them one pass after the other, in order of depth.
+ */
+
+typedef struct gcode_sketch_job_s
+{
+  gcode_block_t *block;                                                         /* the sketch being made */
+  gcode_block_t *start_block;                                                   /* first block of the sub-chain */
+  gcode_block_t *end_block;                                                     /* last block of the sub-chain */
+  gcode_tool_t *tool;
+  gcode_sketch_pass_t *pass;                                                    /* passes, in order of depth */
+  gcode_offset_t outer_offset;                                                  /* sketch offset at the final depth */
+  gfloat_t maximum_proffset;
+  pthread_mutex_t lock;                                                         /* protects next_pass */
+  int closed;
+  int pocketing;
+  int pass_number;
+  int next_pass;
+} gcode_sketch_job_t;
+
 void gcode_sketch_init (gcode_block_t **block, gcode_t *gcode, gcode_block_t *parent);
 void gcode_sketch_free (gcode_block_t **block);
 void gcode_sketch_save (gcode_block_t *block, FILE *fh);
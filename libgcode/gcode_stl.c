@@ -85,7 +85,7 @@ gcode_stl_free (gcode_block_t **block)
   free (stl->slice_list);
   free (stl->tri_list);
 
-  free ((*block)->code);
+  GCODE_FREE ((*block));
   free ((*block)->pdata);
   free (*block);
   *block = NULL;
@@ -445,6 +445,81 @@ gcode_svg_create_cubic_bezier (void *context, double pt0[], double pt1[], double
   return (items);
 }
 
+/**
+ * Read the coordinates of up to three points off 'string' (as many as are not
+ * NULL), the same as sscanf ("%lf %lf %lf %lf ...") would in the "C" locale;
+ * returns the number of coordinates read.
+ */
+
+static int
+gcode_svg_scan_points (char *string, double *point1, double *point2, double *point3)
+{
+  double *point[3] = { point1, point2, point3 };
+  int i, j, items;
+  double number;
+  char *end;
+
+  items = 0;
+
+  for (i = 0; i < 3 && point[i]; i++)
+  {
+    for (j = 0; j < 2; j++, items++)
+    {
+      number = gstrtod (string, &end);
+
+      if (end == string)
+        return (items);
+
+      point[i][j] = number;
+      string = end;
+    }
+  }
+
+  return (items);
+}
+
+/**
+ * Read the 7 values of an arc command off 'string', the same as sscanf ("%lf
+ * %lf %lf %i %i %lf %lf") would in the "C" locale; returns the number read.
+ */
+
+static int
+gcode_svg_scan_arc (char *string, double *rx, double *ry, double *phi, int *fla, int *fls, double *point)
+{
+  double *value[3] = { rx, ry, phi };
+  int *flag[2] = { fla, fls };
+  int i, items;
+  double number;
+  long integer;
+  char *end;
+
+  items = 0;
+
+  for (i = 0; i < 3; i++, items++)
+  {
+    number = gstrtod (string, &end);
+
+    if (end == string)
+      return (items);
+
+    *value[i] = number;
+    string = end;
+  }
+
+  for (i = 0; i < 2; i++, items++)
+  {
+    integer = strtol (string, &end, 0);
+
+    if (end == string)
+      return (items);
+
+    *flag[i] = (int)integer;
+    string = end;
+  }
+
+  return (items + gscan (string, point, 2));
+}
+
 /**
  * Thanks to neither atof() nor sscanf() being willing to disclose WHERE EXACTLY
  * they stopped parsing the string they work on, we need some other way to tell
@@ -990,7 +1065,7 @@ svg_start (void *context, const char *tag, const char **attr)
     {
       if (strcmp (attr[i], SVG_XML_ATTR_WIDTH) == 0)                            // Found a "width" attribute;
       {
-        svg->size[0] = atof (attr[i + 1]);                                      // Try converting it: failure equals "0" returned - no harm there;
+        svg->size[0] = gstrtod (attr[i + 1], NULL);                             // Try converting it: failure equals "0" returned - no harm there;
 
         if (svg->size[0])                                                       // If the numeric conversion failed, the rest would be pointless;
         {
@@ -1027,7 +1102,7 @@ svg_start (void *context, const char *tag, const char **attr)
       }
       else if (strcmp (attr[i], SVG_XML_ATTR_HEIGHT) == 0)                      // Found a "height" attribute;
       {
-        svg->size[1] = atof (attr[i + 1]);                                      // Try converting it: failure equals "0" returned - no harm there;
+        svg->size[1] = gstrtod (attr[i + 1], NULL);                             // Try converting it: failure equals "0" returned - no harm there;
 
         if (svg->size[1])                                                       // If the numeric conversion failed, the rest would be pointless;
         {
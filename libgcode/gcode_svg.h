@@ -88,18 +88,18 @@ static const char *SVG_PATH_COMMANDS = "MmLlHhVvAaQqTtCcSsZz";
 int gcode_svg_import (gcode_block_t *template_block, char *filename);
 
 #define SVG_PARSE_1X_VALUE(_value, _string) \
-        (sscanf (_string, "%lf", &_value) == 1)
+        (gscan (_string, &_value, 1) == 1)
 
 #define SVG_PARSE_1X_POINT(_point, _string) \
-        (sscanf (_string, "%lf %lf", &_point[0], &_point[1]) == 2)
+        (gscan (_string, _point, 2) == 2)
 
 #define SVG_PARSE_2X_POINT(_point1, _point2, _string) \
-        (sscanf (_string, "%lf %lf %lf %lf", &_point1[0], &_point1[1], &_point2[0], &_point2[1]) == 4)
+        (gcode_svg_scan_points (_string, _point1, _point2, NULL) == 4)
 
 #define SVG_PARSE_3X_POINT(_point1, _point2, _point3, _string) \
-        (sscanf (_string, "%lf %lf %lf %lf %lf %lf", &_point1[0], &_point1[1], &_point2[0], &_point2[1], &_point3[0], &_point3[1]) == 6)
+        (gcode_svg_scan_points (_string, _point1, _point2, _point3) == 6)
 
 #define SVG_PARSE_ARC_DATA(_value1, _value2, _value3, _flag1, _flag2, _point, _string) \
-        (sscanf (_string, "%lf %lf %lf %i %i %lf %lf", &_value1, &_value2, &_value3, &_flag1, &_flag2, &_point[0], &_point[1]) == 7)
+        (gcode_svg_scan_arc (_string, &_value1, &_value2, &_value3, &_flag1, &_flag2, _point) == 7)
 
 #endif
@@ -90,7 +90,7 @@ gcode_template_free (gcode_block_t **block)
     tmp->free (&tmp);
   }
 
-  free ((*block)->code);
+  GCODE_FREE ((*block));
   free ((*block)->pdata);
   free (*block);
   *block = NULL;
@@ -319,7 +319,7 @@ gcode_template_make (gcode_block_t *block)
   {
     index_block->make (index_block);
 
-    GCODE_APPEND (block, index_block->code);
+    GCODE_SPLICE (block, index_block);
 
     index_block = index_block->next;
   }
@@ -73,7 +73,7 @@ gcode_tool_init (gcode_block_t **block, gcode_t *gcode, gcode_block_t *parent)
 void
 gcode_tool_free (gcode_block_t **block)
 {
-  free ((*block)->code);
+  GCODE_FREE ((*block));
   free ((*block)->pdata);
   free (*block);
   *block = NULL;
@@ -230,7 +230,7 @@ gcode_tool_make (gcode_block_t *block)
   sprintf (string, "Selected Tool: %s", tool->label);
   GCODE_COMMENT (block, string);
 
-  sprintf (string, "Tool Diameter: %f", tool->diameter);
+  gsprintf (string, block->gcode->decimals, "Tool Diameter: %.6f", tool->diameter);
   GCODE_COMMENT (block, string);
 
   if (tool->prompt)
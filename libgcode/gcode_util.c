@@ -155,33 +155,6 @@ gcode_util_remove_comment (char *string)
   string[i] = '\0';
 }
 
-void
-gcode_util_filter_newlines (char *string)
-{
-  uint32_t i, j;
-
-  i = j = 0;
-
-  while (string[j] != '\0')                                                     // Only loop as long as string[j] is not the terminating null;
-  {                                                                             // If so, string[j+1] must still be part of the string, null included;
-    if ((string[j] == '\n') && (string[j + 1] == '\n'))                         // If both string[j] and string[j+1] are newlines, are there more?
-    {                                                                           // If so, string[j+2] must ALSO be part of the string, null included;
-      while (string[j + 2] == '\n')                                             // That means we may test it, and as long as there are further newlines
-        j++;                                                                    // past the first two, we keep dropping chars - that means when we stop
-    }                                                                           // skipping there will be exactly two newlines left to copy, not more;
-
-    if (j > i)
-    {
-      string[i] = string[j];
-    }
-
-    i++;
-    j++;
-  }
-
-  string[i] = '\0';
-}
-
 void
 gcode_util_remove_duplicate_scalars (gfloat_t *array, uint32_t *num)
 {
@@ -1173,6 +1146,128 @@ gcode_util_remove_null_sections (gcode_block_t **listhead)
   return (0);
 }
 
+/**
+ * A spatial hash of the endpoints of a block list: every endpoint is filed by
+ * the cell of a GCODE_TOLERANCE-sized grid it falls in, so all endpoints that
+ * may be within tolerance of a point are in the 3 x 3 cells around its own;
+ * blocks are known by their position in the list, endpoint 'k' of block 'i'
+ * being entry '2 * i + k';
+ */
+
+typedef struct gcode_util_end_entry_s
+{
+  int64_t cell[2];
+  int32_t next;                                                                 // Next entry in the same bucket, or -1
+} gcode_util_end_entry_t;
+
+typedef struct gcode_util_end_map_s
+{
+  uint32_t mask;                                                                // Number of buckets minus one (a power of two minus one)
+  int32_t *bucket;                                                              // First entry in each bucket, or -1
+  gcode_util_end_entry_t *entry;
+  gcode_vec2d_t *end;                                                           // The endpoints themselves, two per block
+  uint8_t *used;                                                                // Blocks already taken out of the search
+} gcode_util_end_map_t;
+
+static void
+gcode_util_end_cell (gcode_vec2d_t point, int64_t cell[2])
+{
+  gfloat_t c;
+  int i;
+
+  for (i = 0; i < 2; i++)
+  {
+    c = floor (point[i] / GCODE_TOLERANCE);
+
+    cell[i] = (fabs (c) < 1e15) ? (int64_t)c : 0;                               // Also takes care of NaN-s (those never match anything anyway);
+  }
+}
+
+static uint32_t
+gcode_util_end_bucket (gcode_util_end_map_t *map, int64_t x, int64_t y)
+{
+  uint64_t h;
+
+  h = (uint64_t)x * 0x9E3779B97F4A7C15ULL ^ (uint64_t)y * 0xC2B2AE3D27D4EB4FULL;
+
+  return ((uint32_t)(h ^ (h >> 32)) & map->mask);
+}
+
+static void
+gcode_util_end_map_init (gcode_util_end_map_t *map, gcode_vec2d_t *end, uint32_t count)
+{
+  uint32_t i, b;
+
+  map->mask = 1;
+
+  while (map->mask < 2 * count)
+    map->mask <<= 1;
+
+  map->bucket = malloc (map->mask * sizeof (int32_t));
+  map->entry = malloc (2 * count * sizeof (gcode_util_end_entry_t));
+  map->used = calloc (count, sizeof (uint8_t));
+  map->end = end;
+
+  map->mask--;
+
+  memset (map->bucket, 0xFF, (map->mask + 1) * sizeof (int32_t));
+
+  for (i = 0; i < 2 * count; i++)
+  {
+    gcode_util_end_cell (end[i], map->entry[i].cell);
+
+    b = gcode_util_end_bucket (map, map->entry[i].cell[0], map->entry[i].cell[1]);
+
+    map->entry[i].next = map->bucket[b];
+    map->bucket[b] = i;
+  }
+}
+
+static void
+gcode_util_end_map_free (gcode_util_end_map_t *map)
+{
+  free (map->bucket);
+  free (map->entry);
+  free (map->used);
+}
+
+/**
+ * Return the position of the first block not yet used that has an endpoint
+ * within tolerance of 'point', if it comes before 'best' - or 'best' if not;
+ */
+
+static uint32_t
+gcode_util_end_map_match (gcode_util_end_map_t *map, gcode_vec2d_t point, uint32_t best)
+{
+  int64_t cell[2];
+  int32_t e;
+  int dx, dy;
+
+  gcode_util_end_cell (point, cell);
+
+  for (dy = -1; dy <= 1; dy++)
+  {
+    for (dx = -1; dx <= 1; dx++)
+    {
+      e = map->bucket[gcode_util_end_bucket (map, cell[0] + dx, cell[1] + dy)];
+
+      for (; e >= 0; e = map->entry[e].next)
+      {
+        if ((uint32_t)e / 2 >= best || map->used[e / 2])
+          continue;
+
+        if (map->entry[e].cell[0] != cell[0] + dx || map->entry[e].cell[1] != cell[1] + dy)
+          continue;
+
+        if (GCODE_MATH_2D_DISTANCE (map->end[e], point) < GCODE_TOLERANCE)
+          best = e / 2;
+      }
+    }
+  }
+
+  return (best);
+}
+
 /**
  * Rearrange and/or flip the blocks in the list that starts with 'listhead' in a
  * way that results in the longest contiguous fragments possible, then return 1
@@ -1182,18 +1277,21 @@ gcode_util_remove_null_sections (gcode_block_t **listhead)
  * the original direction the majority of the blocks in the list are facing in;
  * NOTE: this will return 1 even if multiple unconnected fragments are found, as
  * long as each one is closed;
- * NOTE: although practical observed performance (speed) of this function seems
- * quite adequate in ordinary conditions, it could slow down significantly for
- * inconveniently ordered large lists; the best bet to avoid that is keeping
- * lists correctly ordered in the first place thereby reducing the amount of
- * processing involved from quadratic to linear in relation to list size;
+ * NOTE: the blocks not yet placed keep their original order in the list, so
+ * instead of crawling along them in search of the first one that connects to
+ * either edge, their endpoints are looked up in a spatial hash - the lowest of
+ * their original positions that does connect being the one a crawl would find;
  */
 
 int
 gcode_util_merge_list_fragments (gcode_block_t **listhead)
 {
   gcode_block_t *prev_edge_block, *next_edge_block, *index_block;
+  gcode_block_t **block_array;
   gcode_vec2d_t e, pe, ne, e0, e1;
+  gcode_vec2d_t *end_array;
+  gcode_util_end_map_t map;
+  uint32_t block_number, first_unused, match;
   int closed, block_count, flip_count, break_count;
 
   if (!(*listhead))                                                             // Nothing to sort at all...? Oh great - we're done!
@@ -1209,6 +1307,31 @@ gcode_util_merge_list_fragments (gcode_block_t **listhead)
       return (0);
   }
 
+  block_number = 0;
+
+  for (index_block = *listhead; index_block; index_block = index_block->next)
+    block_number++;
+
+  block_array = malloc (block_number * sizeof (gcode_block_t *));
+  end_array = malloc (2 * block_number * sizeof (gcode_vec2d_t));
+
+  block_number = 0;
+
+  for (index_block = *listhead; index_block; index_block = index_block->next)   // Note every block with its endpoints by its position in the list;
+  {
+    block_array[block_number] = index_block;
+
+    index_block->ends (index_block, end_array[2 * block_number], end_array[2 * block_number + 1], GCODE_GET);
+
+    block_number++;
+  }
+
+  gcode_util_end_map_init (&map, end_array, block_number);
+
+  map.used[0] = 1;                                                              // The first block is where the first fragment starts;
+
+  first_unused = 0;
+
   closed = 1;                                                                   // Okay, crunch time; the list is 'closed' until proven guil... erm, 'open'.
 
   block_count = 1;                                                              // Block count starts from 1 because the loop runs 'n-1' times, not 'n';
@@ -1223,11 +1346,19 @@ gcode_util_merge_list_fragments (gcode_block_t **listhead)
     prev_edge_block->ends (prev_edge_block, pe, e, GCODE_GET);                  // Get hold of the edge endpoints of the current fragment, as 'pe' and 'ne';
     next_edge_block->ends (next_edge_block, e, ne, GCODE_GET);
 
-    index_block = next_edge_block->next;                                        // Start looking for match candidates starting right after the sorted edge;
+    match = gcode_util_end_map_match (&map, ne, block_number);                  // Look up the first block still unplaced that connects to either edge;
+    match = gcode_util_end_map_match (&map, pe, match);
 
-    while (index_block)                                                         // Keep looping (and looking for matches) until the list ends;
+    index_block = NULL;
+
+    if (match < block_number)
     {
-      index_block->ends (index_block, e0, e1, GCODE_GET);                       // Obtain the two endpoints of the current block, as 'e0' and 'e1';
+      index_block = block_array[match];
+
+      map.used[match] = 1;
+
+      GCODE_MATH_VEC2D_COPY (e0, end_array[2 * match]);                         // Its endpoints are still the ones it had when the map got built,
+      GCODE_MATH_VEC2D_COPY (e1, end_array[2 * match + 1]);                     // as only blocks already placed ever get flipped;
 
       if (GCODE_MATH_2D_DISTANCE (e0, ne) < GCODE_TOLERANCE)                    // If the current block fits right after the current 'next' edge...
       {
@@ -1235,11 +1366,8 @@ gcode_util_merge_list_fragments (gcode_block_t **listhead)
           gcode_place_block_behind (next_edge_block, index_block);              // MAKE IT be the block next to the edge (slide it within the list);
 
         next_edge_block = index_block;                                          // Once that's done, this block becomes the new edge;
-
-        break;                                                                  // Since a match was found, abandon the search and move on to the next block;
       }
-
-      if (GCODE_MATH_2D_DISTANCE (e1, ne) < GCODE_TOLERANCE)                    // If the current block would fit after the current 'next' edge IF FLIPPED...
+      else if (GCODE_MATH_2D_DISTANCE (e1, ne) < GCODE_TOLERANCE)               // If the current block would fit after the current 'next' edge IF FLIPPED...
       {
         flip_count++;                                                           // ...do just that: flip it - but count each time a block gets flipped;
 
@@ -1249,21 +1377,15 @@ gcode_util_merge_list_fragments (gcode_block_t **listhead)
           gcode_place_block_behind (next_edge_block, index_block);              // MAKE IT be the block next to the edge (slide it within the list);
 
         next_edge_block = index_block;                                          // Once that's done, this block becomes the new edge;
-
-        break;                                                                  // Since a match was found, abandon the search and move on to the next block;
       }
-
-      if (GCODE_MATH_2D_DISTANCE (e1, pe) < GCODE_TOLERANCE)                    // If the current block fits right before the current 'prev' edge...
+      else if (GCODE_MATH_2D_DISTANCE (e1, pe) < GCODE_TOLERANCE)               // If the current block fits right before the current 'prev' edge...
       {
         if (prev_edge_block->prev != index_block)                               // ...but it's not actually the block next to it,
           gcode_place_block_before (prev_edge_block, index_block);              // MAKE IT be the block next to the edge (slide it within the list);
 
         prev_edge_block = index_block;                                          // Once that's done, this block becomes the new edge;
-
-        break;                                                                  // Since a match was found, abandon the search and move on to the next block;
       }
-
-      if (GCODE_MATH_2D_DISTANCE (e0, pe) < GCODE_TOLERANCE)                    // If the current block would fit before the current 'prev' edge IF FLIPPED...
+      else                                                                      // Otherwise it can only fit before the current 'prev' edge IF FLIPPED...
       {
         flip_count++;                                                           // ...do just that: flip it - but count each time a block gets flipped;
 
@@ -1273,11 +1395,7 @@ gcode_util_merge_list_fragments (gcode_block_t **listhead)
           gcode_place_block_before (prev_edge_block, index_block);              // MAKE IT be the block next to the edge (slide it within the list);
 
         prev_edge_block = index_block;                                          // Once that's done, this block becomes the new edge;
-
-        break;
       }
-
-      index_block = index_block->next;                                          // If there's no way the current block fits anywhere, try the next one;
     }
 
     if (!index_block)                                                           // If 'index_block' got to become NULL, we ran out of blocks without a match;
@@ -1289,11 +1407,21 @@ gcode_util_merge_list_fragments (gcode_block_t **listhead)
 
       next_edge_block = next_edge_block->next;                                  // Either way, start a new fragment by appointing the first block
       prev_edge_block = next_edge_block;                                        // past the 'next' edge as both the new 'prev' and 'next' edge;
+
+      while (map.used[first_unused])                                            // That is the first block still unplaced, which is now placed;
+        first_unused++;
+
+      map.used[first_unused] = 1;
     }
 
     block_count++;                                                              // And while we're at it, remember to count the number of blocks in the list;
   }
 
+  gcode_util_end_map_free (&map);
+
+  free (end_array);
+  free (block_array);
+
   /* The list is now sorted into as few fragments as possible */
 
   prev_edge_block->ends (prev_edge_block, pe, e, GCODE_GET);                    // The sorting is done, but the last fragment was not yet checked for closure;
@@ -1431,3 +1559,257 @@ gcode_util_convert_to_no_offset (gcode_block_t *listhead)
 
   return (0);
 }
+
+/**
+ * Return 1 if points 'first' to 'last' of 'point' all lie within 'tolerance' of
+ * the straight line from the first to the last, in that order, or 0 otherwise;
+ */
+
+static int
+gcode_util_fit_line (gcode_vec2d_t *point, int first, int last, gfloat_t tolerance)
+{
+  gcode_vec2d_t v, w;
+  gfloat_t l, t, t_prev, d;
+  int i;
+
+  GCODE_MATH_VEC2D_SUB (v, point[last], point[first]);
+
+  l = v[0] * v[0] + v[1] * v[1];
+
+  if (l < GCODE_PRECISION * GCODE_PRECISION)                                    // A run that ends where it started is no line at all;
+    return (0);
+
+  t_prev = 0.0;
+
+  for (i = first + 1; i < last; i++)
+  {
+    GCODE_MATH_VEC2D_SUB (w, point[i], point[first]);
+
+    t = (w[0] * v[0] + w[1] * v[1]) / l;                                        // How far along the line the point falls (0 at the start, 1 at the end);
+
+    if (t < t_prev || t > 1.0)                                                  // If the run doubles back on itself, it is not a line either;
+      return (0);
+
+    d = fabs (w[0] * v[1] - w[1] * v[0]) / sqrt (l);                            // ...and how far off the line it falls;
+
+    if (d > tolerance)
+      return (0);
+
+    t_prev = t;
+  }
+
+  return (1);
+}
+
+/**
+ * Return 1 if points 'first' to 'last' of 'point' (and the midpoints of the
+ * segments between them) all lie within 'tolerance' of the circle through the
+ * first, the middle and the last one, going around it in one direction and less
+ * than a full turn, or 0 otherwise; if they do, the arc is put into 'center',
+ * 'radius' and 'sweep' (in degrees, positive counter-clockwise);
+ */
+
+static int
+gcode_util_fit_arc (gcode_vec2d_t *point, int first, int last, gfloat_t tolerance, gcode_vec2d_t center, gfloat_t *radius, gfloat_t *sweep)
+{
+  gfloat_t *a, *b, *c, d, a0, a1, delta, total;
+  gcode_vec2d_t m;
+  int i;
+
+  if (last - first < 2)
+    return (0);
+
+  a = point[first];
+  b = point[(first + last) / 2];
+  c = point[last];
+
+  d = 2.0 * (a[0] * (b[1] - c[1]) + b[0] * (c[1] - a[1]) + c[0] * (a[1] - b[1]));
+
+  if (fabs (d) < GCODE_PRECISION)                                               // Three points in a row have no circle through them;
+    return (0);
+
+  center[0] = ((a[0] * a[0] + a[1] * a[1]) * (b[1] - c[1]) +
+               (b[0] * b[0] + b[1] * b[1]) * (c[1] - a[1]) +
+               (c[0] * c[0] + c[1] * c[1]) * (a[1] - b[1])) / d;
+  center[1] = ((a[0] * a[0] + a[1] * a[1]) * (c[0] - b[0]) +
+               (b[0] * b[0] + b[1] * b[1]) * (a[0] - c[0]) +
+               (c[0] * c[0] + c[1] * c[1]) * (b[0] - a[0])) / d;
+
+  *radius = GCODE_MATH_2D_DISTANCE (a, center);
+
+  total = 0.0;
+
+  gcode_math_xy_to_angle (center, point[first], &a0);
+
+  for (i = first + 1; i <= last; i++)
+  {
+    if (fabs (GCODE_MATH_2D_DISTANCE (point[i], center) - *radius) > tolerance)
+      return (0);
+
+    m[0] = (point[i - 1][0] + point[i][0]) / 2;
+    m[1] = (point[i - 1][1] + point[i][1]) / 2;
+
+    if (fabs (GCODE_MATH_2D_DISTANCE (m, center) - *radius) > tolerance)
+      return (0);
+
+    gcode_math_xy_to_angle (center, point[i], &a1);
+
+    delta = a1 - a0;
+
+    GCODE_MATH_WRAP_SIGNED_DEGREES (delta);
+
+    if (fabs (delta) < GCODE_ANGULAR_PRECISION || delta * total < 0.0)          // Every segment has to turn the same way around the center...
+      return (0);
+
+    total += delta;
+    a0 = a1;
+  }
+
+  if (fabs (total) > 360.0 - GCODE_ANGULAR_PRECISION)                           // ...and all of them together, less than all the way around it;
+    return (0);
+
+  *sweep = total;
+
+  return (1);
+}
+
+/**
+ * Replace runs of consecutive, connected lines in the list starting with
+ * 'listhead' that stray no further than 'tolerance' from a single line or arc
+ * with that line or arc (flattened curves, STL slices and the like); runs are
+ * grown greedily from their first line, doubling then halving the length tried;
+ */
+
+int
+gcode_util_fit_list (gcode_block_t **listhead, gfloat_t tolerance)
+{
+  gcode_block_t *index_block, *run_block, **block, *new_block;
+  gcode_vec2d_t *point, e0, e1, center;
+  gfloat_t radius, sweep;
+  int i, good, bad, step, next, run_number, run_alloc;
+
+  if (!(*listhead) || tolerance <= 0.0)
+    return (1);
+
+  point = NULL;
+  block = NULL;
+  run_alloc = 0;
+
+  index_block = *listhead;
+
+  while (index_block)
+  {
+    run_number = 0;                                                             // Collect the run of connected lines starting at 'index_block';
+
+    for (run_block = index_block; run_block && run_block->type == GCODE_TYPE_LINE; run_block = run_block->next)
+    {
+      run_block->ends (run_block, e0, e1, GCODE_GET);
+
+      if (run_number > 0 && GCODE_MATH_2D_DISTANCE (point[run_number], e0) > GCODE_TOLERANCE)
+        break;
+
+      if (run_number + 2 > run_alloc)
+      {
+        run_alloc = run_alloc ? 2 * run_alloc : 64;
+        point = realloc (point, run_alloc * sizeof (gcode_vec2d_t));
+        block = realloc (block, run_alloc * sizeof (gcode_block_t *));
+
+        if (!point || !block)
+        {
+          REMARK ("Failed to allocate memory for fitting\n");
+          free (point);
+          free (block);
+          return (1);
+        }
+      }
+
+      GCODE_MATH_VEC2D_COPY (point[run_number], e0);
+      GCODE_MATH_VEC2D_COPY (point[run_number + 1], e1);
+
+      block[run_number++] = run_block;
+    }
+
+    if (run_number == 0)                                                        // Not a line: nothing to fit here, move on;
+    {
+      index_block = index_block->next;
+      continue;
+    }
+
+    index_block = block[run_number - 1]->next;                                  // Whatever the run turns into, go on after it next;
+
+    for (i = 0; i < run_number; i = good)
+    {
+      good = i + 1;                                                             // A single line always fits itself;
+      bad = run_number + 1;
+      step = 1;
+
+      while (good < run_number)                                                 // Try ever longer runs until one does not fit...
+      {
+        next = good + step < run_number ? good + step : run_number;
+
+        if (!gcode_util_fit_line (point, i, next, tolerance) &&
+            !gcode_util_fit_arc (point, i, next, tolerance, center, &radius, &sweep))
+        {
+          bad = next;
+          break;
+        }
+
+        good = next;
+        step *= 2;
+      }
+
+      while (bad - good > 1)                                                    // ...then close in on the longest one that does, between the two;
+      {
+        next = (good + bad) / 2;
+
+        if (gcode_util_fit_line (point, i, next, tolerance) ||
+            gcode_util_fit_arc (point, i, next, tolerance, center, &radius, &sweep))
+          good = next;
+        else
+          bad = next;
+      }
+
+      if (good - i < 2)
+        continue;
+
+      if (gcode_util_fit_line (point, i, good, tolerance))                      // A line is kept in the first line of the run, stretched to its end;
+      {
+        gcode_line_t *line;
+
+        line = (gcode_line_t *)block[i]->pdata;
+
+        GCODE_MATH_VEC2D_COPY (line->p1, point[good]);
+
+        next = i + 1;
+      }
+      else                                                                      // An arc is a new block put after the run, replacing the whole of it;
+      {
+        gcode_arc_t *arc;
+
+        gcode_util_fit_arc (point, i, good, tolerance, center, &radius, &sweep);
+
+        gcode_arc_init (&new_block, block[i]->gcode, NULL);
+
+        arc = (gcode_arc_t *)new_block->pdata;
+
+        GCODE_MATH_VEC2D_COPY (arc->p, point[i]);
+
+        arc->radius = radius;
+        gcode_math_xy_to_angle (center, point[i], &arc->start_angle);
+        arc->sweep_angle = sweep;
+
+        gcode_insert_after_block (block[good - 1], new_block);
+
+        next = i;
+      }
+
+      for (; next < good; next++)
+        GCODE_UTIL_TAG_BLOCK (block[next]);
+    }
+  }
+
+  free (point);
+  free (block);
+
+  return (gcode_util_remove_tagged_blocks (listhead));
+}
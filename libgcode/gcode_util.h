@@ -30,7 +30,6 @@ void gcode_util_xml_cpysafe (char *safestring, char *string);
 int gcode_util_qsort_compare_asc (const void *a, const void *b);
 void gcode_util_remove_spaces (char *string);
 void gcode_util_remove_comment (char *string);
-void gcode_util_filter_newlines (char *string);
 void gcode_util_remove_duplicate_scalars (gfloat_t *array, uint32_t *num);
 void gcode_util_qdbb (gcode_block_t *block, gcode_vec2d_t min, gcode_vec2d_t max);
 int gcode_util_endpoint (gcode_block_t *block, gcode_vec2d_t point, uint8_t mode);
@@ -45,6 +44,7 @@ int gcode_util_remove_tagged_blocks (gcode_block_t **listhead);
 int gcode_util_remove_null_sections (gcode_block_t **listhead);
 int gcode_util_merge_list_fragments (gcode_block_t **listhead);
 int gcode_util_convert_to_no_offset (gcode_block_t *listhead);
+int gcode_util_fit_list (gcode_block_t **listhead, gfloat_t tolerance);
 
 /**
  * Miscellaneous macros
@@ -0,0 +1,616 @@
+/**
+ *  gcode_voxel.c
+ *  Source code file for G-Code generation, simulation, and visualization
+ *  library.
+ *
+ *  Copyright (C) 2006 - 2010 by Justin Shumaker
+ *  Copyright (C) 2014 - 2020 by Asztalos Attila Oszkár
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gcode_voxel.h"
+#include "gcode_internal.h"
+
+/**
+ * Clear the bits 'zmin' to 'zmax' of a bit layout column: masked partial bytes
+ * at both ends, whole bytes in between.
+ */
+
+static void
+gcode_voxel_clear_bits (uint8_t *column, int zmin, int zmax)
+{
+  int first, last;
+
+  first = zmin >> 3;
+  last = zmax >> 3;
+
+  if (first == last)
+  {
+    column[first] &= (uint8_t)~((0xFF << (zmin & 7)) & (0xFF >> (7 - (zmax & 7))));
+    return;
+  }
+
+  column[first] &= (uint8_t)~(0xFF << (zmin & 7));
+
+  if (last - first > 1)
+    memset (&column[first + 1], 0, last - first - 1);
+
+  column[last] &= (uint8_t)~(0xFF >> (7 - (zmax & 7)));
+}
+
+/**
+ * Remove the interval [zmin, zmax) from the material runs of a run-length layout
+ * column; every run overlapping it is dropped, except for the parts sticking out
+ * below 'zmin' and above 'zmax', so the column grows by at most one run.
+ */
+
+static void
+gcode_voxel_cut_column (gcode_voxel_column_t *column, int zmin, int zmax)
+{
+  uint16_t *bound, *grown, low, high;
+  uint32_t run_number, first, last, left, right, keep, capacity;
+
+  bound = column->alloc ? column->bound.heap : column->bound.local;
+  run_number = column->number / 2;
+
+  for (first = 0; first < run_number; first++)
+    if (bound[2 * first + 1] > zmin)
+      break;
+
+  for (last = first; last < run_number; last++)
+    if (bound[2 * last] >= zmax)
+      break;
+
+  if (last == first)                                                            // No run overlaps the interval
+    return;
+
+  last--;
+
+  low = bound[2 * first];
+  high = bound[2 * last + 1];
+
+  left = (low < zmin);
+  right = (high > zmax);
+
+  keep = run_number - (last - first + 1) + left + right;
+  capacity = column->alloc ? column->alloc : GCODE_VOXEL_RLE_LOCAL;
+
+  if (2 * keep > capacity)
+  {
+    capacity *= 2;
+
+    grown = malloc (capacity * sizeof (uint16_t));
+
+    if (!grown)
+    {
+      REMARK ("Failed to grow a voxel map column\n");
+      return;
+    }
+
+    memcpy (grown, bound, column->number * sizeof (uint16_t));
+
+    if (column->alloc)
+      free (column->bound.heap);
+
+    column->bound.heap = grown;
+    column->alloc = capacity;
+    bound = grown;
+  }
+
+  memmove (&bound[2 * (first + left + right)], &bound[2 * (last + 1)], 2 * (run_number - last - 1) * sizeof (uint16_t));
+
+  if (left)
+  {
+    bound[2 * first] = low;
+    bound[2 * first + 1] = zmin;
+    first++;
+  }
+
+  if (right)
+  {
+    bound[2 * first] = zmax;
+    bound[2 * first + 1] = high;
+  }
+
+  column->number = 2 * keep;
+}
+
+/**
+ * The shared brick standing for every brick that has been carved out completely
+ */
+
+static gcode_voxel_brick_t gcode_voxel_air_brick;
+
+/**
+ * Fill 'brick' with the solid brick at (bx, by, bz); the voxels of a brick that
+ * stick out past the far edges of the map stay air, so that a brick can be told
+ * empty (or solid) by its words alone.
+ */
+
+static void
+gcode_voxel_brick_solid (gcode_voxel_t *voxel, uint32_t bx, uint32_t by, uint32_t bz, gcode_voxel_brick_t *brick)
+{
+  uint64_t row, layer;
+  uint32_t i, n[3];
+
+  n[0] = voxel->number[0] - bx * GCODE_VOXEL_BRICK_SIZE;
+  n[1] = voxel->number[1] - by * GCODE_VOXEL_BRICK_SIZE;
+  n[2] = voxel->number[2] - bz * GCODE_VOXEL_BRICK_SIZE;
+
+  row = (n[0] < GCODE_VOXEL_BRICK_SIZE) ? (1 << n[0]) - 1 : 0xFF;
+  layer = 0;
+
+  for (i = 0; i < GCODE_VOXEL_BRICK_SIZE && i < n[1]; i++)
+    layer |= row << (8 * i);
+
+  for (i = 0; i < GCODE_VOXEL_BRICK_SIZE; i++)
+    brick->word[i] = (i < n[2]) ? layer : 0;
+}
+
+static gcode_voxel_brick_t *
+gcode_voxel_brick_new (gcode_voxel_t *voxel, uint32_t bx, uint32_t by, uint32_t bz)
+{
+  gcode_voxel_brick_t *brick;
+
+  brick = malloc (sizeof (gcode_voxel_brick_t));
+
+  if (brick)
+    gcode_voxel_brick_solid (voxel, bx, by, bz, brick);
+
+  return (brick);
+}
+
+/**
+ * Release every brick of the sparse layout, turning the whole map back to solid
+ */
+
+static void
+gcode_voxel_brick_release (gcode_voxel_t *voxel)
+{
+  size_t i, stacks;
+  uint32_t bz;
+
+  stacks = (size_t)voxel->brick_number[0] * (size_t)voxel->brick_number[1];
+
+  for (i = 0; i < stacks; i++)
+  {
+    if (!voxel->brick[i])
+      continue;
+
+    for (bz = 0; bz < voxel->brick_number[2]; bz++)
+      if (voxel->brick[i][bz] != &gcode_voxel_air_brick)
+        free (voxel->brick[i][bz]);
+
+    free (voxel->brick[i]);
+    voxel->brick[i] = NULL;
+  }
+}
+
+/**
+ * Clear the X run 'xmin' to 'xmax' (all within brick column 'bx') of row 'y' in
+ * the layers 'zmin' to 'zmax', allocating the bricks it partly carves on the way
+ * and retiring those it leaves empty.
+ */
+
+static void
+gcode_voxel_brick_clear (gcode_voxel_t *voxel, uint32_t bx, int xmin, int xmax, int y, int zmin, int zmax)
+{
+  gcode_voxel_brick_t ***stack, *brick;
+  uint64_t mask;
+  uint32_t by, bz;
+  int z, z0, z1;
+
+  by = y / GCODE_VOXEL_BRICK_SIZE;
+  stack = &voxel->brick[(size_t)by * voxel->brick_number[0] + bx];
+
+  if (!*stack)
+  {
+    *stack = calloc (voxel->brick_number[2], sizeof (gcode_voxel_brick_t *));
+
+    if (!*stack)
+    {
+      REMARK ("Failed to allocate a stack of voxel map bricks\n");
+      return;
+    }
+  }
+
+  mask = (uint64_t)((0xFF << (xmin % GCODE_VOXEL_BRICK_SIZE)) & (0xFF >> (7 - xmax % GCODE_VOXEL_BRICK_SIZE)));
+  mask <<= 8 * (y % GCODE_VOXEL_BRICK_SIZE);
+
+  for (bz = zmin / GCODE_VOXEL_BRICK_SIZE; bz <= (uint32_t)zmax / GCODE_VOXEL_BRICK_SIZE; bz++)
+  {
+    brick = (*stack)[bz];
+
+    if (brick == &gcode_voxel_air_brick)
+      continue;
+
+    if (!brick)
+    {
+      brick = gcode_voxel_brick_new (voxel, bx, by, bz);
+
+      if (!brick)
+      {
+        REMARK ("Failed to allocate a voxel map brick\n");
+        return;
+      }
+
+      (*stack)[bz] = brick;
+    }
+
+    z0 = (zmin > (int)(bz * GCODE_VOXEL_BRICK_SIZE)) ? zmin % GCODE_VOXEL_BRICK_SIZE : 0;
+    z1 = (zmax < (int)((bz + 1) * GCODE_VOXEL_BRICK_SIZE)) ? zmax % GCODE_VOXEL_BRICK_SIZE : GCODE_VOXEL_BRICK_SIZE - 1;
+
+    for (z = z0; z <= z1; z++)
+      brick->word[z] &= ~mask;
+
+    if (!(brick->word[0] | brick->word[1] | brick->word[2] | brick->word[3] |
+          brick->word[4] | brick->word[5] | brick->word[6] | brick->word[7]))
+    {
+      free (brick);
+      (*stack)[bz] = &gcode_voxel_air_brick;
+    }
+  }
+}
+
+/**
+ * Turn the column (x, y) of the sparse layout back into material, retiring the
+ * bricks that end up solid again.
+ */
+
+static void
+gcode_voxel_brick_fill_column (gcode_voxel_t *voxel, int x, int y)
+{
+  gcode_voxel_brick_t **stack, *brick, solid;
+  uint64_t bit;
+  uint32_t bx, by, bz, z;
+
+  bx = x / GCODE_VOXEL_BRICK_SIZE;
+  by = y / GCODE_VOXEL_BRICK_SIZE;
+
+  stack = voxel->brick[(size_t)by * voxel->brick_number[0] + bx];
+
+  if (!stack)                                                                   // Never carved
+    return;
+
+  bit = (uint64_t)1 << (8 * (y % GCODE_VOXEL_BRICK_SIZE) + x % GCODE_VOXEL_BRICK_SIZE);
+
+  for (bz = 0; bz < voxel->brick_number[2]; bz++)
+  {
+    brick = stack[bz];
+
+    if (!brick)
+      continue;
+
+    if (brick == &gcode_voxel_air_brick)
+    {
+      brick = calloc (1, sizeof (gcode_voxel_brick_t));
+
+      if (!brick)
+      {
+        REMARK ("Failed to allocate a voxel map brick\n");
+        return;
+      }
+
+      stack[bz] = brick;
+    }
+
+    gcode_voxel_brick_solid (voxel, bx, by, bz, &solid);
+
+    for (z = 0; z < GCODE_VOXEL_BRICK_SIZE; z++)
+      brick->word[z] |= solid.word[z] & bit;
+
+    if (memcmp (brick, &solid, sizeof (gcode_voxel_brick_t)) == 0)
+    {
+      free (brick);
+      stack[bz] = NULL;
+    }
+  }
+}
+
+void
+gcode_voxel_init (gcode_voxel_t *voxel)
+{
+  voxel->layout = GCODE_VOXEL_BYTE;
+
+  voxel->number[0] = 0;
+  voxel->number[1] = 0;
+  voxel->number[2] = 0;
+
+  voxel->brick_number[0] = 0;
+  voxel->brick_number[1] = 0;
+  voxel->brick_number[2] = 0;
+
+  voxel->stride = 0;
+  voxel->size = 0;
+  voxel->data = NULL;
+  voxel->column = NULL;
+  voxel->brick = NULL;
+}
+
+/**
+ * (Re)allocate the map for 'number' voxels in the given layout and fill it with
+ * material; all sizes are computed in 'size_t' so that large maps are either
+ * allocated in full or refused, never silently truncated. Returns 1 on failure,
+ * leaving an empty map behind.
+ */
+
+int
+gcode_voxel_prep (gcode_voxel_t *voxel, uint8_t layout, uint32_t number[3])
+{
+  size_t columns;
+
+  gcode_voxel_free (voxel);
+
+  voxel->layout = layout;
+
+  voxel->number[0] = number[0];
+  voxel->number[1] = number[1];
+  voxel->number[2] = number[2];
+
+  columns = (size_t)number[0] * (size_t)number[1];
+
+  switch (layout)
+  {
+    case GCODE_VOXEL_BIT:
+      voxel->stride = ((size_t)number[2] + 7) / 8;
+      voxel->size = columns * voxel->stride;
+      voxel->data = malloc (voxel->size);
+      break;
+
+    case GCODE_VOXEL_RLE:
+      if (number[2] > UINT16_MAX)                                               // Run bounds are 16 bit
+        break;
+
+      voxel->size = columns * sizeof (gcode_voxel_column_t);
+      voxel->column = calloc (columns, sizeof (gcode_voxel_column_t));
+      break;
+
+    case GCODE_VOXEL_BRICK:
+      voxel->brick_number[0] = (number[0] + GCODE_VOXEL_BRICK_SIZE - 1) / GCODE_VOXEL_BRICK_SIZE;
+      voxel->brick_number[1] = (number[1] + GCODE_VOXEL_BRICK_SIZE - 1) / GCODE_VOXEL_BRICK_SIZE;
+      voxel->brick_number[2] = (number[2] + GCODE_VOXEL_BRICK_SIZE - 1) / GCODE_VOXEL_BRICK_SIZE;
+
+      columns = (size_t)voxel->brick_number[0] * (size_t)voxel->brick_number[1];
+
+      voxel->size = columns * sizeof (gcode_voxel_brick_t **);
+      voxel->brick = calloc (columns, sizeof (gcode_voxel_brick_t **));
+      break;
+
+    default:
+      voxel->layout = GCODE_VOXEL_BYTE;
+      voxel->size = columns * (size_t)number[2];
+      voxel->data = malloc (voxel->size);
+      break;
+  }
+
+  if (!voxel->data && !voxel->column && !voxel->brick)
+  {
+    voxel->size = 0;
+    return (1);
+  }
+
+  gcode_voxel_fill (voxel);
+
+  return (0);
+}
+
+void
+gcode_voxel_free (gcode_voxel_t *voxel)
+{
+  size_t i, columns;
+
+  if (voxel->column)
+  {
+    columns = (size_t)voxel->number[0] * (size_t)voxel->number[1];
+
+    for (i = 0; i < columns; i++)
+      if (voxel->column[i].alloc)
+        free (voxel->column[i].bound.heap);
+  }
+
+  if (voxel->brick)
+    gcode_voxel_brick_release (voxel);
+
+  free (voxel->data);
+  free (voxel->column);
+  free (voxel->brick);
+
+  voxel->data = NULL;
+  voxel->column = NULL;
+  voxel->brick = NULL;
+  voxel->stride = 0;
+  voxel->size = 0;
+}
+
+/**
+ * Turn every voxel back into material
+ */
+
+void
+gcode_voxel_fill (gcode_voxel_t *voxel)
+{
+  size_t i, columns;
+
+  if (!voxel->size)
+    return;
+
+  switch (voxel->layout)
+  {
+    case GCODE_VOXEL_BIT:
+      memset (voxel->data, 0xFF, voxel->size);
+      break;
+
+    case GCODE_VOXEL_RLE:
+      columns = (size_t)voxel->number[0] * (size_t)voxel->number[1];
+
+      for (i = 0; i < columns; i++)
+      {
+        if (voxel->column[i].alloc)
+          free (voxel->column[i].bound.heap);
+
+        voxel->column[i].alloc = 0;
+        voxel->column[i].number = 2;
+        voxel->column[i].bound.local[0] = 0;
+        voxel->column[i].bound.local[1] = voxel->number[2];
+      }
+      break;
+
+    case GCODE_VOXEL_BRICK:
+      gcode_voxel_brick_release (voxel);
+      break;
+
+    default:
+      memset (voxel->data, 1, voxel->size);
+      break;
+  }
+}
+
+/**
+ * Turn every voxel of the column (x, y) back into material
+ */
+
+void
+gcode_voxel_fill_column (gcode_voxel_t *voxel, int x, int y)
+{
+  gcode_voxel_column_t *column;
+  uint32_t z;
+
+  switch (voxel->layout)
+  {
+    case GCODE_VOXEL_BIT:
+      memset (&voxel->data[((size_t)y * voxel->number[0] + x) * voxel->stride], 0xFF, voxel->stride);
+      break;
+
+    case GCODE_VOXEL_RLE:
+      column = &voxel->column[(size_t)y * voxel->number[0] + x];
+
+      if (column->alloc)
+        free (column->bound.heap);
+
+      column->alloc = 0;
+      column->number = 2;
+      column->bound.local[0] = 0;
+      column->bound.local[1] = voxel->number[2];
+      break;
+
+    case GCODE_VOXEL_BRICK:
+      gcode_voxel_brick_fill_column (voxel, x, y);
+      break;
+
+    default:
+      for (z = 0; z < voxel->number[2]; z++)
+        voxel->data[((size_t)z * voxel->number[1] + y) * voxel->number[0] + x] = 1;
+      break;
+  }
+}
+
+/**
+ * Return non-zero if there is material at voxel (x, y, z)
+ */
+
+uint8_t
+gcode_voxel_get (gcode_voxel_t *voxel, int x, int y, int z)
+{
+  gcode_voxel_column_t *column;
+  gcode_voxel_brick_t **stack, *brick;
+  uint16_t *bound;
+  uint32_t i;
+
+  switch (voxel->layout)
+  {
+    case GCODE_VOXEL_BIT:
+      return ((voxel->data[((size_t)y * voxel->number[0] + x) * voxel->stride + (z >> 3)] >> (z & 7)) & 1);
+
+    case GCODE_VOXEL_RLE:
+      column = &voxel->column[(size_t)y * voxel->number[0] + x];
+      bound = column->alloc ? column->bound.heap : column->bound.local;
+
+      for (i = 0; i < column->number; i += 2)
+      {
+        if (z < bound[i])
+          return (0);
+
+        if (z < bound[i + 1])
+          return (1);
+      }
+
+      return (0);
+
+    case GCODE_VOXEL_BRICK:
+      stack = voxel->brick[(size_t)(y / GCODE_VOXEL_BRICK_SIZE) * voxel->brick_number[0] + x / GCODE_VOXEL_BRICK_SIZE];
+
+      if (!stack)
+        return (1);
+
+      brick = stack[z / GCODE_VOXEL_BRICK_SIZE];
+
+      if (!brick)
+        return (1);
+
+      return ((brick->word[z % GCODE_VOXEL_BRICK_SIZE] >> (8 * (y % GCODE_VOXEL_BRICK_SIZE) + x % GCODE_VOXEL_BRICK_SIZE)) & 1);
+
+    default:
+      return (voxel->data[((size_t)z * voxel->number[1] + y) * voxel->number[0] + x]);
+  }
+}
+
+/**
+ * Turn the voxels 'xmin' to 'xmax' of row 'y' into air in every layer from 'zmin'
+ * to 'zmax'; the indices must be within the map. Only the columns of that X run
+ * (or, in the sparse layout, the bricks holding them) are written to, so that
+ * simulation threads working on disjoint XY tiles aligned to bricks never touch
+ * the same memory.
+ */
+
+void
+gcode_voxel_clear (gcode_voxel_t *voxel, int xmin, int xmax, int y, int zmin, int zmax)
+{
+  uint32_t bx;
+  int x, xend, z;
+
+  if (xmin > xmax || zmin > zmax)
+    return;
+
+  switch (voxel->layout)
+  {
+    case GCODE_VOXEL_BIT:
+      for (x = xmin; x <= xmax; x++)
+        gcode_voxel_clear_bits (&voxel->data[((size_t)y * voxel->number[0] + x) * voxel->stride], zmin, zmax);
+      break;
+
+    case GCODE_VOXEL_RLE:
+      for (x = xmin; x <= xmax; x++)
+        gcode_voxel_cut_column (&voxel->column[(size_t)y * voxel->number[0] + x], zmin, zmax + 1);
+      break;
+
+    case GCODE_VOXEL_BRICK:
+      for (x = xmin; x <= xmax; x = xend + 1)
+      {
+        bx = x / GCODE_VOXEL_BRICK_SIZE;
+        xend = (bx + 1) * GCODE_VOXEL_BRICK_SIZE - 1;
+
+        if (xend > xmax)
+          xend = xmax;
+
+        gcode_voxel_brick_clear (voxel, bx, x, xend, y, zmin, zmax);
+      }
+      break;
+
+    default:
+      for (z = zmin; z <= zmax; z++)
+        memset (&voxel->data[((size_t)z * voxel->number[1] + y) * voxel->number[0] + xmin], 0, xmax - xmin + 1);
+      break;
+  }
+}
@@ -0,0 +1,93 @@
+/**
+ *  gcode_voxel.h
+ *  Source code file for G-Code generation, simulation, and visualization
+ *  library.
+ *
+ *  Copyright (C) 2006 - 2010 by Justin Shumaker
+ *  Copyright (C) 2014 - 2020 by Asztalos Attila Oszkár
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _GCODE_VOXEL_H
+#define _GCODE_VOXEL_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#define GCODE_VOXEL_BYTE            0x00                                        /* One byte per voxel, Z-major (the original layout) */
+#define GCODE_VOXEL_BIT             0x01                                        /* One bit per voxel, packed along Z within each column */
+#define GCODE_VOXEL_RLE             0x02                                        /* Runs of material along Z within each column */
+#define GCODE_VOXEL_BRICK           0x03                                        /* Sparse bricks, only allocated once partly carved */
+
+#define GCODE_VOXEL_RLE_LOCAL       4                                           /* Run bounds kept inside the column (two runs) */
+#define GCODE_VOXEL_BRICK_SIZE      8                                           /* Voxels along each side of a brick */
+
+/**
+ * A column of the run-length layout: 'number' run bounds, taken in [start, end)
+ * pairs of Z indices in ascending order, each pair being a run of material; the
+ * bounds live in 'local' until they outgrow it, then in the heap, so a column
+ * takes 16 bytes however tall the stock is.
+ */
+
+typedef struct gcode_voxel_column_s
+{
+  uint32_t number;                                                              // Number of run bounds in use (always even)
+  uint32_t alloc;                                                               // Number of bounds 'bound.heap' can hold, zero while 'bound.local' is used
+  union
+  {
+    uint16_t local[GCODE_VOXEL_RLE_LOCAL];
+    uint16_t *heap;
+  } bound;
+} gcode_voxel_column_t;
+
+/**
+ * A brick of the sparse layout: 8 x 8 x 8 voxels, one word per Z layer, one byte
+ * of it per Y row and one bit of that per X voxel. Bricks exist only where the
+ * tool cut some, but not all, of their material: a NULL brick is still solid and
+ * one that turns entirely into air is swapped for a single shared air brick.
+ */
+
+typedef struct gcode_voxel_brick_s
+{
+  uint64_t word[GCODE_VOXEL_BRICK_SIZE];
+} gcode_voxel_brick_t;
+
+/**
+ * Storage of the voxel map; whatever the layout, a voxel is addressed by its
+ * (x, y, z) indices and only ever goes from material to air, so every layout
+ * only has to support reading a voxel and clearing runs of voxels.
+ */
+
+typedef struct gcode_voxel_s
+{
+  uint8_t layout;
+  uint32_t number[3];                                                           // Number of voxels along X, Y and Z
+  uint32_t brick_number[3];                                                     // Number of bricks along X, Y and Z in the sparse layout
+  size_t stride;                                                                // Bytes per column in the bit layout
+  size_t size;                                                                  // Bytes allocated up front, zero while there is no map
+  uint8_t *data;                                                                // Byte and bit layouts
+  gcode_voxel_column_t *column;                                                 // Run-length layout
+  gcode_voxel_brick_t ***brick;                                                 // Sparse layout: a (lazily allocated) Z stack of bricks per XY
+} gcode_voxel_t;
+
+void gcode_voxel_init (gcode_voxel_t *voxel);
+int gcode_voxel_prep (gcode_voxel_t *voxel, uint8_t layout, uint32_t number[3]);
+void gcode_voxel_free (gcode_voxel_t *voxel);
+void gcode_voxel_fill (gcode_voxel_t *voxel);
+void gcode_voxel_fill_column (gcode_voxel_t *voxel, int x, int y);
+uint8_t gcode_voxel_get (gcode_voxel_t *voxel, int x, int y, int z);
+void gcode_voxel_clear (gcode_voxel_t *voxel, int xmin, int xmax, int y, int zmin, int zmax);
+
+#endif
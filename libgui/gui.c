@@ -826,10 +826,19 @@ gui_attach (gcode_t *gcode, gui_t *gui)
   gcode->progress_callback = update_progress;
   gcode->message_callback = generic_dialog;
 
+  gcode->stock_model = gui->settings.stock_model;
+  gcode->sim_mode = gui->settings.sim_mode;
+  gcode->sim_threads = gui->settings.sim_threads;
+  gcode->make_threads = gui->settings.make_threads;
+  gcode->compact_output = gui->settings.compact_output;
+  gcode->subprograms = gui->settings.subprograms;
+  gcode->voxel_layout = gui->settings.voxel_layout;
   gcode->voxel_resolution = gui->settings.voxel_resolution;
+  gcode->height_resolution = gui->settings.height_resolution;
   gcode->curve_segments = gui->settings.curve_segments;
   gcode->roughing_overlap = gui->settings.roughing_overlap;
   gcode->padding_fraction = gui->settings.padding_fraction;
+  gcode->fit_tolerance = gui->settings.fit_tolerance;
 }
 
 /**
@@ -93,7 +93,7 @@ start (void *data, const char *xmlelem, const char **xmlattr)
       }
       else if (strcmp (name, GCODE_XML_ATTR_ENDMILL_DIAMETER) == 0)
       {
-        new_endmill->diameter = atof (value);
+        new_endmill->diameter = gstrtod (value, NULL);
       }
       else if (strcmp (name, GCODE_XML_ATTR_ENDMILL_UNIT) == 0)
       {
@@ -117,27 +117,27 @@ start (void *data, const char *xmlelem, const char **xmlattr)
 
       if (strcmp (name, GCODE_XML_ATTR_PROPERTY_TRAVEL_X) == 0)
       {
-        new_machine->travel[0] = atof (value);
+        new_machine->travel[0] = gstrtod (value, NULL);
       }
       else if (strcmp (name, GCODE_XML_ATTR_PROPERTY_TRAVEL_Y) == 0)
       {
-        new_machine->travel[1] = atof (value);
+        new_machine->travel[1] = gstrtod (value, NULL);
       }
       else if (strcmp (name, GCODE_XML_ATTR_PROPERTY_TRAVEL_Z) == 0)
       {
-        new_machine->travel[2] = atof (value);
+        new_machine->travel[2] = gstrtod (value, NULL);
       }
       else if (strcmp (name, GCODE_XML_ATTR_PROPERTY_MAX_IPM_X) == 0)
       {
-        new_machine->maxipm[0] = atof (value);
+        new_machine->maxipm[0] = gstrtod (value, NULL);
       }
       else if (strcmp (name, GCODE_XML_ATTR_PROPERTY_MAX_IPM_Y) == 0)
       {
-        new_machine->maxipm[1] = atof (value);
+        new_machine->maxipm[1] = gstrtod (value, NULL);
       }
       else if (strcmp (name, GCODE_XML_ATTR_PROPERTY_MAX_IPM_Z) == 0)
       {
-        new_machine->maxipm[2] = atof (value);
+        new_machine->maxipm[2] = gstrtod (value, NULL);
       }
       else if (strcmp (name, GCODE_XML_ATTR_PROPERTY_SPINDLE_CONTROL) == 0)
       {
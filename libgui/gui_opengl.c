@@ -29,27 +29,21 @@
 static void
 sum_normal (gui_opengl_t *opengl, int i, int j, int k, gcode_vec3d_t nor)
 {
-  int ind;
+  gcode_voxel_t *voxel;
 
   if (i < 0 || j < 0 || k < 0 || i >= opengl->gcode->voxel_number[0] || j >= opengl->gcode->voxel_number[1] || k >= opengl->gcode->voxel_number[2])
     return;
 
-  ind = i + j * opengl->gcode->voxel_number[0] + k * (opengl->gcode->voxel_number[0] * opengl->gcode->voxel_number[1]);
+  voxel = &opengl->gcode->voxel_map;
 
   /**
    * Compute Normal Based on Existance of Neighbors
-   * -x = -1
-   * +x = +1
-   * -y = -opengl->gcode->voxel_number[1]
-   * +y = +opengl->gcode->voxel_number[1]
-   * -z = -(opengl->gcode->voxel_number[0] * opengl->gcode->voxel_number[1])
-   * +z = +(opengl->gcode->voxel_number[0] * opengl->gcode->voxel_number[1])
    */
 
   /* X */
   if (i > 0)
   {
-    if (!opengl->gcode->voxel_map[ind - 1])
+    if (!gcode_voxel_get (voxel, i - 1, j, k))
       nor[0] += -1.0;
   }
   else
@@ -59,7 +53,7 @@ sum_normal (gui_opengl_t *opengl, int i, int j, int k, gcode_vec3d_t nor)
 
   if (i < opengl->gcode->voxel_number[0] - 1)
   {
-    if (!opengl->gcode->voxel_map[ind + 1])
+    if (!gcode_voxel_get (voxel, i + 1, j, k))
       nor[0] += 1.0;
   }
   else
@@ -70,7 +64,7 @@ sum_normal (gui_opengl_t *opengl, int i, int j, int k, gcode_vec3d_t nor)
   /* Y */
   if (j > 0)
   {
-    if (!opengl->gcode->voxel_map[ind - opengl->gcode->voxel_number[0]])
+    if (!gcode_voxel_get (voxel, i, j - 1, k))
       nor[1] += -1.0;
   }
   else
@@ -80,7 +74,7 @@ sum_normal (gui_opengl_t *opengl, int i, int j, int k, gcode_vec3d_t nor)
 
   if (j < opengl->gcode->voxel_number[1] - 1)
   {
-    if (!opengl->gcode->voxel_map[ind + opengl->gcode->voxel_number[0]])
+    if (!gcode_voxel_get (voxel, i, j + 1, k))
       nor[1] += 1.0;
   }
   else
@@ -91,7 +85,7 @@ sum_normal (gui_opengl_t *opengl, int i, int j, int k, gcode_vec3d_t nor)
   /* Z */
   if (k > 0)
   {
-    if (!opengl->gcode->voxel_map[ind - opengl->gcode->voxel_number[0] * opengl->gcode->voxel_number[1]])
+    if (!gcode_voxel_get (voxel, i, j, k - 1))
       nor[2] += -1.0;
   }
   else
@@ -101,7 +95,7 @@ sum_normal (gui_opengl_t *opengl, int i, int j, int k, gcode_vec3d_t nor)
 
   if (k < opengl->gcode->voxel_number[2] - 1)
   {
-    if (!opengl->gcode->voxel_map[ind + opengl->gcode->voxel_number[0] * opengl->gcode->voxel_number[1]])
+    if (!gcode_voxel_get (voxel, i, j, k + 1))
       nor[2] += 1.0;
   }
   else
@@ -376,20 +370,114 @@ gui_opengl_build_gridxz_display_list (gui_opengl_t *opengl)
   glEndList ();
 }
 
+/**
+ * Return the Z coordinate of the lowest height map cell within the 'step' x 'step'
+ * square starting at cell (i, j); taking the minimum rather than just sampling
+ * keeps narrow grooves visible when the map has to be decimated for display.
+ */
+
+static gfloat_t
+height_map_z (gui_opengl_t *opengl, int i, int j, int step)
+{
+  int x, y, x1, y1;
+  uint16_t level;
+
+  if (i < 0)
+    i = 0;
+
+  if (j < 0)
+    j = 0;
+
+  if (i >= opengl->gcode->voxel_number[0])
+    i = opengl->gcode->voxel_number[0] - 1;
+
+  if (j >= opengl->gcode->voxel_number[1])
+    j = opengl->gcode->voxel_number[1] - 1;
+
+  x1 = (i + step < opengl->gcode->voxel_number[0]) ? i + step : opengl->gcode->voxel_number[0];
+  y1 = (j + step < opengl->gcode->voxel_number[1]) ? j + step : opengl->gcode->voxel_number[1];
+
+  level = GCODE_HEIGHT_MAP_TOP;
+
+  for (y = j; y < y1; y++)
+    for (x = i; x < x1; x++)
+      if (opengl->gcode->height_map[x + y * opengl->gcode->voxel_number[0]] < level)
+        level = opengl->gcode->height_map[x + y * opengl->gcode->voxel_number[0]];
+
+  return (((gfloat_t)level / (gfloat_t)GCODE_HEIGHT_MAP_TOP) * opengl->gcode->material_size[2] - opengl->gcode->material_size[2]);
+}
+
+/**
+ * Draw the height map as a shaded surface, one quad strip per row of cells;
+ * normals come from the central differences of the neighbouring heights.
+ */
+
+static void
+draw_height_map (gui_opengl_t *opengl)
+{
+  int i, j, k, step;
+  gfloat_t vx, vy, vz, dx, dy;
+  gcode_vec3d_t nor;
+
+  step = 1;
+
+  while (opengl->gcode->voxel_number[0] / step > GUI_OPENGL_HEIGHT_MAP_MAX_CELLS ||
+         opengl->gcode->voxel_number[1] / step > GUI_OPENGL_HEIGHT_MAP_MAX_CELLS)
+    step++;
+
+  dx = step * opengl->gcode->material_size[0] / (gfloat_t)opengl->gcode->voxel_number[0];
+  dy = step * opengl->gcode->material_size[1] / (gfloat_t)opengl->gcode->voxel_number[1];
+
+  for (j = 0; j + step < opengl->gcode->voxel_number[1]; j += step)
+  {
+    /* Update Progress based on Y */
+    opengl->progress_callback (opengl->gcode->gui, (gfloat_t)(j + step) / (gfloat_t)opengl->gcode->voxel_number[1]);
+
+    glBegin (GL_QUAD_STRIP);
+
+    for (i = 0; i < opengl->gcode->voxel_number[0]; i += step)
+    {
+      vx = -opengl->gcode->material_size[0] * 0.5 + ((gfloat_t)i / (gfloat_t)opengl->gcode->voxel_number[0]) * opengl->gcode->material_size[0];
+
+      for (k = j; k <= j + step; k += step)
+      {
+        vy = -opengl->gcode->material_size[1] * 0.5 + ((gfloat_t)k / (gfloat_t)opengl->gcode->voxel_number[1]) * opengl->gcode->material_size[1];
+        vz = height_map_z (opengl, i, k, step);
+
+        nor[0] = (height_map_z (opengl, i - step, k, step) - height_map_z (opengl, i + step, k, step)) / (2.0 * dx);
+        nor[1] = (height_map_z (opengl, i, k - step, step) - height_map_z (opengl, i, k + step, step)) / (2.0 * dy);
+        nor[2] = 1.0;
+
+        glNormal3f (nor[0], nor[1], nor[2]);
+        glVertex3f (vx, vy, vz);
+      }
+    }
+
+    glEnd ();
+  }
+}
+
 void
 gui_opengl_build_simulate_display_list (gui_opengl_t *opengl)
 {
-  int16_t i, j, k;
+  int i, j, k;
   gfloat_t vx, vy, vz;
   gcode_vec3d_t nor;
-  int ind;
   GLfloat mat_ambient[] = { 1.0, 1.0, 1.0, 1.0 };
   GLfloat mat_diffuse[] = { 0.6, 0.6, 0.6, 1.0 };
   GLfloat mat_specular[] = { 0.0, 0.0, 0.0, 1.0 };
   GLfloat mat_shininess[] = { 0.0 };
 
-  if (!opengl->gcode->voxel_map)
-    return;
+  if (opengl->gcode->stock_model == GCODE_STOCK_HEIGHT_MAP)
+  {
+    if (!opengl->gcode->height_map)
+      return;
+  }
+  else
+  {
+    if (!opengl->gcode->voxel_map.size)
+      return;
+  }
 
   opengl->simulate_display_list = glGenLists (5);
   glNewList (opengl->simulate_display_list, GL_COMPILE);
@@ -404,11 +492,18 @@ gui_opengl_build_simulate_display_list (gui_opengl_t *opengl)
   glMaterialfv (GL_FRONT_AND_BACK, GL_SPECULAR, mat_specular);
   glMaterialfv (GL_FRONT_AND_BACK, GL_SHININESS, mat_shininess);
 
+  if (opengl->gcode->stock_model == GCODE_STOCK_HEIGHT_MAP)
+  {
+    draw_height_map (opengl);
+
+    glEndList ();
+
+    return;
+  }
+
   glPointSize (GCODE_OPENGL_VOXEL_POINT_SIZE);
   glBegin (GL_POINTS);
 
-  ind = 0;
-
   for (k = 0; k < opengl->gcode->voxel_number[2]; k++)
   {
     vz = ((gfloat_t)k / (gfloat_t)opengl->gcode->voxel_number[2]) * opengl->gcode->material_size[2] - opengl->gcode->material_size[2];
@@ -424,7 +519,7 @@ gui_opengl_build_simulate_display_list (gui_opengl_t *opengl)
       {
         vx = -opengl->gcode->material_size[0] * 0.5 + ((gfloat_t)i / (gfloat_t)opengl->gcode->voxel_number[0]) * opengl->gcode->material_size[0];
 
-        if (opengl->gcode->voxel_map[ind])
+        if (gcode_voxel_get (&opengl->gcode->voxel_map, i, j, k))
         {
           nor[0] = 0.0;
           nor[1] = 0.0;
@@ -445,8 +540,6 @@ gui_opengl_build_simulate_display_list (gui_opengl_t *opengl)
             glVertex3f (vx, vy, vz);
           }
         }
-
-        ind++;
       }
     }
   }
@@ -41,6 +41,8 @@
 #define GUI_OPENGL_PROJECTION_PERSPECTIVE   0x0
 #define GUI_OPENGL_PROJECTION_ORTHOGRAPHIC  0x1
 
+#define GUI_OPENGL_HEIGHT_MAP_MAX_CELLS     2048                                /* Max. number of displayed height map cells along X or Y */
+
 typedef void gui_opengl_progress_t (void *gui, gfloat_t progress);
 
 typedef struct gui_opengl_view_s
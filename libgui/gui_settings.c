@@ -34,10 +34,19 @@
 void
 gui_settings_init (gui_settings_t *settings)
 {
+  settings->stock_model = GCODE_STOCK_VOXEL_MAP;
+  settings->sim_mode = GCODE_SIM_STEPPED;
+  settings->sim_threads = 0;
+  settings->make_threads = 0;
+  settings->compact_output = 0;
+  settings->subprograms = 0;
+  settings->voxel_layout = GCODE_VOXEL_BIT;
   settings->voxel_resolution = 1000;
+  settings->height_resolution = 5000;
   settings->curve_segments = 50;
   settings->roughing_overlap = 0.5;
   settings->padding_fraction = 0.1;
+  settings->fit_tolerance = 0.0;
 }
 
 void
@@ -73,11 +82,88 @@ start (void *data, const char *xmlelem, const char **xmlattr)
 
       value = (char *)xmlattr[i + 1];
 
+      if (strcmp (name, GCODE_XML_ATTR_SETTING_STOCK_MODEL) == 0)
+      {
+        if (strcmp (value, GCODE_XML_VAL_SETTING_STOCK_MODEL_HEIGHT) == 0)
+          settings->stock_model = GCODE_STOCK_HEIGHT_MAP;
+        else
+          settings->stock_model = GCODE_STOCK_VOXEL_MAP;
+      }
+
+      if (strcmp (name, GCODE_XML_ATTR_SETTING_SIM_MODE) == 0)
+      {
+        if (strcmp (value, GCODE_XML_VAL_SETTING_SIM_MODE_SWEPT) == 0)
+          settings->sim_mode = GCODE_SIM_SWEPT;
+        else
+          settings->sim_mode = GCODE_SIM_STEPPED;
+      }
+
+      if (strcmp (name, GCODE_XML_ATTR_SETTING_SIM_THREADS) == 0)
+      {
+        settings->sim_threads = atoi (value);
+
+        if (settings->sim_threads < 0)
+          settings->sim_threads = 0;
+
+        if (settings->sim_threads > GCODE_SIM_MAX_THREADS)
+          settings->sim_threads = GCODE_SIM_MAX_THREADS;
+      }
+
+      if (strcmp (name, GCODE_XML_ATTR_SETTING_MAKE_THREADS) == 0)
+      {
+        settings->make_threads = atoi (value);
+
+        if (settings->make_threads < 0)
+          settings->make_threads = 0;
+
+        if (settings->make_threads > GCODE_MAKE_MAX_THREADS)
+          settings->make_threads = GCODE_MAKE_MAX_THREADS;
+      }
+
+      if (strcmp (name, GCODE_XML_ATTR_SETTING_COMPACT_OUTPUT) == 0)
+      {
+        if (strcmp (value, GCODE_XML_VAL_SETTING_COMPACT_OUTPUT_ON) == 0)
+          settings->compact_output = 1;
+        else
+          settings->compact_output = 0;
+      }
+
+      if (strcmp (name, GCODE_XML_ATTR_SETTING_SUBPROGRAMS) == 0)
+      {
+        if (strcmp (value, GCODE_XML_VAL_SETTING_SUBPROGRAMS_ON) == 0)
+          settings->subprograms = 1;
+        else
+          settings->subprograms = 0;
+      }
+
+      if (strcmp (name, GCODE_XML_ATTR_SETTING_VOXEL_LAYOUT) == 0)
+      {
+        if (strcmp (value, GCODE_XML_VAL_SETTING_VOXEL_LAYOUT_BYTE) == 0)
+          settings->voxel_layout = GCODE_VOXEL_BYTE;
+        else if (strcmp (value, GCODE_XML_VAL_SETTING_VOXEL_LAYOUT_RLE) == 0)
+          settings->voxel_layout = GCODE_VOXEL_RLE;
+        else if (strcmp (value, GCODE_XML_VAL_SETTING_VOXEL_LAYOUT_BRICK) == 0)
+          settings->voxel_layout = GCODE_VOXEL_BRICK;
+        else
+          settings->voxel_layout = GCODE_VOXEL_BIT;
+      }
+
       if (strcmp (name, GCODE_XML_ATTR_SETTING_VOXEL_RESOLUTION) == 0)
       {
         settings->voxel_resolution = atoi (value);
       }
 
+      if (strcmp (name, GCODE_XML_ATTR_SETTING_HEIGHT_RESOLUTION) == 0)
+      {
+        settings->height_resolution = atoi (value);
+
+        if (settings->height_resolution < 1)
+          settings->height_resolution = 1;
+
+        if (settings->height_resolution > 0xFFFF)
+          settings->height_resolution = 0xFFFF;
+      }
+
       if (strcmp (name, GCODE_XML_ATTR_SETTING_CURVE_SEGMENTS) == 0)
       {
         settings->curve_segments = atoi (value);
@@ -88,7 +174,7 @@ start (void *data, const char *xmlelem, const char **xmlattr)
 
       if (strcmp (name, GCODE_XML_ATTR_SETTING_ROUGHING_OVERLAP) == 0)
       {
-        settings->roughing_overlap = atof (value);
+        settings->roughing_overlap = gstrtod (value, NULL);
 
         if (settings->roughing_overlap < 0.0)
           settings->roughing_overlap = 0.0;
@@ -99,11 +185,19 @@ start (void *data, const char *xmlelem, const char **xmlattr)
 
       if (strcmp (name, GCODE_XML_ATTR_SETTING_PADDING_FRACTION) == 0)
       {
-        settings->padding_fraction = atof (value);
+        settings->padding_fraction = gstrtod (value, NULL);
 
         if (settings->padding_fraction < 0.0)
           settings->padding_fraction = 0.0;
       }
+
+      if (strcmp (name, GCODE_XML_ATTR_SETTING_FIT_TOLERANCE) == 0)
+      {
+        settings->fit_tolerance = gstrtod (value, NULL);
+
+        if (settings->fit_tolerance < 0.0)
+          settings->fit_tolerance = 0.0;
+      }
     }
   }
 }
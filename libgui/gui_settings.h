@@ -29,17 +29,52 @@ static const char *GCODE_XML_SETTINGS_FILENAME = "settings.xml";
 
 static const char *GCODE_XML_TAG_SETTING = "setting";
 
+static const char *GCODE_XML_ATTR_SETTING_STOCK_MODEL = "stock-model";
+static const char *GCODE_XML_ATTR_SETTING_SIM_MODE = "sim-mode";
+static const char *GCODE_XML_ATTR_SETTING_SIM_THREADS = "sim-threads";
+static const char *GCODE_XML_ATTR_SETTING_MAKE_THREADS = "make-threads";
+static const char *GCODE_XML_ATTR_SETTING_COMPACT_OUTPUT = "compact-output";
+static const char *GCODE_XML_ATTR_SETTING_SUBPROGRAMS = "subprograms";
+static const char *GCODE_XML_ATTR_SETTING_VOXEL_LAYOUT = "voxel-layout";
 static const char *GCODE_XML_ATTR_SETTING_VOXEL_RESOLUTION = "voxel-resolution";
+static const char *GCODE_XML_ATTR_SETTING_HEIGHT_RESOLUTION = "height-resolution";
 static const char *GCODE_XML_ATTR_SETTING_CURVE_SEGMENTS = "curve-segments";
 static const char *GCODE_XML_ATTR_SETTING_ROUGHING_OVERLAP = "roughing-overlap";
 static const char *GCODE_XML_ATTR_SETTING_PADDING_FRACTION = "padding-fraction";
+static const char *GCODE_XML_ATTR_SETTING_FIT_TOLERANCE = "fit-tolerance";
+
+static const char *GCODE_XML_VAL_SETTING_STOCK_MODEL_VOXEL = "voxel";
+static const char *GCODE_XML_VAL_SETTING_STOCK_MODEL_HEIGHT = "height";
+
+static const char *GCODE_XML_VAL_SETTING_SIM_MODE_STEPPED = "stepped";
+static const char *GCODE_XML_VAL_SETTING_SIM_MODE_SWEPT = "swept";
+
+static const char *GCODE_XML_VAL_SETTING_COMPACT_OUTPUT_ON = "on";
+static const char *GCODE_XML_VAL_SETTING_COMPACT_OUTPUT_OFF = "off";
+
+static const char *GCODE_XML_VAL_SETTING_SUBPROGRAMS_ON = "on";
+static const char *GCODE_XML_VAL_SETTING_SUBPROGRAMS_OFF = "off";
+
+static const char *GCODE_XML_VAL_SETTING_VOXEL_LAYOUT_BYTE = "byte";
+static const char *GCODE_XML_VAL_SETTING_VOXEL_LAYOUT_BIT = "bit";
+static const char *GCODE_XML_VAL_SETTING_VOXEL_LAYOUT_RLE = "rle";
+static const char *GCODE_XML_VAL_SETTING_VOXEL_LAYOUT_BRICK = "brick";
 
 typedef struct gui_settings_s
 {
+  int stock_model;
+  int sim_mode;
+  int sim_threads;
+  int make_threads;
+  int compact_output;
+  int subprograms;
+  int voxel_layout;
   int voxel_resolution;
+  int height_resolution;
   int curve_segments;
   gfloat_t roughing_overlap;
   gfloat_t padding_fraction;
+  gfloat_t fit_tolerance;
 } gui_settings_t;
 
 void gui_settings_init (gui_settings_t *settings);
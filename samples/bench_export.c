@@ -0,0 +1,261 @@
+/**
+ *  bench_export.c
+ *  Benchmark of G-Code export throughput and of the number formatting in it.
+ *
+ *  Copyright (C) 2006 - 2010 by Justin Shumaker
+ *  Copyright (C) 2014 - 2020 by Asztalos Attila Oszkár
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Exports a project a few times on a single thread, every block made afresh
+ * each time, and prints the best throughput in lines per second; then formats
+ * a run of coordinate words with 'gsprintf' and with the malloc-and-vsprintf
+ * version it replaced, kept here for reference, and prints both rates along
+ * with whether the two agreed on every pair. Built along with the rest by
+ * 'make' (not installed).
+ *
+ * Run as "./bench_export [project.gcam] [output.ngc]", by default on image.gcam.
+ */
+
+#include "gcode.h"
+#include <stdarg.h>
+#include <time.h>
+
+#ifndef BENCH_RUNS
+#define BENCH_RUNS                  10
+#endif
+
+#define BENCH_PAIRS                 1000000
+
+/**
+ * The 'gsprintf' the allocation-free one replaced: every call rewrites "%z"
+ * in a malloc'd copy of the format into "%.Nf", then hands it to vsprintf.
+ */
+
+static void
+bench_format_z (char *format, char **format2, unsigned int number)
+{
+  unsigned int i, j, s;
+
+  if (number > 9)
+    return;
+
+  s = strlen (format) + 1;
+  *format2 = malloc (2 * s);
+  memcpy (*format2, format, s);
+
+  j = 0;
+
+  for (i = 0; i < s - 1; i++)
+  {
+    if (format[i] == '%' && format[i + 1] == 'z')
+    {
+      (*format2)[j++] = format[i++];
+      (*format2)[j++] = '.';
+
+      sprintf (&(*format2)[j], "%d", number);
+      j++;
+
+      (*format2)[j++] = 'f';
+    }
+    else
+    {
+      (*format2)[j++] = format[i];
+    }
+  }
+
+  (*format2)[j] = 0;
+}
+
+static void
+bench_gsprintf (char *target, unsigned int number, char *format, ...)
+{
+  va_list arglist;
+  char *format2;
+
+  va_start (arglist, format);
+
+  format2 = NULL;
+
+  bench_format_z (format, &format2, number);
+  vsprintf (target, format2, arglist);
+
+  free (format2);
+
+  va_end (arglist);
+}
+
+static double
+bench_seconds (clock_t start)
+{
+  return ((double)(clock () - start) / CLOCKS_PER_SEC);
+}
+
+/**
+ * Count the lines of the exported file
+ */
+
+static uint32_t
+bench_lines (char *filename)
+{
+  FILE *fh;
+  uint32_t lines;
+  int c;
+
+  fh = fopen (filename, "r");
+
+  if (!fh)
+    return (0);
+
+  lines = 0;
+
+  while ((c = getc (fh)) != EOF)
+    if (c == '\n')
+      lines++;
+
+  fclose (fh);
+
+  return (lines);
+}
+
+static void
+bench_export (char *project, char *output)
+{
+  gcode_t gcode;
+  gcode_block_t *index_block;
+  double best, run;
+  clock_t start;
+  uint32_t lines;
+  int r;
+
+  gcode_init (&gcode);
+
+  gcode.format = GCODE_FORMAT_BIN;
+
+  if (gcode_load (&gcode, project) != 0)
+  {
+    gcode.format = GCODE_FORMAT_XML;
+
+    if (gcode_load (&gcode, project) != 0)
+    {
+      printf ("Failed to load '%s'\n", project);
+      return;
+    }
+  }
+
+  gcode.make_threads = 1;
+
+  best = -1.0;
+
+  for (r = 0; r < BENCH_RUNS; r++)
+  {
+    for (index_block = gcode.listhead; index_block; index_block = index_block->next)
+      index_block->make_stamp = 0;                                              // Nothing gets reused from the previous run
+
+    start = clock ();
+    gcode_export (&gcode, output);
+    run = bench_seconds (start);
+
+    if (best < 0.0 || run < best)
+      best = run;
+  }
+
+  lines = bench_lines (output);
+
+  printf ("export  %s: %u lines, %.2f ms, %.0f lines/s\n", project, lines, 1000.0 * best, lines / best);
+
+  gcode_free (&gcode);
+}
+
+/**
+ * The next coordinate pair, spread over a few inches
+ */
+
+static void
+bench_coordinates (uint32_t *seed, double *x, double *y)
+{
+  *seed = *seed * 1103515245 + 12345;
+  *x = (double)(*seed >> 8) / (double)(1 << 24) * 8.0 - 2.0;
+  *seed = *seed * 1103515245 + 12345;
+  *y = (double)(*seed >> 8) / (double)(1 << 24) * 8.0 - 2.0;
+}
+
+/**
+ * Format 'BENCH_PAIRS' coordinate pairs both ways: once to compare the results,
+ * then a few times over to time each way.
+ */
+
+static void
+bench_format (void)
+{
+  char string[2][64];
+  double best[2], run, x, y;
+  clock_t start;
+  uint32_t i, seed, differ;
+  int way, r;
+
+  differ = 0;
+  seed = 12345;
+
+  for (i = 0; i < BENCH_PAIRS; i++)
+  {
+    bench_coordinates (&seed, &x, &y);
+
+    gsprintf (string[0], 5, "X%z Y%z", x, y);
+    bench_gsprintf (string[1], 5, "X%z Y%z", x, y);
+
+    if (strcmp (string[0], string[1]) != 0)
+      differ++;
+  }
+
+  for (way = 0; way < 2; way++)
+  {
+    best[way] = -1.0;
+
+    for (r = 0; r < BENCH_RUNS; r++)
+    {
+      seed = 12345;
+
+      start = clock ();
+
+      for (i = 0; i < BENCH_PAIRS; i++)
+      {
+        bench_coordinates (&seed, &x, &y);
+
+        if (way)
+          bench_gsprintf (string[1], 5, "X%z Y%z", x, y);
+        else
+          gsprintf (string[0], 5, "X%z Y%z", x, y);
+      }
+
+      run = bench_seconds (start);
+
+      if (best[way] < 0.0 || run < best[way])
+        best[way] = run;
+    }
+  }
+
+  printf ("format  malloc + vsprintf: %.0f pairs/s, gsprintf: %.0f pairs/s, %u of %u pairs differ\n", BENCH_PAIRS / best[1], BENCH_PAIRS / best[0], differ, BENCH_PAIRS);
+}
+
+int
+main (int argc, char **argv)
+{
+  bench_export (argc > 1 ? argv[1] : "image.gcam", argc > 2 ? argv[2] : "bench_export.ngc");
+  bench_format ();
+
+  return (0);
+}
@@ -0,0 +1,302 @@
+/**
+ *  bench_stamp.c
+ *  Microbenchmark of the stepped end mill stamp of the G-Code simulator.
+ *
+ *  Copyright (C) 2006 - 2010 by Justin Shumaker
+ *  Copyright (C) 2014 - 2020 by Asztalos Attila Oszkár
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Carves a zig-zag of 3 passes of 16 G01 moves each into a 2 x 2 x 0.5 inch
+ * voxel map, on a single thread, for a few tool diameters and resolutions -
+ * once with the simulator (row span stamp) and once more along the very same
+ * steps with the per-cell stamp it replaced, kept here for reference. Prints
+ * the best time of a few runs of each in milliseconds, and whether the two
+ * maps came out the same. Built along with the rest by 'make' (not installed).
+ */
+
+#include "gcode.h"
+#include "gcode_sim.h"
+#include <time.h>
+
+#ifndef BENCH_RUNS
+#define BENCH_RUNS                  3
+#endif
+
+typedef struct bench_case_s
+{
+  uint32_t resolution;
+  gfloat_t diameter;
+} bench_case_t;
+
+static const bench_case_t bench_case[] =
+{
+  { 400, 0.0625 },
+  { 400, 0.25 },
+  { 400, 1.0 },
+  { 800, 0.25 },
+  { 800, 0.5 },
+  { 800, 1.0 },
+};
+
+/**
+ * Compile the zig-zag: each pass goes 0.1 deeper, back and forth along X while
+ * stepping along Y, well inside the stock.
+ */
+
+static void
+bench_compile (gcode_t *gcode, gcode_motion_list_t *list, gfloat_t diameter)
+{
+  gcode_motion_state_t state;
+  char line[256];
+  int pass, move;
+
+  gcode_motion_state_init (&state, gcode);
+
+  gsprintf (line, gcode->decimals, "(Tool Diameter: %z)", diameter);
+  gcode_motion_compile_line (list, &state, line, 0);
+
+  strcpy (line, "G00 Z0.10000");
+  gcode_motion_compile_line (list, &state, line, 0);
+
+  strcpy (line, "G00 X0.10000 Y0.10000");
+  gcode_motion_compile_line (list, &state, line, 0);
+
+  for (pass = 1; pass <= 3; pass++)
+  {
+    gsprintf (line, gcode->decimals, "G01 Z%z", -0.1 * pass);
+    gcode_motion_compile_line (list, &state, line, 0);
+
+    for (move = 0; move < 16; move++)
+    {
+      gsprintf (line, gcode->decimals, "G01 X%z Y%z", (move & 1) ? 0.1 : 1.9, 0.1 + 1.8 * (move + 1) / 16.0);
+      gcode_motion_compile_line (list, &state, line, 0);
+    }
+  }
+}
+
+/**
+ * The per-cell stamp the row span one replaced: every cell of the bounding box
+ * of the tool gets tested against the disk, and cleared one voxel at a time.
+ */
+
+static void
+bench_stamp_cell (gcode_t *gcode, gcode_sim_t *sim)
+{
+  int xind, yind, zind, min[3], max[3];
+  gfloat_t pos[3], xt, yt, xd, yd, rad;
+  uint8_t *data;
+
+  rad = 0.5 * sim->tool_diameter + 100.0 * GCODE_PRECISION;
+
+  pos[0] = sim->pos[0] + sim->origin[0];
+  pos[1] = sim->pos[1] + sim->origin[1];
+  pos[2] = sim->pos[2] - sim->origin[2];
+
+  min[0] = (int)((gfloat_t)gcode->voxel_number[0]) * (pos[0] - rad) / gcode->material_size[0];
+  min[1] = (int)((gfloat_t)gcode->voxel_number[1]) * (pos[1] - rad) / gcode->material_size[1];
+  min[2] = (int)((gfloat_t)gcode->voxel_number[2]) * (gcode->material_size[2] + pos[2]) / gcode->material_size[2];
+
+  max[0] = (int)((gfloat_t)gcode->voxel_number[0]) * (pos[0] + rad) / gcode->material_size[0];
+  max[1] = (int)((gfloat_t)gcode->voxel_number[1]) * (pos[1] + rad) / gcode->material_size[1];
+  max[2] = (int)((gfloat_t)gcode->voxel_number[2]) * (gcode->material_size[2] + pos[2] + (10.0 * rad)) / gcode->material_size[2];
+
+  if (min[0] < sim->clip_min[0])
+    min[0] = sim->clip_min[0];
+
+  if (min[1] < sim->clip_min[1])
+    min[1] = sim->clip_min[1];
+
+  if (min[2] < 0)
+    min[2] = 0;
+
+  if (max[0] > sim->clip_max[0])
+    max[0] = sim->clip_max[0];
+
+  if (max[1] > sim->clip_max[1])
+    max[1] = sim->clip_max[1];
+
+  if (max[2] < 0)
+    max[2] = min[2] - 1;
+
+  if (max[2] >= (int)gcode->voxel_number[2])
+    max[2] = gcode->voxel_number[2] - 1;
+
+  if (min[2] >= (int)gcode->voxel_number[2])
+    min[2] = max[2] + 1;
+
+  data = gcode->voxel_map.data;
+
+  for (yind = min[1]; yind <= max[1]; yind++)
+  {
+    yt = ((gfloat_t)yind * sim->vn_inv[1]) * gcode->material_size[1];
+    yd = yt - pos[1];
+
+    for (xind = min[0]; xind <= max[0]; xind++)
+    {
+      xt = ((gfloat_t)xind * sim->vn_inv[0]) * gcode->material_size[0];
+      xd = xt - pos[0];
+
+      if ((xd * xd + yd * yd) <= rad * rad)
+        for (zind = min[2]; zind <= max[2]; zind++)
+          data[((size_t)zind * gcode->voxel_number[1] + yind) * gcode->voxel_number[0] + xind] = 0;
+    }
+  }
+}
+
+/**
+ * Step along the (linear) motions exactly as the stepped simulation does, with
+ * the per-cell stamp at every step.
+ */
+
+static void
+bench_run_cell (gcode_t *gcode, gcode_sim_t *sim, gcode_motion_list_t *list)
+{
+  gcode_vec3d_t dvec, orig;
+  gfloat_t cur_dist, tot_dist, mag;
+  uint32_t i;
+
+  for (i = 0; i < list->number; i++)
+  {
+    sim->tool_diameter = list->motion[i].tool_diameter;
+
+    GCODE_MATH_VEC3D_COPY (orig, sim->pos);
+    GCODE_MATH_VEC3D_DIST (tot_dist, list->motion[i].xyz, orig);
+
+    GCODE_MATH_VEC3D_SUB (dvec, list->motion[i].xyz, orig);
+    GCODE_MATH_VEC3D_MAG (mag, dvec);
+
+    if (mag < GCODE_PRECISION)
+      continue;
+
+    GCODE_MATH_VEC3D_UNITIZE (dvec);
+    GCODE_MATH_VEC3D_MUL_SCALAR (dvec, dvec, sim->step_res);
+
+    do
+    {
+      GCODE_MATH_VEC3D_ADD (sim->pos, sim->pos, dvec);
+
+      GCODE_MATH_VEC3D_DIST (cur_dist, sim->pos, orig);
+
+      if (cur_dist > tot_dist)
+      {
+        GCODE_MATH_VEC3D_COPY (sim->pos, list->motion[i].xyz);
+      }
+
+      bench_stamp_cell (gcode, sim);
+    } while (cur_dist < tot_dist);
+  }
+}
+
+/**
+ * Carve the motions into a fresh stock, one way or the other; returns the time
+ * it took in milliseconds.
+ */
+
+static double
+bench_run (gcode_t *gcode, gcode_motion_list_t *list, int cell)
+{
+  gcode_sim_t sim;
+  clock_t start;
+
+  gcode_prep (gcode);
+
+  gcode_sim_init (&sim, gcode);
+
+  sim.vn_inv[0] = 1.0 / (gfloat_t)gcode->voxel_number[0];
+  sim.vn_inv[1] = 1.0 / (gfloat_t)gcode->voxel_number[1];
+  sim.vn_inv[2] = 1.0 / (gfloat_t)gcode->voxel_number[2];
+
+  start = clock ();
+
+  if (cell)
+    bench_run_cell (gcode, &sim, list);
+  else
+    gcode_sim_run (gcode, &sim, list);
+
+  gcode_sim_free (&sim);
+
+  return (1000.0 * (double)(clock () - start) / CLOCKS_PER_SEC);
+}
+
+int
+main (void)
+{
+  gcode_t gcode;
+  gcode_motion_list_t list;
+  double best[2], run;
+  uint8_t *map;
+  size_t size;
+  uint32_t i, r;
+  int cell, same;
+
+  printf ("%-6s %-8s %10s %10s  %s\n", "res", "dia", "per cell", "row span", "maps");
+
+  for (i = 0; i < sizeof (bench_case) / sizeof (bench_case_t); i++)
+  {
+    gcode_init (&gcode);
+
+    gcode.units = GCODE_UNITS_INCH;
+    gcode.material_size[0] = 2.0;
+    gcode.material_size[1] = 2.0;
+    gcode.material_size[2] = 0.5;
+    gcode.sim_mode = GCODE_SIM_STEPPED;
+    gcode.sim_threads = 1;
+    gcode.voxel_layout = GCODE_VOXEL_BYTE;                                      // The only layout the per-cell stamp knows of
+    gcode.voxel_resolution = bench_case[i].resolution;
+
+    gcode_motion_list_init (&list);
+
+    bench_compile (&gcode, &list, bench_case[i].diameter);
+
+    map = NULL;
+    size = 0;
+    same = 1;
+
+    for (cell = 1; cell >= 0; cell--)
+    {
+      best[cell] = -1.0;
+
+      for (r = 0; r < BENCH_RUNS; r++)
+      {
+        run = bench_run (&gcode, &list, cell);
+
+        if (best[cell] < 0.0 || run < best[cell])
+          best[cell] = run;
+      }
+
+      if (!map)
+      {
+        size = gcode.voxel_map.size;
+        map = malloc (size);
+        memcpy (map, gcode.voxel_map.data, size);
+      }
+      else
+      {
+        same = (size == gcode.voxel_map.size && memcmp (map, gcode.voxel_map.data, size) == 0);
+      }
+    }
+
+    printf ("%-6u %-8.4f %10.2f %10.2f  %s\n", bench_case[i].resolution, bench_case[i].diameter, best[1], best[0], same ? "same" : "DIFFERENT");
+    fflush (stdout);
+
+    free (map);
+    gcode_motion_list_free (&list);
+    gcode_free (&gcode);
+  }
+
+  return (0);
+}
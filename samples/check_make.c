@@ -0,0 +1,218 @@
+/**
+ *  check_make.c
+ *  Check of the reuse of block code by the threaded G-Code make.
+ *
+ *  Copyright (C) 2006 - 2010 by Justin Shumaker
+ *  Copyright (C) 2014 - 2020 by Asztalos Attila Oszkár
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Makes a project on CHECK_THREADS threads, counting the top-level blocks that
+ * actually get made: a second make with nothing changed must make none but the
+ * begin block (which is never reused), and one after renaming a single block
+ * must make just that one more; the code must come out the same as a make on
+ * a single thread every time. Prints what it found and exits with 1 if any of
+ * that does not hold. Built along with the rest by 'make' (not installed).
+ *
+ * Run as "./check_make [project.gcam ...]", by default on test.gcam.
+ */
+
+#include "gcode.h"
+
+#define CHECK_THREADS               4
+
+static gcode_make_t *check_make_of[256];                                        // The make of each block type, before being counted
+static int check_made;
+
+static void
+check_counted_make (gcode_block_t *block)
+{
+  __sync_fetch_and_add (&check_made, 1);
+
+  check_make_of[block->type] (block);
+}
+
+static int
+check_load (gcode_t *gcode, char *project, int threads)
+{
+  gcode_block_t *index_block;
+
+  gcode_init (gcode);
+
+  gcode->format = GCODE_FORMAT_BIN;
+
+  if (gcode_load (gcode, project) != 0)
+  {
+    gcode->format = GCODE_FORMAT_XML;
+
+    if (gcode_load (gcode, project) != 0)
+    {
+      printf ("Failed to load '%s'\n", project);
+      return (1);
+    }
+  }
+
+  gcode->make_threads = threads;
+
+  for (index_block = gcode->listhead; index_block; index_block = index_block->next)
+  {
+    if (index_block->make != check_counted_make)
+      check_make_of[index_block->type] = index_block->make;
+
+    index_block->make = check_counted_make;
+  }
+
+  return (0);
+}
+
+/**
+ * The fingerprint of the code of every top-level block of 'gcode' but the begin
+ * block (which carries the time it was made at), in order
+ */
+
+static uint64_t
+check_code (gcode_t *gcode)
+{
+  gcode_block_t *index_block;
+  gcode_rope_t *rope;
+  uint64_t hash;
+  uint32_t i;
+
+  hash = 0xCBF29CE484222325ULL;
+
+  for (index_block = gcode->listhead; index_block; index_block = index_block->next)
+  {
+    if (index_block->type == GCODE_TYPE_BEGIN)
+      continue;
+
+    rope = &index_block->code;
+
+    for (i = 0; i < rope->piece_number; i++)
+      hash = gcode_make_hash (hash, &rope->piece[i].chunk->data[rope->piece[i].offset], rope->piece[i].len);
+
+    hash = gcode_make_hash (hash, "\0", 1);
+  }
+
+  return (hash);
+}
+
+/**
+ * The last top-level block of 'gcode' other than a begin or an end block
+ */
+
+static gcode_block_t *
+check_last_block (gcode_t *gcode)
+{
+  gcode_block_t *index_block, *last_block;
+
+  last_block = NULL;
+
+  for (index_block = gcode->listhead; index_block; index_block = index_block->next)
+    if (index_block->type != GCODE_TYPE_BEGIN && index_block->type != GCODE_TYPE_END)
+      last_block = index_block;
+
+  return (last_block);
+}
+
+/**
+ * Make 'gcode' once more, returning the number of top-level blocks made
+ */
+
+static int
+check_remake (gcode_t *gcode)
+{
+  check_made = 0;
+
+  gcode_list_make (gcode);
+
+  return (check_made);
+}
+
+static int
+check_project (char *project)
+{
+  gcode_t gcode, serial;
+  int made, serial_made, begin, failed;
+
+  if (check_load (&gcode, project, CHECK_THREADS))
+    return (1);
+
+  if (check_load (&serial, project, 1))
+  {
+    gcode_free (&gcode);
+    return (1);
+  }
+
+  begin = (gcode.listhead && gcode.listhead->type == GCODE_TYPE_BEGIN) ? 1 : 0;
+
+  failed = 0;
+
+  made = check_remake (&gcode);
+  serial_made = check_remake (&serial);
+
+  printf ("%s: first make made %d blocks (%d on one thread), code %s\n", project, made, serial_made, check_code (&gcode) == check_code (&serial) ? "same" : "DIFFERENT");
+
+  if (check_code (&gcode) != check_code (&serial))
+    failed = 1;
+
+  made = check_remake (&gcode);
+
+  printf ("%s: make with nothing changed made %d blocks\n", project, made);
+
+  if (made != begin)
+    failed = 1;
+
+  if (check_last_block (&gcode))
+  {
+    strcat (check_last_block (&gcode)->comment, "*");
+    strcat (check_last_block (&serial)->comment, "*");
+
+    made = check_remake (&gcode);
+    check_remake (&serial);
+
+    printf ("%s: make with one block renamed made %d blocks, code %s\n", project, made, check_code (&gcode) == check_code (&serial) ? "same" : "DIFFERENT");
+
+    if (made != begin + 1 || check_code (&gcode) != check_code (&serial))
+      failed = 1;
+  }
+
+  gcode_free (&gcode);
+  gcode_free (&serial);
+
+  return (failed);
+}
+
+int
+main (int argc, char **argv)
+{
+  int i, failed;
+
+  failed = 0;
+
+  if (argc > 1)
+  {
+    for (i = 1; i < argc; i++)
+      failed |= check_project (argv[i]);
+  }
+  else
+  {
+    failed = check_project ("test.gcam");
+  }
+
+  printf ("%s\n", failed ? "FAILED" : "passed");
+
+  return (failed);
+}